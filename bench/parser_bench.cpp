@@ -0,0 +1,117 @@
+// Parser throughput for realistic ADD lines, fed in 4 KB reads the way
+// Session::onReadable delivers them. Binary frame decoding is measured on
+// the same orders for comparison.
+//
+//   make bench && ./bin/parser_bench [messages]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "BinaryProtocol.h"
+#include "Logging.h"
+#include "MessageParser.h"
+
+namespace {
+
+constexpr size_t READ_SIZE = 4096;
+const char* SYMBOLS[] = {"AAPL", "BTCUSD", "MSFT", "ES"};
+
+std::string makeTextStream(size_t count) {
+    std::string out;
+    char line[160];
+    for (size_t i = 0; i < count; ++i) {
+        int n = std::snprintf(line, sizeof(line), "ADD|%zu|1640995200%06zu|%zu|%s|%.2f|%zu|%s|GTC|LIMIT|%zu|0|0\n",
+                              i + 1, i % 1000000, 1000 + i, SYMBOLS[i % 4], 150.0 + (double)(i % 500) * 0.01,
+                              1 + i % 100, (i & 1) ? "SELL" : "BUY", 100 + i % 50);
+        out.append(line, (size_t)n);
+    }
+    return out;
+}
+
+std::string makeBinaryStream(size_t count) {
+    std::string out;
+    for (size_t i = 0; i < count; ++i) {
+        WireAdd w{};
+        w.header.length = sizeof(w);
+        w.header.type = (uint8_t)WireType::ADD;
+        w.header.sequence = i + 1;
+        w.orderId = 1000 + i;
+        std::strncpy(w.symbol, SYMBOLS[i % 4], sizeof(w.symbol));
+        w.price = BinaryCodec::toWirePrice(150.0 + (double)(i % 500) * 0.01);
+        w.quantity = 1 + i % 100;
+        w.participantId = 100 + i % 50;
+        w.side = (i & 1) ? 1 : 0;
+        out.append(reinterpret_cast<const char*>(&w), sizeof(w));
+    }
+    return out;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const char* name, size_t messages, size_t bytes, double secs, uint64_t checksum) {
+    std::printf("%-8s %10zu msgs  %8.3f s  %12.0f msgs/s  %8.1f MB/s  (checksum %llu)\n", name, messages, secs,
+                (double)messages / secs, (double)bytes / secs / 1e6, (unsigned long long)checksum);
+}
+
+void benchText(const std::string &stream, size_t expected, const SymbolTable &symbols) {
+    MessageParser parser;
+    parser.setSymbols(&symbols);
+    ParsedMessage msg;
+    size_t parsed = 0;
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t off = 0; off < stream.size(); off += READ_SIZE) {
+        parser.appendData(stream.data() + off, std::min(READ_SIZE, stream.size() - off));
+        MessageParser::Result r;
+        while ((r = parser.next(msg)) != MessageParser::Result::NEED_MORE) {
+            if (r != MessageParser::Result::MESSAGE) continue;
+            ++parsed;
+            checksum += msg.add.orderId + msg.add.quantity + msg.add.symbolId;
+        }
+    }
+    double secs = secondsSince(start);
+    if (parsed != expected) std::fprintf(stderr, "text: parsed %zu of %zu\n", parsed, expected);
+    report("text", parsed, stream.size(), secs, checksum);
+}
+
+void benchBinary(const std::string &stream, size_t expected, const SymbolTable &symbols) {
+    AddMessage msg;
+    size_t parsed = 0;
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    const char* p = stream.data();
+    const char* end = p + stream.size();
+    while (p + sizeof(WireHeader) <= end) {
+        const WireHeader &hdr = *reinterpret_cast<const WireHeader*>(p);
+        if (BinaryCodec::decodeAdd(p, hdr.length, symbols, msg)) {
+            ++parsed;
+            checksum += msg.orderId + msg.quantity + msg.symbolId;
+        }
+        p += hdr.length;
+    }
+    double secs = secondsSince(start);
+    if (parsed != expected) std::fprintf(stderr, "binary: decoded %zu of %zu\n", parsed, expected);
+    report("binary", parsed, stream.size(), secs, checksum);
+}
+
+}
+
+int main(int argc, char** argv) {
+    GLOBAL_LOG_LEVEL = LogLevel::ERROR;
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    std::string text = makeTextStream(count);
+    std::string binary = makeBinaryStream(count);
+    SymbolTable symbols;
+    for (const char* symbol : SYMBOLS) symbols.intern(symbol);
+
+    // First pass warms caches and the allocator
+    for (int round = 0; round < 2; ++round) {
+        benchText(text, count, symbols);
+        benchBinary(binary, count, symbols);
+    }
+    return 0;
+}
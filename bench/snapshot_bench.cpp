@@ -0,0 +1,84 @@
+// Snapshot cost against book size: the capture an engine thread pays, the
+// encode + durable write the snapshot thread pays, and the load + rebuild
+// paid at startup.
+//
+//   make bench && ./bin/snapshot_bench [directory]
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+#include "Logging.h"
+#include "OrderBook.h"
+#include "Snapshot.h"
+
+namespace {
+
+const std::string SYMBOL = "BENCH";
+const SymbolId SYMBOL_ID = 0;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Non-crossing book: bids below 10000 ticks, asks above, several orders per level
+void fillBook(OrderBook &book, MemoryPool<Order> &pool, size_t orders) {
+    for (size_t i = 0; i < orders; ++i) {
+        bool buy = (i & 1) == 0;
+        Price price = buy ? 9999 - (Price)(i % 2000) : 10001 + (Price)(i % 2000);
+        Order* o = pool.allocate();
+        new(o) Order(i + 1, buy ? Side::BUY : Side::SELL, SYMBOL_ID, price, 1 + i % 100, i, 100 + i % 50,
+                     TimeInForce::GTC, OrderType::LIMIT, 0, 0);
+        book.addOrder(o);
+    }
+}
+
+void benchSize(const std::string &directory, size_t orders) {
+    MemoryPool<Order> pool;
+    OrderBook book;
+    book.setMemoryPool(&pool);
+    fillBook(book, pool, orders);
+
+    EngineSnapshot snap;
+    snap.symbol = SYMBOL;
+    auto start = std::chrono::steady_clock::now();
+    book.captureState(snap.book);
+    double captureSecs = secondsSince(start);
+
+    SnapshotStore store(directory);
+    uint64_t lsn = orders;
+    start = std::chrono::steady_clock::now();
+    bool written = store.write(snap, lsn);
+    double writeSecs = secondsSince(start);
+
+    MemoryPool<Order> loadPool;
+    OrderBook loaded;
+    loaded.setMemoryPool(&loadPool);
+    EngineSnapshot in;
+    start = std::chrono::steady_clock::now();
+    bool ok = written && store.loadLatest(SYMBOL, in) && loaded.restoreState(in.book, SYMBOL_ID);
+    double loadSecs = secondsSince(start);
+    store.prune(SYMBOL, 0);
+
+    if (!ok || in.book.orders.size() != snap.book.orders.size()) {
+        std::fprintf(stderr, "%zu orders: snapshot round trip failed\n", orders);
+        return;
+    }
+    double mb = (double)(orders * sizeof(SnapshotOrder)) / 1e6;
+    std::printf("%10zu  %8.1f  %10.2f  %10.2f  %10.2f\n", orders, mb, captureSecs * 1e3, writeSecs * 1e3,
+                loadSecs * 1e3);
+}
+
+}
+
+int main(int argc, char** argv) {
+    GLOBAL_LOG_LEVEL = LogLevel::ERROR;
+    std::string directory = argc > 1 ? argv[1] : "snapshot_bench";
+    mkdir(directory.c_str(), 0755);
+
+    std::printf("%10s  %8s  %10s  %10s  %10s\n", "orders", "MB", "capture ms", "write ms", "load ms");
+    for (size_t orders : {1000, 10000, 100000, 1000000}) {
+        benchSize(directory, orders);
+    }
+    rmdir(directory.c_str());
+    return 0;
+}
@@ -1,9 +1,12 @@
+import sys
+
 from client import Client 
 from order import Order, OrderManager
 
 manager = OrderManager("orders.json")
 
-client = Client("127.0.0.1", 9999, manager)
+# python main.py --binary speaks the binary protocol instead of text
+client = Client("127.0.0.1", 9999, manager, binary="--binary" in sys.argv)
 client.connect()
 
 # Add a LIMIT order
@@ -11,9 +14,9 @@ order1 = Order(order_id = 1, symbol = "AAPL", side = "BUY", price = 110.0, quant
 print(f"Placing order: {order1}")
 client.add_order(order1)
 
-# Request a snapshot for AAPL
+# Request the top 5 levels of the AAPL book
 print("Requesting snapshot for AAPL...")
-client.request_snapshot(1, "AAPL")
+client.request_snapshot(1, "AAPL", depth=5)
 
 # Replace the order
 print(f"Replacing order {order1.order_id}")
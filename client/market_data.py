@@ -0,0 +1,129 @@
+"""Market data consumer (see src/MarketData.h).
+
+Joins the incremental and snapshot channels, builds each symbol's order book
+from a snapshot plus the incrementals after it, and prints top of book as it
+changes:
+
+    python market_data.py 239.1.1.1:30001 239.1.1.2:30002
+
+Works the same against unicast addresses of this host.
+"""
+import select
+import socket
+import struct
+import sys
+
+PRICE_SCALE = 100_000_000
+
+ORDER_ADD, ORDER_MODIFY, ORDER_DELETE, TRADE, LEVEL_UPDATE = 1, 2, 3, 4, 5
+SNAPSHOT_BEGIN, SNAPSHOT_ORDER, SNAPSHOT_END = 6, 7, 8
+
+_PACKET = struct.Struct("<QQHHIQ")
+_MESSAGE = struct.Struct("<HBBI8sQQ")
+_ORDER = struct.Struct("<QqQ")
+_TRADE = struct.Struct("<QQqQ")
+
+
+class Book:
+    def __init__(self):
+        self.orders = {}        # order id -> [side, price, quantity]
+        self.sequence = None    # last symbol sequence applied; None until a snapshot arrives
+        self.buffered = []      # incrementals received before that
+        self.loading = None     # snapshot being received: (sequence, orders)
+
+    def apply(self, kind, side, sequence, body):
+        if kind == TRADE:
+            buy, sell, price, qty = _TRADE.unpack_from(body)
+            print(f"  trade {qty} @ {price / PRICE_SCALE:g} (buy {buy}, sell {sell})")
+        elif kind in (ORDER_ADD, ORDER_MODIFY, ORDER_DELETE):
+            order_id, price, qty = _ORDER.unpack_from(body)
+            if kind == ORDER_DELETE:
+                self.orders.pop(order_id, None)
+            else:
+                self.orders[order_id] = [side, price, qty]
+        self.sequence = sequence
+
+    def top(self):
+        bids = [p for s, p, _ in self.orders.values() if s == 0]
+        asks = [p for s, p, _ in self.orders.values() if s == 1]
+        bid = max(bids) / PRICE_SCALE if bids else None
+        ask = min(asks) / PRICE_SCALE if asks else None
+        return bid, ask
+
+
+books = {}
+
+
+def on_incremental(symbol, kind, side, sequence, body):
+    book = books.setdefault(symbol, Book())
+    if book.sequence is None:
+        book.buffered.append((kind, side, sequence, body))
+        return
+    if sequence <= book.sequence:
+        return
+    if sequence != book.sequence + 1:
+        print(f"{symbol}: gap after {book.sequence}, waiting for the next snapshot")
+        books[symbol] = Book()
+        return
+    book.apply(kind, side, sequence, body)
+    print(f"{symbol} #{sequence}: bid={book.top()[0]} ask={book.top()[1]}")
+
+
+def on_snapshot(symbol, kind, side, sequence, body):
+    book = books.setdefault(symbol, Book())
+    if book.sequence is not None:
+        return
+    if kind == SNAPSHOT_BEGIN:
+        book.loading = (sequence, {})
+    elif kind == SNAPSHOT_ORDER and book.loading:
+        order_id, price, qty = _ORDER.unpack_from(body)
+        book.loading[1][order_id] = [side, price, qty]
+    elif kind == SNAPSHOT_END and book.loading:
+        book.sequence, book.orders = book.loading
+        book.loading = None
+        for item in book.buffered:
+            if item[2] > book.sequence:
+                book.apply(*item)
+        book.buffered = []
+        print(f"{symbol}: recovered at #{book.sequence} with {len(book.orders)} orders, "
+              f"bid={book.top()[0]} ask={book.top()[1]}")
+
+
+def open_channel(address):
+    host, port = address.rsplit(":", 1)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", int(port)))
+    if 224 <= int(host.split(".")[0]) <= 239:
+        membership = socket.inet_aton(host) + socket.inet_aton("0.0.0.0")
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    return sock
+
+
+def messages(packet):
+    _, _, count, length, _, _ = _PACKET.unpack_from(packet)
+    offset = _PACKET.size
+    for _ in range(count):
+        msg_len, kind, side, _, symbol, sequence, _ = _MESSAGE.unpack_from(packet, offset)
+        body = packet[offset + _MESSAGE.size:offset + msg_len]
+        yield symbol.rstrip(b"\0").decode(), kind, side, sequence, body
+        offset += msg_len
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        return
+    incremental = open_channel(sys.argv[1])
+    snapshot = open_channel(sys.argv[2])
+    while True:
+        ready, _, _ = select.select([incremental, snapshot], [], [])
+        for sock in ready:
+            packet = sock.recv(2048)
+            handler = on_incremental if sock is incremental else on_snapshot
+            for message in messages(packet):
+                handler(*message)
+
+
+if __name__ == "__main__":
+    main()
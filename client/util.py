@@ -1,3 +1,4 @@
+import struct
 import time
 
 def build_add_order_message(order_id: int, symbol: str, price: float, quantity: int, side: str, order_type: str, tif: str) -> str:
@@ -5,9 +6,9 @@ def build_add_order_message(order_id: int, symbol: str, price: float, quantity:
     return (f"ADD|{order_id}|{timestamp}|{order_id}|{symbol}|{price}|{quantity}|{side}|{tif}|{order_type}|"
             f"{order_id}|0.0|{quantity}\n")
 
-def build_snapshot_request_message(seq: int, symbol: str) -> str:
+def build_snapshot_request_message(seq: int, symbol: str, depth: int = 1) -> str:
     timestamp = int(time.time())
-    return f"SNAPSHOT_REQUEST|{seq}|{timestamp}|{symbol}\n"
+    return f"SNAPSHOT_REQUEST|{seq}|{timestamp}|{symbol}|{depth}\n"
 
 def build_cancel_order_message(order_id: int, participant_id: int) -> str:
     timestamp = int(time.time())
@@ -16,3 +17,96 @@ def build_cancel_order_message(order_id: int, participant_id: int) -> str:
 def build_cancel_replace_message(order_id: int, new_price: float, new_quantity: int, participant_id: int) -> str:
     timestamp = int(time.time())
     return f"CANCEL_REPLACE|{order_id}|{timestamp}|{order_id}|{new_price}|{new_quantity}|{participant_id}\n"
+
+# Binary protocol (see src/BinaryProtocol.h). A connection switches to it by
+# sending BINARY_MAGIC as its very first byte; every frame after that is a
+# little-endian packed struct led by a 20 byte header.
+
+BINARY_MAGIC = b"\xb1"
+PRICE_SCALE = 100_000_000
+
+WIRE_ADD = 1
+WIRE_CANCEL = 2
+WIRE_CANCEL_REPLACE = 3
+WIRE_SNAPSHOT_REQUEST = 4
+WIRE_ACK = 0x81
+WIRE_NACK = 0x82
+WIRE_EXECUTION = 0x83
+WIRE_SNAPSHOT = 0x84
+
+_HEADER = struct.Struct("<HBBQQ")
+_ADD = struct.Struct("<Q8sqQQQqBBB5x")
+_CANCEL = struct.Struct("<QQ")
+_CANCEL_REPLACE = struct.Struct("<QqQQ")
+_SNAPSHOT_REQUEST = struct.Struct("<8sI4x")
+_ACK = struct.Struct("<BB6x")
+_EXECUTION = struct.Struct("<Q8sqQQB7x")
+_SNAPSHOT = struct.Struct("<8sqqqHH4x")
+_DEPTH_LEVEL = struct.Struct("<qQI4x")
+
+_SIDES = {"BUY": 0, "SELL": 1}
+_TIFS = {"GTC": 0, "IOC": 1, "FOK": 2}
+_ORDER_TYPES = {"LIMIT": 0, "MARKET": 1, "STOP_LOSS": 2, "ICEBERG": 3}
+_REQUEST_NAMES = {WIRE_ADD: "ADD", WIRE_CANCEL: "CANCEL", WIRE_CANCEL_REPLACE: "CANCEL_REPLACE",
+                  WIRE_SNAPSHOT_REQUEST: "SNAPSHOT"}
+_REJECT_REASONS = {1: "OPEN_ORDERS", 2: "GROSS_NOTIONAL", 3: "POSITION", 4: "MESSAGE_RATE", 5: "RISK_CAPACITY"}
+
+def _frame(wire_type: int, seq: int, body: bytes) -> bytes:
+    timestamp = int(time.time())
+    return _HEADER.pack(_HEADER.size + len(body), wire_type, 0, seq, timestamp) + body
+
+def _wire_price(price: float) -> int:
+    return round(price * PRICE_SCALE)
+
+def _symbol(symbol: str) -> bytes:
+    return symbol.encode("ascii")[:8]
+
+def _symbol_str(raw: bytes) -> str:
+    return raw.rstrip(b"\0").decode("ascii")
+
+def build_binary_add_order_message(order_id: int, symbol: str, price: float, quantity: int, side: str, order_type: str, tif: str) -> bytes:
+    body = _ADD.pack(order_id, _symbol(symbol), _wire_price(price), quantity, quantity, order_id, 0,
+                     _SIDES[side], _TIFS[tif], _ORDER_TYPES[order_type])
+    return _frame(WIRE_ADD, order_id, body)
+
+def build_binary_snapshot_request_message(seq: int, symbol: str, depth: int = 1) -> bytes:
+    return _frame(WIRE_SNAPSHOT_REQUEST, seq, _SNAPSHOT_REQUEST.pack(_symbol(symbol), depth))
+
+def build_binary_cancel_order_message(order_id: int, participant_id: int) -> bytes:
+    return _frame(WIRE_CANCEL, order_id, _CANCEL.pack(order_id, participant_id))
+
+def build_binary_cancel_replace_message(order_id: int, new_price: float, new_quantity: int, participant_id: int) -> bytes:
+    body = _CANCEL_REPLACE.pack(order_id, _wire_price(new_price), new_quantity, participant_id)
+    return _frame(WIRE_CANCEL_REPLACE, order_id, body)
+
+def decode_binary_responses(data: bytes) -> tuple[list[str], bytes]:
+    """Decode whole frames into the text protocol's response lines so callers
+    can treat both protocols alike. Returns the lines and any leftover bytes."""
+    lines = []
+    off = 0
+    while len(data) - off >= _HEADER.size:
+        length, wire_type, _, seq, _ = _HEADER.unpack_from(data, off)
+        if len(data) - off < length:
+            break
+        body = off + _HEADER.size
+        if wire_type in (WIRE_ACK, WIRE_NACK):
+            request, reason = _ACK.unpack_from(data, body)
+            suffix = "ACK" if wire_type == WIRE_ACK else "NACK"
+            if reason:
+                suffix += f"|{_REJECT_REASONS.get(reason, reason)}"
+            lines.append(f"{_REQUEST_NAMES.get(request, request)}_{suffix}")
+        elif wire_type == WIRE_SNAPSHOT:
+            sym, bid, ask, last, bid_levels, ask_levels = _SNAPSHOT.unpack_from(data, body)
+            levels = [_DEPTH_LEVEL.unpack_from(data, body + _SNAPSHOT.size + i * _DEPTH_LEVEL.size)
+                      for i in range(bid_levels + ask_levels)]
+            depth = [",".join(f"{p / PRICE_SCALE:g}:{q}:{n}" for p, q, n in side)
+                     for side in (levels[:bid_levels], levels[bid_levels:])]
+            lines.append(f"SNAPSHOT|symbol={_symbol_str(sym)}|bestBid={bid / PRICE_SCALE}"
+                         f"|bestAsk={ask / PRICE_SCALE}|lastTradePrice={last / PRICE_SCALE}"
+                         f"|bids={depth[0]}|asks={depth[1]}")
+        elif wire_type == WIRE_EXECUTION:
+            order_id, sym, price, qty, leaves, side = _EXECUTION.unpack_from(data, body)
+            lines.append(f"EXECUTION|{seq}|{order_id}|{_symbol_str(sym)}|{'SELL' if side else 'BUY'}"
+                         f"|{price / PRICE_SCALE}|{qty}|{leaves}")
+        off += length
+    return lines, data[off:]
@@ -0,0 +1,151 @@
+#include "BinaryProtocol.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+uint64_t nowNanos() {
+    return (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+}
+
+void fillHeader(WireHeader &hdr, WireType type, uint16_t length, uint64_t sequence) {
+    hdr.length = length;
+    hdr.type = (uint8_t)type;
+    hdr.reserved = 0;
+    hdr.sequence = sequence;
+    hdr.timestamp = nowNanos();
+}
+
+MessageHeader toHeader(const WireHeader &hdr, MessageType type) {
+    return MessageHeader{type, hdr.sequence, hdr.timestamp};
+}
+
+void copySymbol(char (&dst)[8], const std::string &src) {
+    std::memset(dst, 0, sizeof(dst));
+    std::memcpy(dst, src.data(), std::min(src.size(), sizeof(dst)));
+}
+
+}
+
+bool BinaryCodec::decodeAdd(const char* frame, size_t len, const SymbolTable &symbols, AddMessage &out) {
+    if (len < sizeof(WireAdd)) return false;
+    const WireAdd &w = *reinterpret_cast<const WireAdd*>(frame);
+    if (w.side > (uint8_t)Side::SELL || w.tif > (uint8_t)TimeInForce::FOK ||
+        w.orderType > (uint8_t)OrderType::ICEBERG || w.stp > (uint8_t)SelfTradePrevention::DECREMENT_AND_CANCEL) {
+        return false;
+    }
+    out.header = toHeader(w.header, MessageType::ADD);
+    out.orderId = w.orderId;
+    out.symbolId = symbols.find(w.symbol);
+    out.price = fromWirePrice(w.price);
+    out.quantity = w.quantity;
+    out.side = (Side)w.side;
+    out.tif = (TimeInForce)w.tif;
+    out.orderType = (OrderType)w.orderType;
+    out.stp = (SelfTradePrevention)w.stp;
+    out.participantId = w.participantId;
+    out.triggerPrice = fromWirePrice(w.triggerPrice);
+    // Same default as the text protocol: fully visible unless stated
+    out.visibleQuantity = w.visibleQuantity ? w.visibleQuantity : w.quantity;
+    return true;
+}
+
+bool BinaryCodec::decodeCancel(const char* frame, size_t len, CancelMessage &out) {
+    if (len < sizeof(WireCancel)) return false;
+    const WireCancel &w = *reinterpret_cast<const WireCancel*>(frame);
+    out.header = toHeader(w.header, MessageType::CANCEL);
+    out.orderId = w.orderId;
+    out.participantId = w.participantId;
+    return true;
+}
+
+bool BinaryCodec::decodeCancelReplace(const char* frame, size_t len, CancelReplaceMessage &out) {
+    if (len < sizeof(WireCancelReplace)) return false;
+    const WireCancelReplace &w = *reinterpret_cast<const WireCancelReplace*>(frame);
+    out.header = toHeader(w.header, MessageType::CANCEL_REPLACE);
+    out.orderId = w.orderId;
+    out.newPrice = fromWirePrice(w.newPrice);
+    out.newQuantity = w.newQuantity;
+    out.participantId = w.participantId;
+    return true;
+}
+
+bool BinaryCodec::decodeSnapshotRequest(const char* frame, size_t len, const SymbolTable &symbols, SnapshotRequest &out) {
+    // Older clients send the frame without the depth field
+    if (len < offsetof(WireSnapshotRequest, depth)) return false;
+    const WireSnapshotRequest &w = *reinterpret_cast<const WireSnapshotRequest*>(frame);
+    out.header = toHeader(w.header, MessageType::SNAPSHOT_REQUEST);
+    out.symbolId = symbols.find(w.symbol);
+    uint32_t depth = len >= sizeof(WireSnapshotRequest) ? w.depth : 1;
+    out.depth = std::min(depth, MAX_SNAPSHOT_DEPTH);
+    return true;
+}
+
+WireAck BinaryCodec::encodeAck(MessageType request, uint64_t sequence, bool success, RejectReason reason) {
+    WireAck w{};
+    fillHeader(w.header, success ? WireType::ACK : WireType::NACK, sizeof(w), sequence);
+    w.requestType = (uint8_t)wireType(request);
+    w.reason = (uint8_t)reason;
+    return w;
+}
+
+void BinaryCodec::encodeSnapshot(const SnapshotResponse &resp, std::vector<char> &out) {
+    size_t bidLevels = std::min<size_t>(resp.bids.size(), MAX_SNAPSHOT_DEPTH);
+    size_t askLevels = std::min<size_t>(resp.asks.size(), MAX_SNAPSHOT_DEPTH);
+    size_t length = sizeof(WireSnapshot) + (bidLevels + askLevels) * sizeof(WireDepthLevel);
+    size_t start = out.size();
+    out.resize(start + length);
+
+    WireSnapshot w{};
+    fillHeader(w.header, WireType::SNAPSHOT, (uint16_t)length, resp.header.sequence);
+    copySymbol(w.symbol, resp.symbol);
+    w.bestBid = toWirePrice(resp.bestBid);
+    w.bestAsk = toWirePrice(resp.bestAsk);
+    w.lastTradePrice = toWirePrice(resp.lastTradePrice);
+    w.bidLevels = (uint16_t)bidLevels;
+    w.askLevels = (uint16_t)askLevels;
+    std::memcpy(out.data() + start, &w, sizeof(w));
+
+    char* p = out.data() + start + sizeof(w);
+    auto put = [&](const DepthLevel &level) {
+        WireDepthLevel l{};
+        l.price = toWirePrice(level.price);
+        l.quantity = level.quantity;
+        l.orderCount = level.orderCount;
+        std::memcpy(p, &l, sizeof(l));
+        p += sizeof(l);
+    };
+    for (size_t i = 0; i < bidLevels; ++i) put(resp.bids[i]);
+    for (size_t i = 0; i < askLevels; ++i) put(resp.asks[i]);
+}
+
+WireExecution BinaryCodec::encodeExecution(const FillReport &fill, const std::string &symbol) {
+    WireExecution w{};
+    fillHeader(w.header, WireType::EXECUTION, sizeof(w), fill.execId);
+    w.orderId = fill.orderId;
+    copySymbol(w.symbol, symbol);
+    w.price = toWirePrice(fill.price);
+    w.quantity = fill.quantity;
+    w.leavesQuantity = fill.leavesQuantity;
+    w.side = (uint8_t)fill.side;
+    return w;
+}
+
+WireType BinaryCodec::wireType(MessageType type) {
+    switch (type) {
+        case MessageType::ADD: return WireType::ADD;
+        case MessageType::CANCEL: return WireType::CANCEL;
+        case MessageType::CANCEL_REPLACE: return WireType::CANCEL_REPLACE;
+        case MessageType::SNAPSHOT_REQUEST: return WireType::SNAPSHOT_REQUEST;
+        case MessageType::EXECUTION: return WireType::EXECUTION;
+        case MessageType::SNAPSHOT_RESPONSE: return WireType::SNAPSHOT;
+        default: return WireType::NACK;
+    }
+}
+
+int64_t BinaryCodec::toWirePrice(double price) {
+    return (int64_t)std::llround(price * WIRE_PRICE_SCALE);
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Messages.h"
+
+// Fixed-layout little-endian binary protocol, spoken instead of the text
+// protocol by clients whose first byte on the connection is BINARY_MAGIC.
+//
+// Every frame starts with a WireHeader whose length covers the whole frame.
+// Frames are packed structs decoded straight out of the receive buffer: no
+// line scanning, no tokenizing, no number parsing. Prices are fixed point
+// (units of 1 / PRICE_SCALE) so the encoding does not depend on a symbol's
+// tick size; symbols are NUL-padded to 8 bytes.
+static_assert(std::endian::native == std::endian::little,
+              "binary protocol frames are decoded in place and assume a little-endian host");
+
+constexpr uint8_t BINARY_MAGIC = 0xB1;
+constexpr int64_t WIRE_PRICE_SCALE = 100000000;
+constexpr size_t WIRE_MAX_FRAME = 1024;
+
+enum class WireType : uint8_t {
+    // inbound
+    ADD = 1,
+    CANCEL = 2,
+    CANCEL_REPLACE = 3,
+    SNAPSHOT_REQUEST = 4,
+    // outbound
+    ACK = 0x81,
+    NACK = 0x82,
+    EXECUTION = 0x83,
+    SNAPSHOT = 0x84
+};
+
+#pragma pack(push, 1)
+struct WireHeader {
+    uint16_t length;   // whole frame, header included
+    uint8_t type;      // WireType
+    uint8_t reserved;
+    uint64_t sequence;
+    uint64_t timestamp;
+};
+
+struct WireAdd {
+    WireHeader header;
+    uint64_t orderId;
+    char symbol[8];
+    int64_t price;
+    uint64_t quantity;
+    uint64_t visibleQuantity;
+    uint64_t participantId;
+    int64_t triggerPrice;
+    uint8_t side;      // Side
+    uint8_t tif;       // TimeInForce
+    uint8_t orderType; // OrderType
+    uint8_t stp;       // SelfTradePrevention, 0 for the symbol's
+    uint8_t reserved[4];
+};
+
+struct WireCancel {
+    WireHeader header;
+    uint64_t orderId;
+    uint64_t participantId;
+};
+
+struct WireCancelReplace {
+    WireHeader header;
+    uint64_t orderId;
+    int64_t newPrice;
+    uint64_t newQuantity;
+    uint64_t participantId;
+};
+
+struct WireSnapshotRequest {
+    WireHeader header;
+    char symbol[8];
+    uint32_t depth;    // levels per side; frames without it ask for 1
+    uint32_t reserved;
+};
+
+// ACK/NACK, header.sequence echoes the request's sequence
+struct WireAck {
+    WireHeader header;
+    uint8_t requestType; // WireType of the request being answered
+    uint8_t reason;      // RejectReason of a NACK, 0 if none is given
+    uint8_t reserved[6];
+};
+
+// Fill report for one of the client's orders; header.sequence is the exec id
+struct WireExecution {
+    WireHeader header;
+    uint64_t orderId;
+    char symbol[8];
+    int64_t price;
+    uint64_t quantity;       // filled by this execution
+    uint64_t leavesQuantity; // still open
+    uint8_t side;            // Side
+    uint8_t reserved[7];
+};
+
+struct WireDepthLevel {
+    int64_t price;
+    uint64_t quantity;
+    uint32_t orderCount;
+    uint32_t reserved;
+};
+
+// Followed by bidLevels then askLevels WireDepthLevels, best first
+struct WireSnapshot {
+    WireHeader header;
+    char symbol[8];
+    int64_t bestBid;
+    int64_t bestAsk;
+    int64_t lastTradePrice;
+    uint16_t bidLevels;
+    uint16_t askLevels;
+    uint32_t reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(WireHeader) == 20);
+static_assert(sizeof(WireAdd) == 84);
+static_assert(sizeof(WireCancel) == 36);
+static_assert(sizeof(WireCancelReplace) == 52);
+static_assert(sizeof(WireSnapshotRequest) == 36);
+static_assert(sizeof(WireAck) == 28);
+static_assert(sizeof(WireExecution) == 68);
+static_assert(sizeof(WireDepthLevel) == 24);
+static_assert(sizeof(WireSnapshot) == 60);
+// Outbound frames may exceed WIRE_MAX_FRAME, which bounds what clients send
+static_assert(sizeof(WireSnapshot) + 2 * MAX_SNAPSHOT_DEPTH * sizeof(WireDepthLevel) <= UINT16_MAX);
+
+class BinaryCodec {
+public:
+    // Decoders take a complete frame (header.length bytes) and return false
+    // if it is too short or carries out-of-range enum values.
+    static bool decodeAdd(const char* frame, size_t len, const SymbolTable &symbols, AddMessage &out);
+    static bool decodeCancel(const char* frame, size_t len, CancelMessage &out);
+    static bool decodeCancelReplace(const char* frame, size_t len, CancelReplaceMessage &out);
+    static bool decodeSnapshotRequest(const char* frame, size_t len, const SymbolTable &symbols, SnapshotRequest &out);
+
+    static WireAck encodeAck(MessageType request, uint64_t sequence, bool success,
+                             RejectReason reason = RejectReason::NONE);
+    // Appends the whole variable-length frame to out
+    static void encodeSnapshot(const SnapshotResponse &resp, std::vector<char> &out);
+    static WireExecution encodeExecution(const FillReport &fill, const std::string &symbol);
+
+    static WireType wireType(MessageType type);
+    static int64_t toWirePrice(double price);
+    static double fromWirePrice(int64_t price) { return (double)price / WIRE_PRICE_SCALE; }
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "Price.h"
+
+// Flat copy of everything an OrderBook holds, used for snapshots. Orders are
+// listed in the order they must be re-inserted to recreate time priority.
+#pragma pack(push, 1)
+struct SnapshotOrder {
+    uint64_t orderId;
+    int64_t price;            // ticks
+    uint64_t quantity;
+    uint64_t timestamp;
+    uint64_t participantId;
+    int64_t triggerPrice;     // ticks
+    uint64_t visibleQuantity;
+    uint64_t hiddenQuantity;  // quantity is the displayed part
+    uint8_t side;
+    uint8_t tif;
+    uint8_t orderType;
+    uint8_t stp;              // SelfTradePrevention
+    uint8_t reserved[4];
+};
+
+struct SnapshotTrade {
+    int64_t price;            // ticks
+    uint64_t quantity;
+};
+#pragma pack(pop)
+
+struct BookState {
+    std::vector<SnapshotOrder> orders; // resting: bids best first, then asks, FIFO within a level
+    std::vector<SnapshotOrder> stops;  // untriggered stop orders
+    std::vector<SnapshotTrade> recentTrades; // oldest first
+    Price lastTradePrice = 0;
+    bool haveLastTrade = false;
+};
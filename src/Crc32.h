@@ -0,0 +1,30 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli), table driven. Used to detect torn or corrupt journal
+// records; not a cryptographic check.
+namespace crc32c_detail {
+constexpr std::array<uint32_t, 256> makeTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? (0x82F63B78u ^ (c >> 1)) : (c >> 1);
+        }
+        table[i] = c;
+    }
+    return table;
+}
+inline constexpr std::array<uint32_t, 256> TABLE = makeTable();
+}
+
+inline uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) {
+        crc = crc32c_detail::TABLE[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
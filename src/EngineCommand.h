@@ -0,0 +1,19 @@
+#pragma once
+#include <memory>
+#include <variant>
+#include "Messages.h"
+#include "ResponseChannel.h"
+
+class SnapshotManager;
+
+// Capture the book for a snapshot and hand it to sink
+struct CheckpointRequest {
+    SnapshotManager* sink = nullptr;
+};
+
+// A pre-parsed request queued to a MatchingEngine's thread. reply may be null
+// for requests nobody is waiting on.
+struct EngineCommand {
+    std::variant<std::monostate, AddMessage, CancelMessage, CancelReplaceMessage, SnapshotRequest, CheckpointRequest> msg;
+    std::shared_ptr<ResponseChannel> reply;
+};
@@ -1,15 +1,31 @@
 #include "EngineController.h"
 #include "Logging.h"
+#include <unordered_map>
 
 EngineController::EngineController(Replay &replay, SymbolConfigManager &cfg)
     : replayLog(replay), configManager(cfg) {}
 
-void EngineController::addEngineForSymbol(const std::string &symbol, double tickSize, uint64_t minQty, double minP, double maxP, double volThreshold, double refPrice) {
-    std::unique_lock lock(enginesMutex);
-    if (engines.find(symbol) != engines.end()) {
+EngineController::~EngineController() {
+    stopEngines();
+    for (MatchingEngine* engine : engineById_) {
+        delete engine;
+    }
+}
+
+void EngineController::addEngineForSymbol(const std::string &symbol, double tickSize, uint64_t minQty, double minP, double maxP, double volThreshold, double refPrice, BookType bookType, SelfTradePrevention selfTrade) {
+    if (started_) {
+        LOG(LogLevel::ERROR, "addEngineForSymbol: engines already started");
+        return;
+    }
+    if (symbols_.find(symbol) != INVALID_SYMBOL) {
         LOG(LogLevel::WARN, "addEngineForSymbol: already have engine for symbol");
         return;
     }
+    SymbolId id = symbols_.intern(symbol);
+    if (id == INVALID_SYMBOL) {
+        LOG(LogLevel::ERROR, "addEngineForSymbol: symbol must be 1-" << MAX_SYMBOL_LENGTH << " characters");
+        return;
+    }
 
     SymbolConfig sc;
     sc.tickSize = tickSize;
@@ -19,97 +35,180 @@ void EngineController::addEngineForSymbol(const std::string &symbol, double tick
     sc.volatilityThreshold = volThreshold;
     sc.referencePrice = refPrice;
     sc.tradingHalted = false;
-    configManager.setConfig(symbol, sc);
+    sc.bookType = bookType;
+    sc.selfTrade = selfTrade;
+    configManager.setConfig(id, sc);
 
-    MatchingEngine* engine = new MatchingEngine(symbol, replayLog, orderPool, configManager);
-    engines[symbol] = engine;
+    // Ids are dense and handed out in order, so the engine lands at its id
+    MatchingEngine* engine = new MatchingEngine(symbol, id, replayLog, orderPool, configManager);
+    engine->setOrderRoutes(&orderRoutes_);
+    engine->setParticipants(&participants_);
+    engineById_.push_back(engine);
 }
 
-bool EngineController::dispatchAdd(const AddMessage &msg) {
-    std::shared_lock lock(enginesMutex);
-    auto it = engines.find(msg.symbol);
-    if (it == engines.end()) {
-        LOG(LogLevel::ERROR, "dispatchAdd: No engine for symbol");
+bool EngineController::updateSymbolConfig(std::string_view symbol, const SymbolConfig &config) {
+    SymbolId id = symbols_.find(symbol);
+    if (id == INVALID_SYMBOL || config.tickSize <= 0 || config.minPrice > config.maxPrice) {
+        LOG(LogLevel::ERROR, "updateSymbolConfig: rejected update for " << symbol);
         return false;
     }
-    bool success = it->second->processAdd(msg);
-    if (success) {
-        std::lock_guard<std::mutex> l(orderSymbolMapMutex);
-        orderSymbolMap[msg.orderId] = msg.symbol;
+    return configManager.update(id, [&](SymbolConfig &c) { c = config; });
+}
+
+bool EngineController::haltSymbol(std::string_view symbol) {
+    return configManager.haltTrading(symbols_.find(symbol));
+}
+
+bool EngineController::resumeSymbol(std::string_view symbol) {
+    return configManager.resumeTrading(symbols_.find(symbol));
+}
+
+void EngineController::startEngines(int firstCpu) {
+    if (started_) return;
+    started_ = true;
+    if (marketDataOptions_.enabled()) {
+        marketData_ = std::make_unique<MarketDataPublisher>(symbols_, marketDataOptions_);
+        if (marketData_->open()) {
+            // Running before the engines hand it their books
+            marketData_->start();
+            for (MatchingEngine* engine : engineById_) engine->setMarketData(marketData_.get());
+        } else {
+            LOG(LogLevel::ERROR, "startEngines: market data feed could not be opened, publishing nothing");
+            marketData_.reset();
+        }
+    }
+    if (riskLimits_.enabled()) {
+        // After recovery, so books seed it with the orders they hold
+        risk_ = std::make_unique<RiskEngine>(riskLimits_, engineById_.size());
+        for (MatchingEngine* engine : engineById_) engine->setRisk(risk_.get());
+    }
+    int cpu = firstCpu;
+    for (MatchingEngine* engine : engineById_) {
+        engine->start(cpu);
+        if (cpu >= 0) ++cpu;
     }
-    return success;
+    snapshots_ = std::make_unique<SnapshotManager>(*this, replayLog, snapshotOptions_);
+    snapshots_->start();
 }
 
-bool EngineController::dispatchCancel(const CancelMessage &msg) {
-    std::string sym;
-    if (!findOrderSymbol(msg.orderId, sym)) {
-        LOG(LogLevel::ERROR, "dispatchCancel: Unknown orderId");
-        return false;
+void EngineController::stopEngines() {
+    if (!started_) return;
+    // Engines may still be handing captures to the snapshot manager
+    for (MatchingEngine* engine : engineById_) {
+        engine->stop();
     }
+    snapshots_.reset();
+    // Sends what the engines queued before they stopped
+    marketData_.reset();
+    started_ = false;
 
-    std::shared_lock lock(enginesMutex);
-    auto it = engines.find(sym);
-    if (it == engines.end()) {
-        LOG(LogLevel::ERROR, "dispatchCancel: No engine for symbol");
-        return false;
+    MemoryPoolStats pool = orderPool.stats();
+    LOG(LogLevel::INFO, "Order pool: " << pool.allocations << " allocations, " << pool.deallocations
+        << " deallocations, " << pool.refills << " refills, " << pool.flushes << " flushes, "
+        << pool.capacity << " slots in " << pool.chunks << " chunks (" << pool.hugeChunks << " huge)");
+    if (risk_) {
+        RiskStats risk = risk_->stats();
+        const uint64_t* r = risk.rejects;
+        LOG(LogLevel::INFO, "Risk: " << risk.checks << " checks, rejected " << r[(size_t)RejectReason::OPEN_ORDERS]
+            << " open orders, " << r[(size_t)RejectReason::GROSS_NOTIONAL] << " notional, "
+            << r[(size_t)RejectReason::POSITION] << " position, " << r[(size_t)RejectReason::MESSAGE_RATE]
+            << " rate, " << r[(size_t)RejectReason::RISK_CAPACITY] << " capacity");
     }
-    return it->second->processCancel(msg);
 }
 
-bool EngineController::dispatchCancelReplace(const CancelReplaceMessage &msg) {
-    std::string sym;
-    if (!findOrderSymbol(msg.orderId, sym)) {
-        LOG(LogLevel::ERROR, "dispatchCancelReplace: Unknown orderId");
+bool EngineController::recover() {
+    if (started_) {
+        LOG(LogLevel::ERROR, "recover: engines already started");
         return false;
     }
+    SnapshotStore store(snapshotOptions_.directory);
+    std::unordered_map<std::string, uint64_t> fromLsn;
+    for (MatchingEngine* engine : engineById_) {
+        const std::string &symbol = engine->symbol();
+        EngineSnapshot snap;
+        if (!store.loadLatest(symbol, snap)) continue;
+        if (!engine->restoreSnapshot(snap)) {
+            LOG(LogLevel::WARN, "recover: snapshot for " << symbol << " not usable, replaying the full journal");
+            continue;
+        }
+        for (const SnapshotOrder &o : snap.book.orders) recordOrder(o.orderId, *engine);
+        for (const SnapshotOrder &o : snap.book.stops) recordOrder(o.orderId, *engine);
+        fromLsn[symbol] = snap.lsn.load();
+        LOG(LogLevel::INFO, "recover: " << symbol << " restored from snapshot at lsn " << snap.lsn.load()
+            << " with " << snap.book.orders.size() << " resting orders");
+    }
+    return replayLog.replayAll(*this, fromLsn);
+}
 
-    std::shared_lock lock(enginesMutex);
-    auto it = engines.find(sym);
-    if (it == engines.end()) {
-        LOG(LogLevel::ERROR, "dispatchCancelReplace: No engine for symbol");
-        return false;
+void EngineController::requestSnapshots(SnapshotManager &sink) {
+    for (MatchingEngine* engine : engineById_) {
+        if (!engine->submit(EngineCommand{CheckpointRequest{&sink}, nullptr})) {
+            LOG(LogLevel::WARN, "requestSnapshots: " << engine->symbol() << " is saturated, skipping this round");
+        }
     }
-    return it->second->processCancelReplace(msg);
 }
 
-void EngineController::dispatchSnapshotRequest(const SnapshotRequest &msg) {
-    std::shared_lock lock(enginesMutex);
-    auto it = engines.find(msg.symbol);
-    if (it == engines.end()) {
-        LOG(LogLevel::ERROR, "dispatchSnapshotRequest: No engine for symbol");
-        return;
+std::vector<MatchingEngine*> EngineController::allEngines() const {
+    return engineById_;
+}
+
+MatchingEngine* EngineController::findEngine(std::string_view symbol) const {
+    return findEngine(symbols_.find(symbol));
+}
+
+bool EngineController::topOfBook(std::string_view symbol, TopOfBook &out) const {
+    MatchingEngine* engine = findEngine(symbol);
+    if (!engine) return false;
+    out = engine->topOfBook();
+    return true;
+}
+
+bool EngineController::dispatchAdd(const AddMessage &msg, std::shared_ptr<ResponseChannel> reply) {
+    MatchingEngine* engine = findEngine(msg.symbolId);
+    if (!engine) {
+        LOG(LogLevel::ERROR, "dispatchAdd: No engine for symbol");
+        return false;
     }
-    it->second->processSnapshotRequest(msg);
+    // Recorded before the engine has seen the order so a cancel sent right
+    // behind it is routed to the same queue; the engine rejects cancels for
+    // orders it never accepted.
+    recordOrder(msg.orderId, *engine);
+    return engine->submit(EngineCommand{msg, std::move(reply)});
 }
 
-double EngineController::getLastTradePrice(const std::string &symbol) const {
-    std::shared_lock lock(enginesMutex);
-    auto it = engines.find(symbol);
-    if (it == engines.end()) {
-        throw std::runtime_error("getLastTradePrice: No machine engine for symbol");
+bool EngineController::dispatchCancel(const CancelMessage &msg, std::shared_ptr<ResponseChannel> reply) {
+    MatchingEngine* engine = findOrderEngine(msg.orderId);
+    if (!engine) {
+        LOG(LogLevel::ERROR, "dispatchCancel: Unknown orderId");
+        return false;
     }
-    return it->second->getLastTradePrice();
+    return engine->submit(EngineCommand{msg, std::move(reply)});
 }
 
-void EngineController::getTopOfBook(const std::string &symbol, double &bestBid, double &bestAsk) {
-    std::shared_lock lock(enginesMutex);
-    auto it = engines.find(symbol);
-    if (it == engines.end()) {
-        throw std::runtime_error("getTopOfBook: No engine for symbol " + symbol);
+bool EngineController::dispatchCancelReplace(const CancelReplaceMessage &msg, std::shared_ptr<ResponseChannel> reply) {
+    MatchingEngine* engine = findOrderEngine(msg.orderId);
+    if (!engine) {
+        LOG(LogLevel::ERROR, "dispatchCancelReplace: Unknown orderId");
+        return false;
     }
-    it->second->orderBook.getTopOfBook(bestBid, bestAsk);
+    return engine->submit(EngineCommand{msg, std::move(reply)});
 }
 
-void EngineController::recordOrderSymbol(uint64_t orderId, const std::string &symbol) {
-    std::lock_guard<std::mutex> lock(orderSymbolMapMutex);
-    orderSymbolMap[orderId] = symbol;
+bool EngineController::dispatchSnapshotRequest(const SnapshotRequest &msg, std::shared_ptr<ResponseChannel> reply) {
+    MatchingEngine* engine = findEngine(msg.symbolId);
+    if (!engine) {
+        LOG(LogLevel::ERROR, "dispatchSnapshotRequest: No engine for symbol");
+        return false;
+    }
+    return engine->submit(EngineCommand{msg, std::move(reply)});
 }
 
-bool EngineController::findOrderSymbol(uint64_t orderId, std::string &symbol) {
-    std::lock_guard<std::mutex> lock(orderSymbolMapMutex);
-    auto it = orderSymbolMap.find(orderId);
-    if (it == orderSymbolMap.end()) return false;
-    symbol = it->second;
-    return true;
+void EngineController::recordOrder(uint64_t orderId, const MatchingEngine &engine) {
+    orderRoutes_.record(orderId, engine.symbolId());
 }
 
+MatchingEngine* EngineController::findOrderEngine(uint64_t orderId) {
+    SymbolId symbolId = INVALID_SYMBOL;
+    if (!orderRoutes_.find(orderId, symbolId)) return nullptr;
+    return findEngine(symbolId);
+}
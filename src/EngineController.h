@@ -1,37 +1,107 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <shared_mutex>
+#include <vector>
+#include <memory>
 #include "MatchingEngine.h"
+#include "MarketData.h"
+#include "ResponseChannel.h"
+#include "RiskEngine.h"
+#include "Snapshot.h"
 #include "Replay.h"
 #include "MemoryPool.h"
+#include "OrderIndex.h"
 #include "SymbolConfig.h"
+#include "SymbolTable.h"
 
+// Routes requests to the engine owning each symbol. All engines must be added
+// before startEngines(); after that the engine table is read-only and the
+// dispatch path takes no lock on it.
 class EngineController {
 public:
     EngineController(Replay &replay, SymbolConfigManager &configManager);
+    ~EngineController();
 
-    bool dispatchAdd(const AddMessage &msg);
-    bool dispatchCancel(const CancelMessage &msg);
-    bool dispatchCancelReplace(const CancelReplaceMessage &msg);
-    void dispatchSnapshotRequest(const SnapshotRequest &msg);
-    double getLastTradePrice(const std::string &symbol) const;
-    void getTopOfBook(const std::string &symbol, double &bestBid, double &bestAsk);
-    
-    void addEngineForSymbol(const std::string &symbol, double tickSize, uint64_t minQty, double minP, double maxP, double volThreshold, double refPrice);
+    // Queue a request on its engine's thread; the result arrives on reply.
+    // Returns false if the request could not be queued (unknown symbol or
+    // order, or the engine is saturated), in which case nothing is delivered.
+    // Safe from any number of network threads: engine rings take multiple
+    // producers and the order route and participant tables are sharded.
+    bool dispatchAdd(const AddMessage &msg, std::shared_ptr<ResponseChannel> reply);
+    bool dispatchCancel(const CancelMessage &msg, std::shared_ptr<ResponseChannel> reply);
+    bool dispatchCancelReplace(const CancelReplaceMessage &msg, std::shared_ptr<ResponseChannel> reply);
+    bool dispatchSnapshotRequest(const SnapshotRequest &msg, std::shared_ptr<ResponseChannel> reply);
+
+    // Engine threads are pinned to firstCpu, firstCpu+1, ... when firstCpu >= 0
+    void startEngines(int firstCpu = -1);
+    void stopEngines();
+
+    // Admin changes, any thread. Published to the symbol's engine without
+    // stopping it; a new tick size or book layout waits for an empty book.
+    bool updateSymbolConfig(std::string_view symbol, const SymbolConfig &config);
+    bool haltSymbol(std::string_view symbol);
+    bool resumeSymbol(std::string_view symbol);
+
+    // Snapshot location and period; set before recover() and startEngines()
+    void setSnapshotOptions(const SnapshotOptions &options) { snapshotOptions_ = options; }
+    // Market data feed; set before startEngines(). Off unless a destination is given.
+    void setMarketDataOptions(const MarketDataOptions &options) { marketDataOptions_ = options; }
+    // Pre-trade risk limits; set before startEngines(). Off unless a limit is given.
+    void setRiskLimits(const RiskLimits &limits) { riskLimits_ = limits; }
+    // Checks and rejects by reason so far; all zero while risk is off
+    RiskStats riskStats() const { return risk_ ? risk_->stats() : RiskStats{}; }
+    // Order pool sizing and backing; call before recover() and startEngines()
+    bool configureOrderPool(const MemoryPoolOptions &options) { return orderPool.configure(options); }
+
+    // Rebuild every book from its latest snapshot plus the journal after it,
+    // or from the whole journal; must run before startEngines()
+    bool recover();
+
+    // Queue a checkpoint on every engine; captures are handed to sink
+    void requestSnapshots(SnapshotManager &sink);
+    std::vector<MatchingEngine*> allEngines() const;
+
+    // Null if no engine trades symbol. Engines may only be driven directly
+    // before startEngines().
+    MatchingEngine* findEngine(std::string_view symbol) const;
+    MatchingEngine* findEngine(SymbolId id) const {
+        return id < engineById_.size() ? engineById_[id] : nullptr;
+    }
+    // Any thread, lock-free: the symbol's TopOfBook as of its last request
+    bool topOfBook(std::string_view symbol, TopOfBook &out) const;
+    // Read-only once sessions are running; parsers intern against it
+    const SymbolTable& symbols() const { return symbols_; }
+    // Route later cancels of orderId to engine; null once the order is gone
+    void recordOrder(uint64_t orderId, const MatchingEngine &engine);
+    MatchingEngine* findOrderEngine(uint64_t orderId);
+    // Any thread: send participantId's fills to channel from now on
+    void bindParticipant(uint64_t participantId, const std::shared_ptr<ResponseChannel> &channel) {
+        participants_.bind(participantId, channel);
+    }
+
+    void addEngineForSymbol(const std::string &symbol, double tickSize, uint64_t minQty, double minP, double maxP, double volThreshold, double refPrice, BookType bookType = BookType::MAP,
+                            SelfTradePrevention selfTrade = SelfTradePrevention::CANCEL_NEWEST);
 
 private:
-    std::unordered_map<std::string, MatchingEngine*> engines;
-    mutable std::shared_mutex enginesMutex; 
+    SymbolTable symbols_;
+    bool started_ = false;
+    SnapshotOptions snapshotOptions_;
+    std::unique_ptr<SnapshotManager> snapshots_;
+    MarketDataOptions marketDataOptions_;
+    std::unique_ptr<MarketDataPublisher> marketData_;
+    RiskLimits riskLimits_;
+    std::unique_ptr<RiskEngine> risk_;
     Replay &replayLog;
     MemoryPool<Order> orderPool; 
     SymbolConfigManager &configManager;
 
-    // We'll need a map orderId->symbol for cancel
-    std::unordered_map<uint64_t, std::string> orderSymbolMap;
-    std::mutex orderSymbolMapMutex;
+    // Indexed by SymbolId
+    std::vector<MatchingEngine*> engineById_;
+    // Live order id -> symbol id for cancel routing; engines retire entries
+    OrderRouteIndex orderRoutes_;
+    // Participant id -> session channel for fill reports
+    ParticipantRegistry participants_;
 
-    void recordOrderSymbol(uint64_t orderId, const std::string &symbol);
-    bool findOrderSymbol(uint64_t orderId, std::string &symbol);
 };
 
@@ -0,0 +1,99 @@
+#include "EpollPoller.h"
+
+#if PLUTUS_HAVE_EPOLL
+
+#include "Logging.h"
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <errno.h>
+
+EpollPoller::~EpollPoller() {
+    if (epfd_ >= 0) close(epfd_);
+}
+
+bool EpollPoller::init() {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ < 0) {
+        LOG(LogLevel::ERROR, "epoll creation failed");
+        return false;
+    }
+    return true;
+}
+
+bool EpollPoller::addListener(int fd) {
+    listenFd_ = fd;
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG(LogLevel::ERROR, "epoll ADD listenFd failed");
+        return false;
+    }
+    return true;
+}
+
+bool EpollPoller::addClient(int fd) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        LOG(LogLevel::ERROR, "epoll ADD clientFd failed");
+        return false;
+    }
+    return true;
+}
+
+void EpollPoller::removeClient(int fd) {
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+bool EpollPoller::armWrite(int fd) {
+    // Edge-triggered EPOLLOUT fires on the transition to writable, and once
+    // immediately if the socket is already writable when re-armed.
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLOUT | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        LOG(LogLevel::ERROR, "Failed to register writable event for fd=" << fd);
+        return false;
+    }
+    return true;
+}
+
+int EpollPoller::wait(PollEvent* out, int maxEvents) {
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+    // A single epoll event can expand into a READABLE and a WRITABLE
+    int want = maxEvents / 2;
+    if (want > MAX_EVENTS) want = MAX_EVENTS;
+    if (want < 1) want = 1;
+
+    while (true) {
+        int n = epoll_wait(epfd_, events, want, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG(LogLevel::ERROR, "epoll wait error");
+            return -1;
+        }
+
+        int count = 0;
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t mask = events[i].events;
+            if (fd == listenFd_) {
+                out[count++] = PollEvent{fd, PollEvent::Kind::ACCEPTABLE};
+                continue;
+            }
+            // HUP/ERR/RDHUP are surfaced through read() returning 0 or an error
+            if (mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                out[count++] = PollEvent{fd, PollEvent::Kind::READABLE};
+            }
+            if (mask & EPOLLOUT) {
+                out[count++] = PollEvent{fd, PollEvent::Kind::WRITABLE};
+            }
+        }
+        return count;
+    }
+}
+
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+#include "Poller.h"
+
+#if defined(__linux__)
+#define PLUTUS_HAVE_EPOLL 1
+#else
+#define PLUTUS_HAVE_EPOLL 0
+#endif
+
+#if PLUTUS_HAVE_EPOLL
+
+// Edge-triggered epoll backend. Sessions already drain reads until EAGAIN, so
+// each fd only wakes the loop once per burst of incoming data.
+class EpollPoller : public Poller {
+public:
+    ~EpollPoller() override;
+
+    const char* name() const override { return "epoll"; }
+    bool init() override;
+
+    bool addListener(int fd) override;
+    bool addClient(int fd) override;
+    void removeClient(int fd) override;
+    bool armWrite(int fd) override;
+
+    int wait(PollEvent* out, int maxEvents) override;
+
+private:
+    int epfd_ = -1;
+    int listenFd_ = -1;
+};
+
+#endif
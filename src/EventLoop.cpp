@@ -1,73 +1,84 @@
 #include "EventLoop.h"
 #include "Logging.h"
 #include "NetworkInterface.h"
-#include <sys/event.h>
 #include <unistd.h>
 #include <errno.h>
 
 EventLoop::EventLoop(EngineController &controller)
     : controller_(controller) {}
 
-bool EventLoop::init(int listenFd) {
+bool EventLoop::init(int listenFd, const std::string &pollerBackend) {
     listenFd_ = listenFd;
-    kqfd_ = kqueue();
-    if (kqfd_ < 0) {
-        LOG(LogLevel::ERROR, "kqueue creation failed");
+    poller_ = Poller::create(pollerBackend);
+    if (!poller_ || !poller_->init()) {
+        LOG(LogLevel::ERROR, "Poller creation failed");
         return false;
     }
-
-    struct kevent ev;
-    EV_SET(&ev, listenFd_, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, nullptr);
-    if (kevent(kqfd_, &ev, 1, nullptr, 0, nullptr) < 0) {
-        LOG(LogLevel::ERROR, "kevent ADD listenFd failed");
+    if (!poller_->addListener(listenFd_)) {
+        return false;
+    }
+    // Engine threads wake the loop through the notifier when responses are ready
+    if (!notifier_.valid() || !poller_->addClient(notifier_.fd())) {
+        LOG(LogLevel::ERROR, "Failed to register engine notifier");
         return false;
     }
+    LOG(LogLevel::INFO, "Event loop using " << poller_->name() << " poller");
     return true;
 }
 
 void EventLoop::run() {
     const int MAX_EVENTS = 64;
-    struct kevent events[MAX_EVENTS];
+    PollEvent events[MAX_EVENTS];
 
     while (true) {
-        int n = kevent(kqfd_, nullptr, 0, events, MAX_EVENTS, nullptr);
+        int n = poller_->wait(events, MAX_EVENTS);
         if (n < 0) {
-            if (errno == EINTR) continue;
-            LOG(LogLevel::ERROR, "kevent wait error");
+            LOG(LogLevel::ERROR, "poller wait error");
             break;
         }
 
         for (int i = 0; i < n; ++i) {
-            int fd = (int)events[i].ident;
-            int16_t filter = events[i].filter;
-
-            if (fd == listenFd_) {
+            const PollEvent &ev = events[i];
+            if (ev.kind == PollEvent::Kind::ACCEPTABLE) {
                 if (!handleNewConnection()) {
                     LOG(LogLevel::ERROR, "handleNewConnection failed");
                 }
+            } else if (ev.kind == PollEvent::Kind::ACCEPTED) {
+                if (!addSession(ev.fd)) {
+                    LOG(LogLevel::ERROR, "handleNewConnection failed");
+                }
+            } else if (ev.fd == notifier_.fd()) {
+                handleResponses();
             } else {
-                if (!handleEvent(fd, filter)) {
-                    removeSession(fd);
+                if (!handleEvent(ev)) {
+                    removeSession(ev.fd);
                 }
             }
         }
+        // One write per session for everything this batch of events produced
+        flushSessions();
     }
 }
 
 bool EventLoop::handleNewConnection() {
+    // Drain the accept queue; edge-triggered pollers will not report it again
     NetworkInterface net;
-    std::string addr;
-    int clientFd = net.acceptClient(listenFd_, addr);
-    if (clientFd < 0) {
-        return true;
+    while (true) {
+        std::string addr;
+        int clientFd = net.acceptClient(listenFd_, addr);
+        if (clientFd < 0) {
+            return true;
+        }
+        if (!addSession(clientFd)) {
+            return false;
+        }
     }
+}
 
-    Session *sess = new Session(clientFd, controller_, kqfd_);
+bool EventLoop::addSession(int clientFd) {
+    Session *sess = new Session(clientFd, controller_, *poller_, notifier_);
 
-    struct kevent ev;
-    EV_SET(&ev, clientFd, EVFILT_READ, EV_ADD | EV_ENABLE | EV_CLEAR, 0, 0, nullptr);
-    if (kevent(kqfd_, &ev, 1, nullptr, 0, nullptr) < 0) {
-        LOG(LogLevel::ERROR, "kevent ADD clientFd failed");
+    if (!poller_->addClient(clientFd)) {
         delete sess;
         return false;
     }
@@ -77,34 +88,71 @@ bool EventLoop::handleNewConnection() {
     return true;
 }
 
-bool EventLoop::handleEvent(int fd, int16_t filter) {
-    auto it = sessions_.find(fd);
+bool EventLoop::handleEvent(const PollEvent &ev) {
+    auto it = sessions_.find(ev.fd);
     if (it == sessions_.end()) {
         LOG(LogLevel::WARN, "Event for unknown fd");
-        return false;
+        return true;
     }
     Session* sess = it->second;
 
-    if (filter == EVFILT_READ) {
-        if (!sess->onReadable()) return false;
-    } else if (filter == EVFILT_WRITE) {
-        if (!sess->onWritable()) return false;
+    bool ok = true;
+    switch (ev.kind) {
+        case PollEvent::Kind::READABLE:
+            ok = sess->onReadable();
+            break;
+        case PollEvent::Kind::DATA:
+            ok = sess->onData(ev.data, ev.len);
+            break;
+        case PollEvent::Kind::WRITABLE:
+            return sess->onWritable();
+        case PollEvent::Kind::HANGUP:
+            return false;
+        default:
+            return true;
     }
+    if (ok) scheduleFlush(sess);
+    return ok;
+}
 
-    return true;
+void EventLoop::scheduleFlush(Session* sess) {
+    if (sess->wantsFlush()) flushQueue_.push_back(sess->getFd());
+}
+
+void EventLoop::flushSessions() {
+    for (int fd : flushQueue_) {
+        auto it = sessions_.find(fd);
+        if (it != sessions_.end() && !it->second->flush()) {
+            removeSession(fd);
+        }
+    }
+    flushQueue_.clear();
+}
+
+void EventLoop::handleResponses() {
+    notifier_.drain();
+    std::shared_ptr<ResponseChannel> channel;
+    while (notifier_.nextReady(channel)) {
+        auto it = sessions_.find(channel->fd());
+        // The fd may have been reused by a newer session; only hand the
+        // responses to the session that owns this channel
+        if (it != sessions_.end() && it->second->channel() == channel) {
+            it->second->onResponses();
+            scheduleFlush(it->second);
+        } else {
+            channel->drain([](const EngineResponse &) {});
+        }
+        channel.reset();
+    }
 }
 
 void EventLoop::removeSession(int fd) {
-    struct kevent ev;
-    EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
-    kevent(kqfd_, &ev, 1, nullptr, 0, nullptr);
-    
     auto it = sessions_.find(fd);
-    if (it != sessions_.end()) {
-        delete it->second;
-        sessions_.erase(it);
-    }
-    close(fd);
+    if (it == sessions_.end()) return;
+
+    poller_->removeClient(fd);
+    // Session owns the fd and closes it
+    delete it->second;
+    sessions_.erase(it);
     LOG(LogLevel::INFO, "Client disconnected fd=" << fd);
 }
-
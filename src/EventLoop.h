@@ -1,23 +1,33 @@
 #pragma once
+#include <memory>
+#include <string>
 #include <unordered_map>
+#include <vector>
 #include "Session.h"
 #include "EngineController.h"
+#include "Poller.h"
+#include "ResponseChannel.h"
 
 class EventLoop {
 public:
     EventLoop(EngineController &controller);
 
-    bool init(int listenFd);
+    bool init(int listenFd, const std::string &pollerBackend = "");
     void run();
 
 private:
-    int kqfd_ = -1;
+    std::unique_ptr<Poller> poller_;
+    LoopNotifier notifier_;
     int listenFd_ = -1;
     EngineController &controller_;
     std::unordered_map<int, Session*> sessions_;
+    std::vector<int> flushQueue_; // sessions with output queued this iteration
 
     bool handleNewConnection();
-    bool handleEvent(int fd, int16_t filter);
+    bool addSession(int clientFd);
+    bool handleEvent(const PollEvent &ev);
+    void handleResponses();
     void removeSession(int fd);
+    void scheduleFlush(Session* sess);
+    void flushSessions();
 };
-;
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bitset with summary levels on top: bit i of level l+1 is set iff word i of
+// level l is non-zero. Finding the next/previous set bit touches one word per
+// level, so even a multi-million bit ladder is a handful of loads away.
+class HierarchicalBitset {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    explicit HierarchicalBitset(size_t bits = 0) { resize(bits); }
+
+    void resize(size_t bits) {
+        bits_ = bits;
+        levels_.clear();
+        size_t words = (bits + 63) / 64;
+        do {
+            levels_.emplace_back(words == 0 ? 1 : words, 0);
+            words = (words + 63) / 64;
+        } while (levels_.back().size() > 1);
+    }
+
+    size_t size() const { return bits_; }
+
+    bool test(size_t i) const {
+        return (levels_[0][i >> 6] >> (i & 63)) & 1;
+    }
+
+    void set(size_t i) {
+        for (auto &level : levels_) {
+            uint64_t &word = level[i >> 6];
+            bool wasEmpty = word == 0;
+            word |= 1ULL << (i & 63);
+            if (!wasEmpty) return; // parents already know this word is non-empty
+            i >>= 6;
+        }
+    }
+
+    void clear(size_t i) {
+        for (auto &level : levels_) {
+            uint64_t &word = level[i >> 6];
+            word &= ~(1ULL << (i & 63));
+            if (word != 0) return;
+            i >>= 6;
+        }
+    }
+
+    // Lowest set bit >= i, or npos
+    size_t findNext(size_t i) const {
+        if (i >= bits_) return npos;
+        size_t l = 0;
+        while (true) {
+            size_t w = i >> 6;
+            if (w >= levels_[l].size()) return npos;
+            uint64_t m = levels_[l][w] & (~0ULL << (i & 63));
+            if (m) {
+                i = (w << 6) | (size_t)__builtin_ctzll(m);
+                break;
+            }
+            if (++l == levels_.size()) return npos;
+            i = w + 1;
+        }
+        while (l > 0) {
+            --l;
+            i = (i << 6) | (size_t)__builtin_ctzll(levels_[l][i]);
+        }
+        return i;
+    }
+
+    // Highest set bit <= i, or npos
+    size_t findPrev(size_t i) const {
+        if (bits_ == 0) return npos;
+        if (i >= bits_) i = bits_ - 1;
+        size_t l = 0;
+        while (true) {
+            size_t w = i >> 6;
+            unsigned b = i & 63;
+            uint64_t mask = (b == 63) ? ~0ULL : ((1ULL << (b + 1)) - 1);
+            uint64_t m = levels_[l][w] & mask;
+            if (m) {
+                i = (w << 6) | (size_t)(63 - __builtin_clzll(m));
+                break;
+            }
+            if (w == 0 || ++l == levels_.size()) return npos;
+            i = w - 1;
+        }
+        while (l > 0) {
+            --l;
+            i = (i << 6) | (size_t)(63 - __builtin_clzll(levels_[l][i]));
+        }
+        return i;
+    }
+
+private:
+    size_t bits_ = 0;
+    std::vector<std::vector<uint64_t>> levels_; // levels_[0] holds one bit per index
+};
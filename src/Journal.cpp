@@ -0,0 +1,363 @@
+#include "Journal.h"
+#include "Crc32.h"
+#include "Logging.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char SEGMENT_MAGIC[8] = {'P', 'L', 'U', 'T', 'U', 'S', 'J', '1'};
+constexpr size_t MIN_SEGMENT_BYTES = 2 * JournalWriter::BATCH_BYTES;
+
+uint64_t nowMicros() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t padded(size_t n) {
+    return (n + 7) & ~size_t(7);
+}
+
+uint32_t recordCrc(const JournalRecordHeader &hdr, const char* payload) {
+    // Everything after the crc field
+    const char* start = reinterpret_cast<const char*>(&hdr) + offsetof(JournalRecordHeader, lsn);
+    uint32_t crc = crc32c(start, sizeof(JournalRecordHeader) - offsetof(JournalRecordHeader, lsn));
+    return crc32c(payload, hdr.length, crc);
+}
+
+int dataSync(int fd) {
+#if defined(__APPLE__)
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+bool preallocate(int fd, size_t bytes) {
+#if defined(__linux__)
+    if (posix_fallocate(fd, 0, (off_t)bytes) == 0) return true;
+#endif
+    return ftruncate(fd, (off_t)bytes) == 0;
+}
+
+bool writeAll(int fd, const char* data, size_t len, size_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= (size_t)n;
+        offset += (size_t)n;
+    }
+    return true;
+}
+
+}
+
+JournalWriter::JournalWriter(const JournalOptions &options)
+    : options_(options), ring_(RING_CAPACITY) {
+    options_.segmentBytes = std::max(options_.segmentBytes, MIN_SEGMENT_BYTES);
+    batch_.reserve(BATCH_BYTES);
+}
+
+JournalWriter::~JournalWriter() {
+    stop();
+}
+
+bool JournalWriter::start() {
+    if (running_.load()) return true;
+    if (mkdir(options_.directory.c_str(), 0755) < 0 && errno != EEXIST) {
+        LOG(LogLevel::ERROR, "Journal: cannot create directory " << options_.directory);
+        return false;
+    }
+
+    // Continue LSNs and segment numbering after whatever is already on disk
+    std::vector<uint64_t> existing = JournalReader::listSegments(options_.directory);
+    uint64_t index = existing.empty() ? 1 : existing.back() + 1;
+    nextLsn_ = JournalReader::lastLsn(options_.directory) + 1;
+    writtenLsn_.store(nextLsn_ - 1);
+    durableLsn_.store(nextLsn_ - 1);
+
+    if (!openSegment(index)) return false;
+    running_.store(true);
+    thread_ = std::thread([this] { run(); });
+    LOG(LogLevel::INFO, "Journal writing to " << JournalReader::segmentPath(options_.directory, index)
+        << " from lsn " << nextLsn_);
+    return true;
+}
+
+void JournalWriter::stop() {
+    if (!running_.exchange(false)) return;
+    if (thread_.joinable()) thread_.join();
+    closeSegment();
+}
+
+void JournalWriter::append(JournalEntry &&entry) {
+    while (!ring_.tryPush(std::move(entry))) {
+        std::this_thread::yield();
+    }
+}
+
+void JournalWriter::run() {
+    // Idle backoff: spin, then yield, then short sleeps. A busy writer never
+    // sleeps, and producers never pay for waking it.
+    const int SPIN_LIMIT = 256;
+    const int YIELD_LIMIT = 512;
+    int idle = 0;
+    JournalEntry entry;
+
+    while (true) {
+        while (batch_.size() + sizeof(JournalRecordHeader) + JournalEntry::MAX_PAYLOAD <= BATCH_BYTES &&
+               ring_.tryPop(entry)) {
+            frame(entry);
+        }
+
+        if (!batch_.empty()) {
+            if (!writeBatch()) {
+                LOG(LogLevel::ERROR, "Journal: write failed, records are being lost");
+            }
+            if (options_.durability == Durability::BATCH) {
+                sync();
+            }
+            idle = 0;
+        } else if (!running_.load(std::memory_order_acquire) && ring_.empty()) {
+            break;
+        } else if (++idle < SPIN_LIMIT) {
+            continue;
+        } else if (idle < YIELD_LIMIT) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+
+        if (options_.durability == Durability::INTERVAL && writtenLsn() > durableLsn() &&
+            nowMicros() - lastSyncMicros_ >= options_.syncIntervalMicros) {
+            sync();
+        }
+    }
+
+    if (options_.durability != Durability::NONE) sync();
+}
+
+void JournalWriter::frame(const JournalEntry &entry) {
+    JournalRecordHeader hdr{};
+    hdr.length = entry.length;
+    hdr.lsn = nextLsn_++;
+    hdr.type = (uint8_t)entry.type;
+    hdr.crc = recordCrc(hdr, entry.payload);
+    if (entry.assignedLsn) entry.assignedLsn->store(hdr.lsn, std::memory_order_release);
+
+    size_t start = batch_.size();
+    batch_.resize(start + padded(sizeof(hdr) + entry.length), 0);
+    std::memcpy(batch_.data() + start, &hdr, sizeof(hdr));
+    std::memcpy(batch_.data() + start + sizeof(hdr), entry.payload, entry.length);
+}
+
+bool JournalWriter::writeBatch() {
+    uint64_t lastLsn = nextLsn_ - 1;
+    if (segmentOffset_ + batch_.size() > options_.segmentBytes) {
+        // Rotation: whatever durability mode, a closed segment is complete on disk
+        sync();
+        closeSegment();
+        if (!openSegment(segmentIndex_ + 1)) {
+            batch_.clear();
+            return false;
+        }
+    }
+
+    bool ok = writeAll(fd_, batch_.data(), batch_.size(), segmentOffset_);
+    if (ok) {
+        segmentOffset_ += batch_.size();
+        writtenLsn_.store(lastLsn, std::memory_order_release);
+    }
+    batch_.clear();
+    return ok;
+}
+
+void JournalWriter::sync() {
+    uint64_t written = writtenLsn();
+    if (fd_ >= 0 && written > durableLsn()) {
+        if (dataSync(fd_) < 0) {
+            LOG(LogLevel::ERROR, "Journal: fdatasync failed");
+            return;
+        }
+        durableLsn_.store(written, std::memory_order_release);
+    }
+    lastSyncMicros_ = nowMicros();
+}
+
+bool JournalWriter::openSegment(uint64_t index) {
+    std::string path = JournalReader::segmentPath(options_.directory, index);
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        LOG(LogLevel::ERROR, "Journal: cannot create segment " << path);
+        return false;
+    }
+    // Preallocate so steady-state writes never extend the file, which would
+    // make every fdatasync flush metadata as well
+    if (!preallocate(fd, options_.segmentBytes)) {
+        LOG(LogLevel::WARN, "Journal: could not preallocate " << path);
+    }
+
+    JournalSegmentHeader hdr{};
+    std::memcpy(hdr.magic, SEGMENT_MAGIC, sizeof(hdr.magic));
+    hdr.segmentIndex = index;
+    hdr.firstLsn = nextLsn_;
+    if (!writeAll(fd, reinterpret_cast<const char*>(&hdr), sizeof(hdr), 0) || dataSync(fd) < 0) {
+        LOG(LogLevel::ERROR, "Journal: cannot initialise segment " << path);
+        close(fd);
+        return false;
+    }
+
+    fd_ = fd;
+    segmentIndex_ = index;
+    segmentOffset_ = sizeof(hdr);
+    return true;
+}
+
+void JournalWriter::closeSegment() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+namespace {
+
+bool readSegmentHeader(const std::string &path, JournalSegmentHeader &hdr) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+              std::memcmp(hdr.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0;
+    close(fd);
+    return ok;
+}
+
+}
+
+JournalReader::JournalReader(const std::string &directory, uint64_t fromLsn)
+    : directory_(directory), segments_(listSegments(directory)) {
+    // Segment i holds LSNs below the first LSN of segment i+1
+    size_t skip = 0;
+    while (fromLsn > 0 && skip + 1 < segments_.size()) {
+        JournalSegmentHeader next;
+        if (!readSegmentHeader(segmentPath(directory_, segments_[skip + 1]), next) || next.firstLsn > fromLsn + 1) break;
+        ++skip;
+    }
+    current_ = firstRead_ = skip;
+}
+
+uint64_t JournalReader::lastLsn(const std::string &directory) {
+    std::vector<uint64_t> segments = listSegments(directory);
+    for (size_t i = segments.size(); i-- > 0;) {
+        JournalReader reader(directory);
+        reader.segments_ = {segments[i]};
+        Record rec;
+        uint64_t last = 0;
+        while (reader.next(rec)) last = rec.lsn;
+        if (last > 0) return last;
+        // An empty segment still records where LSNs stood when it was opened
+        JournalSegmentHeader hdr;
+        if (readSegmentHeader(segmentPath(directory, segments[i]), hdr) && hdr.firstLsn > 0) {
+            return hdr.firstLsn - 1;
+        }
+    }
+    return 0;
+}
+
+JournalReader::~JournalReader() {
+    unmap();
+}
+
+std::string JournalReader::segmentPath(const std::string &directory, uint64_t index) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%010llu.wal", (unsigned long long)index);
+    return directory + "/" + name;
+}
+
+std::vector<uint64_t> JournalReader::listSegments(const std::string &directory) {
+    std::vector<uint64_t> out;
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return out;
+    while (dirent* ent = readdir(dir)) {
+        const char* name = ent->d_name;
+        size_t len = std::strlen(name);
+        if (len != 14 || std::strcmp(name + 10, ".wal") != 0) continue;
+        if (!std::all_of(name, name + 10, [](char c) { return c >= '0' && c <= '9'; })) continue;
+        out.push_back(std::strtoull(name, nullptr, 10));
+    }
+    closedir(dir);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+bool JournalReader::next(Record &out) {
+    while (true) {
+        if (!map_ && !openNext()) return false;
+
+        if (offset_ + sizeof(JournalRecordHeader) <= mapSize_) {
+            JournalRecordHeader hdr;
+            std::memcpy(&hdr, map_ + offset_, sizeof(hdr));
+            const char* payload = map_ + offset_ + sizeof(hdr);
+            if (hdr.length > 0 && offset_ + sizeof(hdr) + hdr.length <= mapSize_ &&
+                hdr.crc == recordCrc(hdr, payload)) {
+                out.lsn = hdr.lsn;
+                out.type = (JournalRecordType)hdr.type;
+                out.payload = payload;
+                out.length = hdr.length;
+                offset_ += padded(sizeof(hdr) + hdr.length);
+                return true;
+            }
+        }
+        // End of the valid part of this segment
+        unmap();
+        ++current_;
+    }
+}
+
+bool JournalReader::openNext() {
+    while (current_ < segments_.size()) {
+        std::string path = segmentPath(directory_, segments_[current_]);
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(JournalSegmentHeader)) {
+            void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (p != MAP_FAILED) {
+                map_ = static_cast<const char*>(p);
+                mapSize_ = (size_t)st.st_size;
+                if (std::memcmp(map_, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0) {
+                    madvise(const_cast<char*>(map_), mapSize_, MADV_SEQUENTIAL);
+                    offset_ = sizeof(JournalSegmentHeader);
+                    return true;
+                }
+                LOG(LogLevel::WARN, "Journal: bad segment header in " << path);
+                unmap();
+            }
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        ++current_;
+    }
+    return false;
+}
+
+void JournalReader::unmap() {
+    if (map_) {
+        munmap(const_cast<char*>(map_), mapSize_);
+        map_ = nullptr;
+        mapSize_ = 0;
+        offset_ = 0;
+    }
+}
@@ -0,0 +1,225 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RingBuffer.h"
+
+// Binary write-ahead journal.
+//
+// A journal is a directory of numbered, preallocated segment files. Each
+// segment starts with a JournalSegmentHeader followed by records laid out
+// back to back, 8-byte aligned:
+//
+//   [JournalRecordHeader][payload][pad]
+//
+// The CRC covers everything after the crc field, so a torn write or the
+// zeroed preallocated tail ends the valid part of a segment.
+//
+// Producers (engine threads) never touch the file: they copy a record into a
+// lock-free ring and return. A single writer thread drains the ring, frames
+// records into one buffer, issues one write per group and syncs it according
+// to the configured Durability.
+
+enum class JournalRecordType : uint8_t {
+    ADD = 1,
+    CANCEL = 2,
+    CANCEL_REPLACE = 3,
+    EXECUTION = 4,
+    CHECKPOINT = 5  // an engine's book was captured for a snapshot here
+};
+
+enum class Durability {
+    NONE,     // never sync; the OS decides when records reach disk
+    BATCH,    // fdatasync after every group written
+    INTERVAL  // fdatasync at most every syncIntervalMicros while records are pending
+};
+
+struct JournalOptions {
+    std::string directory = "journal";
+    Durability durability = Durability::BATCH;
+    uint64_t syncIntervalMicros = 1000;
+    size_t segmentBytes = 64u << 20;
+};
+
+#pragma pack(push, 1)
+struct JournalSegmentHeader {
+    char magic[8];        // "PLUTUSJ1"
+    uint64_t segmentIndex;
+    uint64_t firstLsn;    // LSN of the first record written to this segment
+    uint64_t reserved;
+};
+
+struct JournalRecordHeader {
+    uint32_t length;      // payload bytes, excluding header and padding
+    uint32_t crc;         // CRC-32C of lsn, type, reserved and payload
+    uint64_t lsn;         // journal-wide, assigned by the writer
+    uint8_t type;         // JournalRecordType
+    uint8_t reserved[7];
+};
+
+// Payloads keep the request exactly as received so it can be re-driven
+struct JournalAdd {
+    uint64_t sequence;
+    uint64_t timestamp;
+    uint64_t orderId;
+    char symbol[8];
+    double price;
+    uint64_t quantity;
+    uint64_t participantId;
+    double triggerPrice;
+    uint64_t visibleQuantity;
+    uint8_t side;
+    uint8_t tif;
+    uint8_t orderType;
+    uint8_t stp;
+    uint8_t reserved[4];
+};
+
+struct JournalCancel {
+    uint64_t sequence;
+    uint64_t timestamp;
+    uint64_t orderId;
+    uint64_t participantId;
+};
+
+struct JournalCancelReplace {
+    uint64_t sequence;
+    uint64_t timestamp;
+    uint64_t orderId;
+    double newPrice;
+    uint64_t newQuantity;
+    uint64_t participantId;
+};
+
+struct JournalExecution {
+    uint64_t sequence;
+    uint64_t timestamp;
+    uint64_t buyOrderId;
+    uint64_t sellOrderId;
+    char symbol[8];
+    int64_t price;        // ticks
+    uint64_t quantity;
+    uint64_t buyParticipantId;
+    uint64_t sellParticipantId;
+};
+
+// Everything the symbol's engine logged before this record is in the
+// snapshot taken at this LSN; everything after it is not
+struct JournalCheckpoint {
+    char symbol[8];
+    uint64_t nextSequence;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(JournalSegmentHeader) == 32);
+static_assert(sizeof(JournalRecordHeader) == 24);
+
+// One record in flight between a producer and the writer thread
+struct JournalEntry {
+    static constexpr size_t MAX_PAYLOAD = 96;
+    JournalRecordType type = JournalRecordType::ADD;
+    uint16_t length = 0;
+    // If set, the writer stores the record's LSN here once it is assigned
+    std::atomic<uint64_t>* assignedLsn = nullptr;
+    alignas(8) char payload[MAX_PAYLOAD];
+};
+
+static_assert(sizeof(JournalAdd) <= JournalEntry::MAX_PAYLOAD);
+static_assert(sizeof(JournalExecution) <= JournalEntry::MAX_PAYLOAD);
+
+class JournalWriter {
+public:
+    static constexpr size_t RING_CAPACITY = 65536;
+    static constexpr size_t BATCH_BYTES = 1u << 20;
+
+    explicit JournalWriter(const JournalOptions &options);
+    ~JournalWriter();
+
+    // Opens a fresh segment after any existing ones and starts the writer
+    bool start();
+    // Writes and syncs everything appended so far, then joins the writer
+    void stop();
+
+    // Any thread. Spins if the writer has fallen RING_CAPACITY records behind;
+    // records are never dropped.
+    void append(JournalEntry &&entry);
+
+    // Highest LSN handed to the OS / known to be on stable storage
+    uint64_t writtenLsn() const { return writtenLsn_.load(std::memory_order_acquire); }
+    uint64_t durableLsn() const { return durableLsn_.load(std::memory_order_acquire); }
+    // True once lsn is as safe as the durability mode promises
+    bool persisted(uint64_t lsn) const {
+        return (options_.durability == Durability::NONE ? writtenLsn() : durableLsn()) >= lsn;
+    }
+
+private:
+    JournalOptions options_;
+    MpscRing<JournalEntry> ring_;
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+
+    int fd_ = -1;
+    uint64_t segmentIndex_ = 0;
+    size_t segmentOffset_ = 0;
+    uint64_t nextLsn_ = 1;
+    std::vector<char> batch_;
+    std::atomic<uint64_t> writtenLsn_{0};
+    std::atomic<uint64_t> durableLsn_{0};
+    uint64_t lastSyncMicros_ = 0;
+
+    void run();
+    void frame(const JournalEntry &entry);
+    bool writeBatch();
+    void sync();
+    bool openSegment(uint64_t index);
+    void closeSegment();
+};
+
+// Sequential reader over every segment of a journal directory, in order.
+// Segments are mmapped; records are returned as views into the mapping and
+// stay valid until the reader moves to the next segment.
+class JournalReader {
+public:
+    struct Record {
+        uint64_t lsn = 0;
+        JournalRecordType type = JournalRecordType::ADD;
+        const char* payload = nullptr;
+        uint32_t length = 0;
+    };
+
+    // Segments holding only LSNs <= fromLsn are skipped without being read
+    explicit JournalReader(const std::string &directory, uint64_t fromLsn = 0);
+    ~JournalReader();
+
+    JournalReader(const JournalReader&) = delete;
+    JournalReader& operator=(const JournalReader&) = delete;
+
+    // False once every segment is exhausted. Stops a segment at the first
+    // record that fails its CRC, which is how a torn tail is detected.
+    bool next(Record &out);
+
+    // Segment indices present in the directory, ascending
+    const std::vector<uint64_t>& segments() const { return segments_; }
+    // Segments not skipped by fromLsn
+    size_t segmentsRead() const { return segments_.size() - firstRead_; }
+
+    static std::vector<uint64_t> listSegments(const std::string &directory);
+    // LSN of the last valid record in the journal, found from the newest segments
+    static uint64_t lastLsn(const std::string &directory);
+    static std::string segmentPath(const std::string &directory, uint64_t index);
+
+private:
+    std::string directory_;
+    std::vector<uint64_t> segments_;
+    size_t current_ = 0;
+    size_t firstRead_ = 0;
+    const char* map_ = nullptr;
+    size_t mapSize_ = 0;
+    size_t offset_ = 0;
+
+    bool openNext();
+    void unmap();
+};
@@ -0,0 +1,90 @@
+#include "KqueuePoller.h"
+
+#if PLUTUS_HAVE_KQUEUE
+
+#include "Logging.h"
+#include <sys/event.h>
+#include <unistd.h>
+#include <errno.h>
+
+KqueuePoller::~KqueuePoller() {
+    if (kqfd_ >= 0) close(kqfd_);
+}
+
+bool KqueuePoller::init() {
+    kqfd_ = kqueue();
+    if (kqfd_ < 0) {
+        LOG(LogLevel::ERROR, "kqueue creation failed");
+        return false;
+    }
+    return true;
+}
+
+bool KqueuePoller::addListener(int fd) {
+    listenFd_ = fd;
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, nullptr);
+    if (kevent(kqfd_, &ev, 1, nullptr, 0, nullptr) < 0) {
+        LOG(LogLevel::ERROR, "kevent ADD listenFd failed");
+        return false;
+    }
+    return true;
+}
+
+bool KqueuePoller::addClient(int fd) {
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD | EV_ENABLE | EV_CLEAR, 0, 0, nullptr);
+    if (kevent(kqfd_, &ev, 1, nullptr, 0, nullptr) < 0) {
+        LOG(LogLevel::ERROR, "kevent ADD clientFd failed");
+        return false;
+    }
+    return true;
+}
+
+void KqueuePoller::removeClient(int fd) {
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+    kevent(kqfd_, &ev, 1, nullptr, 0, nullptr);
+}
+
+bool KqueuePoller::armWrite(int fd) {
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_WRITE, EV_ADD | EV_ENABLE | EV_ONESHOT, 0, 0, nullptr);
+    if (kevent(kqfd_, &ev, 1, nullptr, 0, nullptr) < 0) {
+        LOG(LogLevel::ERROR, "Failed to register writable event for fd=" << fd);
+        return false;
+    }
+    return true;
+}
+
+int KqueuePoller::wait(PollEvent* out, int maxEvents) {
+    const int MAX_EVENTS = 64;
+    struct kevent events[MAX_EVENTS];
+    if (maxEvents > MAX_EVENTS) maxEvents = MAX_EVENTS;
+
+    while (true) {
+        int n = kevent(kqfd_, nullptr, 0, events, maxEvents, nullptr);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG(LogLevel::ERROR, "kevent wait error");
+            return -1;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            out[i].fd = (int)events[i].ident;
+            out[i].data = nullptr;
+            out[i].len = 0;
+            if (out[i].fd == listenFd_) {
+                out[i].kind = PollEvent::Kind::ACCEPTABLE;
+            } else if (events[i].filter == EVFILT_WRITE) {
+                out[i].kind = PollEvent::Kind::WRITABLE;
+            } else {
+                // EV_EOF still goes through read() so buffered bytes are drained first
+                out[i].kind = PollEvent::Kind::READABLE;
+            }
+        }
+        return n;
+    }
+}
+
+#endif
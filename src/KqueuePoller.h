@@ -0,0 +1,31 @@
+#pragma once
+#include "Poller.h"
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#define PLUTUS_HAVE_KQUEUE 1
+#else
+#define PLUTUS_HAVE_KQUEUE 0
+#endif
+
+#if PLUTUS_HAVE_KQUEUE
+
+class KqueuePoller : public Poller {
+public:
+    ~KqueuePoller() override;
+
+    const char* name() const override { return "kqueue"; }
+    bool init() override;
+
+    bool addListener(int fd) override;
+    bool addClient(int fd) override;
+    void removeClient(int fd) override;
+    bool armWrite(int fd) override;
+
+    int wait(PollEvent* out, int maxEvents) override;
+
+private:
+    int kqfd_ = -1;
+    int listenFd_ = -1;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include "LadderPriceLevels.h"
+
+LadderPriceLevels::LadderPriceLevels(Side side, Price minPrice, Price maxPrice)
+    : isBid_(side == Side::BUY), minPrice_(minPrice), maxPrice_(maxPrice) {
+    size_t levels = (maxPrice_ >= minPrice_) ? (size_t)(maxPrice_ - minPrice_ + 1) : 0;
+    chunks_.resize((levels + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    nonEmpty_.resize(levels);
+}
+
+PriceLevel* LadderPriceLevels::find(Price price) {
+    if (!accepts(price)) return nullptr;
+    size_t idx = indexOf(price);
+    return nonEmpty_.test(idx) ? slot(idx) : nullptr;
+}
+
+PriceLevel* LadderPriceLevels::getOrCreate(Price price) {
+    if (!accepts(price)) return nullptr;
+    size_t idx = indexOf(price);
+    auto &chunk = chunks_[idx >> CHUNK_SHIFT];
+    if (!chunk) {
+        chunk.reset(new PriceLevel[CHUNK_SIZE]);
+    }
+    PriceLevel* level = slot(idx);
+    if (!nonEmpty_.test(idx)) {
+        level->price = price;
+        nonEmpty_.set(idx);
+        if (empty() || better(idx, bestIdx_)) bestIdx_ = idx;
+    }
+    return level;
+}
+
+PriceLevel* LadderPriceLevels::next(const PriceLevel* level) {
+    size_t idx = indexOf(level->price);
+    size_t n;
+    if (isBid_) {
+        n = (idx == 0) ? HierarchicalBitset::npos : nonEmpty_.findPrev(idx - 1);
+    } else {
+        n = nonEmpty_.findNext(idx + 1);
+    }
+    return n == HierarchicalBitset::npos ? nullptr : slot(n);
+}
+
+void LadderPriceLevels::erase(PriceLevel* level) {
+    size_t idx = indexOf(level->price);
+    nonEmpty_.clear(idx);
+    if (idx == bestIdx_) {
+        bestIdx_ = isBid_ ? nonEmpty_.findPrev(idx) : nonEmpty_.findNext(idx);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "PriceLevels.h"
+#include "HierarchicalBitset.h"
+#include "Messages.h"
+
+// Price levels stored in a flat ladder indexed by (price - minPrice) in ticks,
+// covering the symbol's [minPrice, maxPrice] band. Storage is allocated in
+// chunks on first touch, so only the part of the band around where the symbol
+// actually trades costs memory. A hierarchical bitset marks non-empty levels
+// and the best level index is cached, so best() is O(1) and finding the next
+// level after the best one empties is a few word scans instead of a tree walk.
+class LadderPriceLevels : public PriceLevels {
+public:
+    LadderPriceLevels(Side side, Price minPrice, Price maxPrice);
+
+    bool empty() const override { return bestIdx_ == HierarchicalBitset::npos; }
+    bool accepts(Price price) const override { return price >= minPrice_ && price <= maxPrice_; }
+
+    PriceLevel* best() override {
+        return empty() ? nullptr : slot(bestIdx_);
+    }
+
+    PriceLevel* find(Price price) override;
+    PriceLevel* getOrCreate(Price price) override;
+    PriceLevel* next(const PriceLevel* level) override;
+    void erase(PriceLevel* level) override;
+
+private:
+    static constexpr size_t CHUNK_SHIFT = 10;
+    static constexpr size_t CHUNK_SIZE = size_t(1) << CHUNK_SHIFT;
+
+    bool isBid_;
+    Price minPrice_;
+    Price maxPrice_;
+    std::vector<std::unique_ptr<PriceLevel[]>> chunks_;
+    HierarchicalBitset nonEmpty_;
+    size_t bestIdx_ = HierarchicalBitset::npos;
+
+    size_t indexOf(Price price) const { return (size_t)(price - minPrice_); }
+    PriceLevel* slot(size_t idx) {
+        return &chunks_[idx >> CHUNK_SHIFT][idx & (CHUNK_SIZE - 1)];
+    }
+    bool better(size_t a, size_t b) const { return isBid_ ? a > b : a < b; }
+};
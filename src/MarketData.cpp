@@ -0,0 +1,398 @@
+#include "MarketData.h"
+#include "Logging.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t DRAIN_BATCH = 1024;
+// Snapshot messages sent per publisher pass, so a large book is spread out
+// between incremental packets instead of holding them up
+constexpr size_t SNAPSHOT_BATCH = 4 * (MD_MAX_PACKET / sizeof(MdOrder));
+constexpr auto HEARTBEAT_INTERVAL = std::chrono::seconds(1);
+
+uint64_t wallClock() {
+    return (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+}
+
+size_t roundUp(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+bool parseAddress(const std::string &address, sockaddr_in &out) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) return false;
+    std::memset(&out, 0, sizeof(out));
+    out.sin_family = AF_INET;
+    out.sin_port = htons((uint16_t)std::atoi(address.c_str() + colon + 1));
+    return out.sin_port != 0 && inet_pton(AF_INET, address.substr(0, colon).c_str(), &out.sin_addr) == 1;
+}
+
+}
+
+MarketDataChannel::~MarketDataChannel() {
+    if (fd_ >= 0) close(fd_);
+    if (shm_) {
+        munmap(shm_, shmBytes_);
+        shm_unlink(shmName_.c_str());
+    }
+}
+
+bool MarketDataChannel::openUdp(const std::string &address, const std::string &interface, int ttl) {
+    if (!parseAddress(address, address_)) {
+        LOG(LogLevel::ERROR, "MarketDataChannel: bad address " << address << ", expected ip:port");
+        return false;
+    }
+    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd_ < 0) {
+        LOG(LogLevel::ERROR, "MarketDataChannel: socket creation failed");
+        return false;
+    }
+    int sndbuf = 4 << 20;
+    setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    if (IN_MULTICAST(ntohl(address_.sin_addr.s_addr))) {
+        unsigned char hops = (unsigned char)ttl;
+        unsigned char loop = 1;
+        setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_TTL, &hops, sizeof(hops));
+        setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+        if (!interface.empty()) {
+            in_addr local{};
+            if (inet_pton(AF_INET, interface.c_str(), &local) != 1 ||
+                setsockopt(fd_, IPPROTO_IP, IP_MULTICAST_IF, &local, sizeof(local)) < 0) {
+                LOG(LogLevel::ERROR, "MarketDataChannel: cannot send multicast from " << interface);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool MarketDataChannel::openShm(const std::string &name, uint32_t slots, uint64_t session) {
+    if (slots == 0) return false;
+    size_t headerBytes = roundUp(sizeof(MdShmHeader), 64);
+    size_t slotBytes = roundUp(sizeof(MdShmSlot), 64);
+    size_t bytes = headerBytes + (size_t)slots * slotBytes;
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        LOG(LogLevel::ERROR, "MarketDataChannel: shm_open " << name << " failed");
+        return false;
+    }
+    // Truncating to zero first clears anything a previous run left behind
+    void* mem = MAP_FAILED;
+    if (ftruncate(fd, 0) == 0 && ftruncate(fd, (off_t)bytes) == 0) {
+        mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED) {
+        LOG(LogLevel::ERROR, "MarketDataChannel: cannot map " << bytes << " bytes of " << name);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    shm_ = new(mem) MdShmHeader;
+    std::memcpy(shm_->magic, MD_SHM_MAGIC, sizeof(MD_SHM_MAGIC));
+    shm_->slotCount = slots;
+    shm_->slotSize = (uint32_t)slotBytes;
+    shm_->session = session;
+    shm_->writeIndex.store(0, std::memory_order_release);
+    shmBytes_ = bytes;
+    shmName_ = name;
+    return true;
+}
+
+void MarketDataChannel::send(const char* packet, size_t len) {
+    if (fd_ >= 0) {
+        if (sendto(fd_, packet, len, 0, (const sockaddr*)&address_, sizeof(address_)) < 0 && !sendFailed_) {
+            sendFailed_ = true;
+            LOG(LogLevel::WARN, "MarketDataChannel: sendto failed, consumers will see a gap");
+        }
+    }
+    if (shm_) {
+        uint64_t i = written_++;
+        char* base = (char*)shm_ + roundUp(sizeof(MdShmHeader), 64);
+        auto* slot = (MdShmSlot*)(base + (i % shm_->slotCount) * shm_->slotSize);
+        slot->sequence.store(2 * i + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot->length = (uint32_t)len;
+        std::memcpy(slot->data, packet, len);
+        slot->sequence.store(2 * i + 2, std::memory_order_release);
+        shm_->writeIndex.store(i + 1, std::memory_order_release);
+    }
+}
+
+MarketDataPublisher::MarketDataPublisher(const SymbolTable &symbols, const MarketDataOptions &options)
+    : symbols_(symbols), options_(options), session_(wallClock()), books_(symbols.size()) {
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        rings_.push_back(std::make_unique<MpscRing<MarketDataEvent>>(RING_CAPACITY));
+    }
+    incremental_.channel = &incrementalChannel_;
+    snapshot_.channel = &snapshotChannel_;
+}
+
+MarketDataPublisher::~MarketDataPublisher() {
+    stop();
+}
+
+bool MarketDataPublisher::open() {
+    bool ok = true;
+    if (!options_.incrementalAddress.empty()) {
+        ok = incrementalChannel_.openUdp(options_.incrementalAddress, options_.interface, options_.ttl) && ok;
+    }
+    if (!options_.snapshotAddress.empty()) {
+        ok = snapshotChannel_.openUdp(options_.snapshotAddress, options_.interface, options_.ttl) && ok;
+    }
+    if (!options_.shmName.empty()) {
+        ok = incrementalChannel_.openShm(options_.shmName, options_.shmSlots, session_) && ok;
+        ok = snapshotChannel_.openShm(options_.shmName + "-snapshot", options_.shmSlots, session_) && ok;
+    }
+    return ok && incrementalChannel_.isOpen();
+}
+
+void MarketDataPublisher::start() {
+    if (running_.exchange(true)) return;
+    thread_ = std::thread([this] { run(); });
+}
+
+void MarketDataPublisher::stop() {
+    if (!running_.exchange(false)) return;
+    if (thread_.joinable()) thread_.join();
+}
+
+void MarketDataPublisher::publish(SymbolId symbolId, const MarketDataEvent &event) {
+    MpscRing<MarketDataEvent> &ring = *rings_[symbolId];
+    while (!ring.tryPush(MarketDataEvent(event))) {
+        std::this_thread::yield();
+    }
+}
+
+void MarketDataPublisher::run() {
+    int idle = 0;
+    while (running_.load(std::memory_order_relaxed)) {
+        bool busy = drainRings();
+        // Rings are empty: send the partial packet now rather than wait for more
+        if (!busy) flush(incremental_);
+        continueSnapshot();
+        if (std::chrono::steady_clock::now() - incremental_.lastSend >= HEARTBEAT_INTERVAL) {
+            heartbeat(incremental_);
+        }
+
+        // Idle backoff as in the journal writer
+        if (busy) {
+            idle = 0;
+        } else if (++idle < 64) {
+            continue;
+        } else if (idle < 1024) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+    while (drainRings()) {}
+    flush(incremental_);
+}
+
+bool MarketDataPublisher::drainRings() {
+    bool any = false;
+    MarketDataEvent event;
+    for (SymbolId id = 0; id < rings_.size(); ++id) {
+        for (size_t n = 0; n < DRAIN_BATCH && rings_[id]->tryPop(event); ++n) {
+            apply(id, event);
+            any = true;
+        }
+    }
+    return any;
+}
+
+void MarketDataPublisher::apply(SymbolId symbolId, const MarketDataEvent &event) {
+    ShadowBook &book = books_[symbolId];
+    book.symbolSequence = event.symbolSequence;
+
+    if (event.type == MdType::TRADE) {
+        MdTrade m;
+        fillHeader(m.header, MdType::TRADE, sizeof(m), symbolId, event.side, event.symbolSequence, event.timestamp);
+        m.buyOrderId = event.orderId;
+        m.sellOrderId = event.otherOrderId;
+        m.price = event.price;
+        m.quantity = event.quantity;
+        append(incremental_, &m, sizeof(m));
+        return;
+    }
+
+    // Keep the copy of the book in step and note the level's new aggregate
+    uint64_t levelQuantity = 0;
+    uint32_t levelOrders = 0;
+    auto update = [&](auto &levels) {
+        using Ref = ShadowBook::Ref;
+        if (event.type == MdType::ORDER_ADD) {
+            ShadowBook::Level &level = levels[event.price];
+            auto entry = level.orders.insert(level.orders.end(), ShadowBook::Entry{event.orderId, event.quantity});
+            level.quantity += event.quantity;
+            book.orders.set(event.orderId, Ref{&level, entry, event.price, event.side});
+            levelQuantity = level.quantity;
+            levelOrders = (uint32_t)level.orders.size();
+            return;
+        }
+        Ref* ref = book.orders.find(event.orderId);
+        if (!ref) {
+            LOG(LogLevel::WARN, "MarketDataPublisher: change to unknown order " << event.orderId);
+            return;
+        }
+        ShadowBook::Level &level = *ref->level;
+        level.quantity -= ref->entry->quantity;
+        if (event.type == MdType::ORDER_MODIFY) {
+            ref->entry->quantity = event.quantity;
+            level.quantity += event.quantity;
+        } else {
+            level.orders.erase(ref->entry);
+            book.orders.erase(event.orderId);
+        }
+        levelQuantity = level.quantity;
+        levelOrders = (uint32_t)level.orders.size();
+        if (level.orders.empty()) levels.erase(event.price);
+    };
+    if (event.side == Side::BUY) {
+        update(book.bids);
+    } else {
+        update(book.asks);
+    }
+
+    MdOrder m;
+    fillHeader(m.header, event.type, sizeof(m), symbolId, event.side, event.symbolSequence, event.timestamp);
+    m.orderId = event.orderId;
+    m.price = event.price;
+    m.quantity = event.quantity;
+    append(incremental_, &m, sizeof(m));
+
+    if (options_.levelUpdates) {
+        MdLevel l{};
+        fillHeader(l.header, MdType::LEVEL_UPDATE, sizeof(l), symbolId, event.side, event.symbolSequence, event.timestamp);
+        l.price = event.price;
+        l.quantity = levelQuantity;
+        l.orderCount = levelOrders;
+        append(incremental_, &l, sizeof(l));
+    }
+}
+
+void MarketDataPublisher::continueSnapshot() {
+    if (!snapshotChannel_.isOpen() || options_.snapshotIntervalMs == 0 || books_.empty()) return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (pending_.symbolId == INVALID_SYMBOL) {
+        if (now < nextSnapshotCycle_) return;
+        pending_.symbolId = 0;
+        pending_.begun = false;
+    }
+
+    SymbolId id = pending_.symbolId;
+    uint64_t timestamp = wallClock();
+    if (!pending_.begun) {
+        // Copy the book now so the snapshot is exact at this symbol sequence
+        // however many incrementals pass while it is being sent
+        const ShadowBook &book = books_[id];
+        pending_.symbolSequence = book.symbolSequence;
+        pending_.orders.clear();
+        pending_.next = 0;
+        auto copy = [&](const auto &levels, Side side) {
+            for (const auto &[price, level] : levels) {
+                for (const ShadowBook::Entry &e : level.orders) {
+                    MarketDataEvent o;
+                    o.side = side;
+                    o.orderId = e.orderId;
+                    o.price = price;
+                    o.quantity = e.quantity;
+                    pending_.orders.push_back(o);
+                }
+            }
+        };
+        copy(book.bids, Side::BUY);
+        copy(book.asks, Side::SELL);
+
+        MdSnapshotBegin b;
+        fillHeader(b.header, MdType::SNAPSHOT_BEGIN, sizeof(b), id, Side::BUY, pending_.symbolSequence, timestamp);
+        b.orderCount = pending_.orders.size();
+        append(snapshot_, &b, sizeof(b));
+        pending_.begun = true;
+    }
+
+    for (size_t n = 0; n < SNAPSHOT_BATCH && pending_.next < pending_.orders.size(); ++n) {
+        const MarketDataEvent &o = pending_.orders[pending_.next++];
+        MdOrder m;
+        fillHeader(m.header, MdType::SNAPSHOT_ORDER, sizeof(m), id, o.side, pending_.symbolSequence, timestamp);
+        m.orderId = o.orderId;
+        m.price = o.price;
+        m.quantity = o.quantity;
+        append(snapshot_, &m, sizeof(m));
+    }
+    if (pending_.next < pending_.orders.size()) return;
+
+    MdMessageHeader end;
+    fillHeader(end, MdType::SNAPSHOT_END, sizeof(end), id, Side::BUY, pending_.symbolSequence, timestamp);
+    append(snapshot_, &end, sizeof(end));
+    flush(snapshot_);
+
+    pending_.begun = false;
+    if (id + 1 < books_.size()) {
+        pending_.symbolId = id + 1;
+    } else {
+        pending_.symbolId = INVALID_SYMBOL;
+        pending_.orders = {};
+        nextSnapshotCycle_ = now + std::chrono::milliseconds(options_.snapshotIntervalMs);
+    }
+}
+
+void MarketDataPublisher::append(Packer &packer, const void* message, size_t len) {
+    if (packer.length + len > MD_MAX_PACKET) flush(packer);
+    std::memcpy(packer.buffer + packer.length, message, len);
+    packer.length += len;
+    ++packer.count;
+}
+
+void MarketDataPublisher::flush(Packer &packer) {
+    if (packer.count == 0) return;
+    MdPacketHeader h{};
+    h.session = session_;
+    h.sequence = packer.sequence;
+    h.count = packer.count;
+    h.length = (uint16_t)packer.length;
+    h.sendTime = wallClock();
+    std::memcpy(packer.buffer, &h, sizeof(h));
+    packer.channel->send(packer.buffer, packer.length);
+
+    packer.sequence += packer.count;
+    packer.count = 0;
+    packer.length = sizeof(MdPacketHeader);
+    packer.lastSend = std::chrono::steady_clock::now();
+}
+
+void MarketDataPublisher::heartbeat(Packer &packer) {
+    if (packer.count > 0) {
+        flush(packer);
+        return;
+    }
+    // An empty packet: the channel is alive and nothing was missed
+    MdPacketHeader h{};
+    h.session = session_;
+    h.sequence = packer.sequence;
+    h.length = sizeof(h);
+    h.sendTime = wallClock();
+    packer.channel->send((const char*)&h, sizeof(h));
+    packer.lastSend = std::chrono::steady_clock::now();
+}
+
+void MarketDataPublisher::fillHeader(MdMessageHeader &header, MdType type, size_t len, SymbolId symbolId, Side side,
+                                     uint64_t symbolSequence, uint64_t timestamp) const {
+    std::memset(&header, 0, sizeof(header));
+    header.length = (uint16_t)len;
+    header.type = (uint8_t)type;
+    header.side = (uint8_t)side;
+    const std::string &name = symbols_.name(symbolId);
+    std::memcpy(header.symbol, name.data(), std::min(name.size(), sizeof(header.symbol)));
+    header.symbolSequence = symbolSequence;
+    header.timestamp = timestamp;
+}
@@ -0,0 +1,259 @@
+#pragma once
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include "Order.h"
+#include "OrderIndex.h"
+#include "RingBuffer.h"
+#include "SymbolTable.h"
+
+// Market data feed: every change to the visible book and every trade, per
+// order (L3) and optionally per price level (L2), fixed-layout little-endian
+// like the binary order protocol. Messages are packed into datagrams of at
+// most MD_MAX_PACKET bytes and sent to a UDP (multicast) group and/or written
+// to a shared-memory ring for consumers on the same host.
+//
+// Two channels, each with its own packet sequence:
+//   incremental - ORDER_ADD / ORDER_MODIFY / ORDER_DELETE / TRADE / LEVEL_UPDATE
+//   snapshot    - every symbol's full order book, cycled periodically:
+//                 SNAPSHOT_BEGIN, one SNAPSHOT_ORDER per order, SNAPSHOT_END
+//
+// Each message carries its symbol's sequence, gapless per symbol. To build a
+// book, buffer incrementals, wait for a SNAPSHOT_BEGIN..END of the symbol,
+// then apply the buffered incrementals with a symbol sequence above the one in
+// SNAPSHOT_BEGIN. A gap in the incremental packet sequence means the same.
+static_assert(std::endian::native == std::endian::little,
+              "market data messages are written in place and assume a little-endian host");
+
+constexpr size_t MD_MAX_PACKET = 1400;
+constexpr char MD_SHM_MAGIC[8] = {'P', 'L', 'U', 'T', 'U', 'S', 'M', '1'};
+
+enum class MdType : uint8_t {
+    ORDER_ADD = 1,
+    ORDER_MODIFY = 2,
+    ORDER_DELETE = 3,
+    TRADE = 4,
+    LEVEL_UPDATE = 5,
+    SNAPSHOT_BEGIN = 6,
+    SNAPSHOT_ORDER = 7,
+    SNAPSHOT_END = 8
+};
+
+#pragma pack(push, 1)
+struct MdPacketHeader {
+    uint64_t session;   // publisher start time; sequences restart when it changes
+    uint64_t sequence;  // channel sequence of the first message
+    uint16_t count;     // messages in the packet, 0 for a heartbeat
+    uint16_t length;    // whole packet, header included
+    uint32_t reserved;
+    uint64_t sendTime;
+};
+
+struct MdMessageHeader {
+    uint16_t length;    // whole message, header included
+    uint8_t type;       // MdType
+    uint8_t side;       // Side; the aggressor's for TRADE
+    uint32_t reserved;
+    char symbol[8];
+    uint64_t symbolSequence;
+    uint64_t timestamp;
+};
+
+// ORDER_ADD, ORDER_MODIFY (quantity is what is left), ORDER_DELETE, SNAPSHOT_ORDER
+struct MdOrder {
+    MdMessageHeader header;
+    uint64_t orderId;
+    int64_t price;      // fixed point, WIRE_PRICE_SCALE
+    uint64_t quantity;  // displayed
+};
+
+struct MdTrade {
+    MdMessageHeader header;
+    uint64_t buyOrderId;
+    uint64_t sellOrderId;
+    int64_t price;
+    uint64_t quantity;
+};
+
+// Aggregate at one price after a change; quantity 0 removes the level
+struct MdLevel {
+    MdMessageHeader header;
+    int64_t price;
+    uint64_t quantity;
+    uint32_t orderCount;
+    uint32_t reserved;
+};
+
+// SNAPSHOT_BEGIN: symbolSequence is the last incremental reflected in the snapshot
+struct MdSnapshotBegin {
+    MdMessageHeader header;
+    uint64_t orderCount;
+};
+#pragma pack(pop)
+
+// Shared-memory channel: a header followed by slotCount slots of slotSize
+// bytes, each holding one packet. The writer never waits for readers. Packet
+// i goes to slot i % slotCount; the slot's sequence is 2i+1 while it is being
+// written and 2i+2 once complete. A reader expecting packet i copies the slot
+// when its sequence is 2i+2 and keeps the copy if the sequence is unchanged
+// afterwards; a larger sequence means the reader was lapped.
+struct MdShmHeader {
+    char magic[8];
+    uint32_t slotCount;
+    uint32_t slotSize;
+    uint64_t session;
+    alignas(64) std::atomic<uint64_t> writeIndex; // packets written
+};
+
+struct MdShmSlot {
+    std::atomic<uint64_t> sequence;
+    uint32_t length;
+    uint32_t reserved;
+    char data[MD_MAX_PACKET];
+};
+
+struct MarketDataOptions {
+    std::string incrementalAddress; // "host:port" of the incremental channel; empty for none
+    std::string snapshotAddress;    // "host:port" of the snapshot channel; empty for none
+    std::string interface;          // local address multicast is sent from; empty for the default
+    int ttl = 1;
+    std::string shmName;            // shm_open name of the incremental ring; snapshots go to <name>-snapshot
+    uint32_t shmSlots = 16384;
+    uint64_t snapshotIntervalMs = 1000;
+    bool levelUpdates = false;      // follow each order change with the level's LEVEL_UPDATE
+
+    bool enabled() const { return !incrementalAddress.empty() || !shmName.empty(); }
+};
+
+// What an engine hands the publisher. Price is already fixed point.
+struct MarketDataEvent {
+    MdType type = MdType::ORDER_ADD;
+    Side side = Side::BUY;
+    uint64_t orderId = 0;
+    uint64_t otherOrderId = 0; // sell order of a TRADE
+    int64_t price = 0;
+    uint64_t quantity = 0;
+    uint64_t symbolSequence = 0;
+    uint64_t timestamp = 0;
+};
+
+// One sink of packets: a UDP destination and/or a shared-memory ring
+class MarketDataChannel {
+public:
+    MarketDataChannel() = default;
+    ~MarketDataChannel();
+    MarketDataChannel(const MarketDataChannel&) = delete;
+    MarketDataChannel& operator=(const MarketDataChannel&) = delete;
+
+    bool openUdp(const std::string &address, const std::string &interface, int ttl);
+    bool openShm(const std::string &name, uint32_t slots, uint64_t session);
+    bool isOpen() const { return fd_ >= 0 || shm_; }
+
+    void send(const char* packet, size_t len);
+
+private:
+    int fd_ = -1;
+    sockaddr_in address_{};
+    MdShmHeader* shm_ = nullptr;
+    size_t shmBytes_ = 0;
+    std::string shmName_;
+    uint64_t written_ = 0;
+    bool sendFailed_ = false;
+};
+
+// Publishing thread. Each engine pushes its book events into its own ring;
+// this thread numbers them on the channel, packs them into datagrams and keeps
+// a copy of every book (orders by price and time, as the feed describes them)
+// from which it serves the snapshot channel, so engines never pay for
+// snapshots and a snapshot always matches a symbol sequence exactly.
+class MarketDataPublisher {
+public:
+    static constexpr size_t RING_CAPACITY = 65536;
+
+    MarketDataPublisher(const SymbolTable &symbols, const MarketDataOptions &options);
+    ~MarketDataPublisher();
+
+    // Opens the sockets and shared memory; false if nothing could be opened
+    bool open();
+    void start();
+    // Sends whatever the engines have queued, then stops
+    void stop();
+
+    // The engine thread of symbolId. Waits while the publisher is behind.
+    void publish(SymbolId symbolId, const MarketDataEvent &event);
+
+private:
+    // The publisher's copy of one book
+    struct ShadowBook {
+        struct Entry {
+            uint64_t orderId;
+            uint64_t quantity;
+        };
+        struct Level {
+            std::list<Entry> orders;
+            uint64_t quantity = 0;
+        };
+        struct Ref {
+            Level* level = nullptr;
+            std::list<Entry>::iterator entry;
+            int64_t price = 0;
+            Side side = Side::BUY;
+        };
+        std::map<int64_t, Level, std::greater<int64_t>> bids;
+        std::map<int64_t, Level> asks;
+        OrderIndex<Ref> orders;
+        uint64_t symbolSequence = 0;
+    };
+
+    // A snapshot being sent a few packets at a time between incrementals
+    struct PendingSnapshot {
+        SymbolId symbolId = INVALID_SYMBOL;
+        uint64_t symbolSequence = 0;
+        std::vector<MarketDataEvent> orders;
+        size_t next = 0;
+        bool begun = false;
+    };
+
+    struct Packer {
+        MarketDataChannel* channel = nullptr;
+        uint64_t sequence = 1;
+        uint16_t count = 0;
+        size_t length = sizeof(MdPacketHeader);
+        std::chrono::steady_clock::time_point lastSend{};
+        char buffer[MD_MAX_PACKET];
+    };
+
+    const SymbolTable &symbols_;
+    MarketDataOptions options_;
+    uint64_t session_ = 0;
+    std::vector<std::unique_ptr<MpscRing<MarketDataEvent>>> rings_;
+    std::vector<ShadowBook> books_;
+    MarketDataChannel incrementalChannel_;
+    MarketDataChannel snapshotChannel_;
+    Packer incremental_;
+    Packer snapshot_;
+    PendingSnapshot pending_;
+    std::chrono::steady_clock::time_point nextSnapshotCycle_{};
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+
+    void run();
+    bool drainRings();
+    void apply(SymbolId symbolId, const MarketDataEvent &event);
+    void continueSnapshot();
+
+    void append(Packer &packer, const void* message, size_t len);
+    void flush(Packer &packer);
+    void heartbeat(Packer &packer);
+    void fillHeader(MdMessageHeader &header, MdType type, size_t len, SymbolId symbolId, Side side,
+                    uint64_t symbolSequence, uint64_t timestamp) const;
+};
@@ -1,19 +1,191 @@
 #include "MatchingEngine.h"
+#include "BinaryProtocol.h"
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
-MatchingEngine::MatchingEngine(const std::string& sym, Replay& replay, MemoryPool<Order>& pool, SymbolConfigManager &cfg)
-    : symbol_(sym), replayLog(replay), orderPool(pool), configManager(cfg) {
+MatchingEngine::MatchingEngine(const std::string& sym, SymbolId symbolId, Replay& replay, MemoryPool<Order>& pool, SymbolConfigManager &cfg)
+    : symbol_(sym), symbolId_(symbolId), replayLog(replay), orderPool(pool), configManager(cfg), inbound_(INBOUND_CAPACITY) {
     orderBook.setMemoryPool(&orderPool);
+    SymbolConfig sc;
+    if (configManager.getConfig(symbolId_, sc)) {
+        applyLayout(sc);
+    } else {
+        LOG(LogLevel::ERROR, "MatchingEngine: no config for symbol " << symbol_);
+    }
+}
+
+MatchingEngine::~MatchingEngine() {
+    stop();
+}
+
+void MatchingEngine::start(int cpu) {
+    if (running_.exchange(true)) return;
+    // The book may have been rebuilt by recovery
+    publishTop();
+    thread_ = std::thread([this] { run(); });
+#if defined(__linux__)
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(thread_.native_handle(), sizeof(set), &set) != 0) {
+            LOG(LogLevel::WARN, "MatchingEngine: could not pin " << symbol_ << " to cpu " << cpu);
+        }
+    }
+#else
+    (void)cpu;
+#endif
+}
+
+void MatchingEngine::stop() {
+    if (!running_.exchange(false)) return;
+    wakeSeq_.fetch_add(1, std::memory_order_seq_cst);
+    wakeSeq_.notify_one();
+    if (thread_.joinable()) thread_.join();
+}
+
+bool MatchingEngine::submit(EngineCommand &&cmd) {
+    if (!inbound_.tryPush(std::move(cmd))) {
+        LOG(LogLevel::WARN, "MatchingEngine: inbound ring full for " << symbol_);
+        return false;
+    }
+    // Pairs with the fence in run(): either the engine sees our command before
+    // parking, or we see parked_ and wake it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_relaxed)) {
+        wakeSeq_.fetch_add(1, std::memory_order_relaxed);
+        wakeSeq_.notify_one();
+    }
+    return true;
+}
+
+void MatchingEngine::run() {
+    const int SPIN_LIMIT = 4096;
+    int idle = 0;
+    EngineCommand cmd;
+    while (running_.load(std::memory_order_relaxed)) {
+        if (inbound_.tryPop(cmd)) {
+            execute(cmd);
+            cmd = EngineCommand{};
+            idle = 0;
+            continue;
+        }
+        if (++idle < SPIN_LIMIT) {
+            continue;
+        }
+
+        uint32_t seq = wakeSeq_.load(std::memory_order_relaxed);
+        parked_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (inbound_.empty() && running_.load(std::memory_order_relaxed)) {
+            wakeSeq_.wait(seq);
+        }
+        parked_.store(false, std::memory_order_relaxed);
+        idle = 0;
+    }
+}
+
+void MatchingEngine::execute(EngineCommand &cmd) {
+    EngineResponse resp;
+    if (auto* m = std::get_if<AddMessage>(&cmd.msg)) {
+        resp.type = MessageType::ADD;
+        resp.sequence = m->header.sequence;
+        RiskEngine::Hold hold;
+        if (risk_) resp.reason = checkRisk(*m, hold);
+        if (resp.reason == RejectReason::NONE) resp.success = processAdd(*m);
+        if (risk_) risk_->release(hold);
+    } else if (auto* m = std::get_if<CancelMessage>(&cmd.msg)) {
+        resp.type = MessageType::CANCEL;
+        resp.sequence = m->header.sequence;
+        resp.success = processCancel(*m);
+    } else if (auto* m = std::get_if<CancelReplaceMessage>(&cmd.msg)) {
+        resp.type = MessageType::CANCEL_REPLACE;
+        resp.sequence = m->header.sequence;
+        RiskEngine::Hold hold;
+        if (risk_) resp.reason = checkRisk(*m, hold);
+        if (resp.reason == RejectReason::NONE) resp.success = processCancelReplace(*m);
+        if (risk_) risk_->release(hold);
+    } else if (auto* m = std::get_if<CheckpointRequest>(&cmd.msg)) {
+        if (m->sink) m->sink->submit(captureSnapshot());
+        return;
+    } else if (auto* m = std::get_if<SnapshotRequest>(&cmd.msg)) {
+        resp.type = MessageType::SNAPSHOT_REQUEST;
+        resp.sequence = m->header.sequence;
+        resp.snapshot = processSnapshotRequest(*m);
+        resp.success = true;
+    } else {
+        return;
+    }
+    if (!bookEvents_.empty()) publishBookEvents();
+    if (resp.type != MessageType::SNAPSHOT_REQUEST) publishTop();
+    if (cmd.reply) cmd.reply->deliver(std::move(resp));
+    // After the reply, so an order's acknowledgement precedes its fills
+    if (!fills_.empty()) deliverFills();
+}
+
+void MatchingEngine::deliverFills() {
+    for (const FillReport &fill : fills_) {
+        std::shared_ptr<ResponseChannel> channel = participants_->find(fill.participantId);
+        if (!channel) continue;
+        EngineResponse report;
+        report.type = MessageType::EXECUTION;
+        report.success = true;
+        report.sequence = fill.execId;
+        report.fill = fill;
+        channel->deliver(std::move(report));
+    }
+    fills_.clear();
+}
+
+void MatchingEngine::setRisk(RiskEngine* risk) {
+    risk_ = risk;
+    if (risk_) risk_->setTickSize(symbolId_, tickSize_);
+    orderBook.setRisk(risk);
+}
+
+RejectReason MatchingEngine::checkRisk(const AddMessage &msg, RiskEngine::Hold &hold) {
+    // Valued where it can trade: at its limit, a stop at its trigger and a
+    // market order at the best price it would take
+    Price price = 0;
+    if (msg.orderType == OrderType::MARKET) {
+        Price bestBid = 0, bestAsk = 0;
+        orderBook.getTopOfBook(bestBid, bestAsk);
+        price = msg.side == Side::BUY ? bestAsk : bestBid;
+    } else if (msg.orderType == OrderType::STOP_LOSS) {
+        if (tickSize_ > 0) price = roundToTicks(msg.triggerPrice, tickSize_);
+    } else if (!priceToTicks(msg.price, price)) {
+        price = 0; // validateAdd turns it away
+    }
+    return risk_->check(msg.participantId, symbolId_, msg.side, 1, msg.quantity,
+                        risk_->notional(symbolId_, price, msg.quantity), hold);
+}
+
+RejectReason MatchingEngine::checkRisk(const CancelReplaceMessage &msg, RiskEngine::Hold &hold) {
+    const Order* o = orderBook.findOrder(msg.orderId);
+    Price price = 0;
+    if (!o || o->participantId != msg.participantId || !priceToTicks(msg.newPrice, price)) {
+        // Turned away later, but it still counts toward the message rate
+        return risk_->check(msg.participantId, symbolId_, Side::BUY, 0, 0, 0, hold);
+    }
+    // Only what the replace adds to the order is checked
+    uint64_t open = o->openQuantity();
+    uint64_t added = msg.newQuantity > open ? msg.newQuantity - open : 0;
+    int64_t notional = risk_->notional(symbolId_, price, msg.newQuantity) - risk_->notional(symbolId_, o->price, open);
+    return risk_->check(msg.participantId, symbolId_, o->side, 0, added, std::max<int64_t>(notional, 0), hold);
 }
 
-bool MatchingEngine::validateAdd(const AddMessage &msg) {
-    if (msg.symbol.size() > 7 || msg.quantity == 0) {
+bool MatchingEngine::validateAdd(const AddMessage &msg, const SymbolConfig &cfg, Price &priceTicks, Price &triggerTicks) {
+    if (msg.symbolId != symbolId_ || msg.quantity == 0) {
         LOG(LogLevel::ERROR, "Invalid AddMessage basic checks");
         return false;
     }
 
-    if (!quantityValid(msg.symbol, msg.quantity)) {
+    if (!quantityValid(cfg, msg.quantity)) {
         LOG(LogLevel::WARN, "validateAdd: Quantity below min");
         return false;
     }
@@ -23,11 +195,11 @@ bool MatchingEngine::validateAdd(const AddMessage &msg) {
             LOG(LogLevel::ERROR, "Invalid AddMessage price <=0 for limit/iceberg");
             return false;
         }
-        if (!tickSizeValid(msg.symbol, msg.price)) {
+        if (!priceToTicks(msg.price, priceTicks)) {
             LOG(LogLevel::WARN, "validateAdd: price not aligned to tickSize");
             return false;
         }
-        if (!priceValidForSymbol(msg.symbol, msg.price)) {
+        if (!priceValidForSymbol(cfg, msg.price)) {
             LOG(LogLevel::WARN, "validateAdd: price out of allowed range");
             return false;
         }
@@ -38,9 +210,10 @@ bool MatchingEngine::validateAdd(const AddMessage &msg) {
             LOG(LogLevel::ERROR, "Stop order invalid triggerPrice");
             return false;
         }
+        triggerTicks = roundToTicks(msg.triggerPrice, tickSize_);
     }
 
-    if (checkVolatilityHalt(msg)) {
+    if (checkVolatilityHalt(msg, cfg)) {
         LOG(LogLevel::WARN, "Trading halted for symbol due to volatility");
         return false;
     }
@@ -56,20 +229,23 @@ bool MatchingEngine::validateCancel(const CancelMessage &msg) {
     return true;
 }
 
-bool MatchingEngine::validateCancelReplace(const CancelReplaceMessage &msg) {
+bool MatchingEngine::validateCancelReplace(const CancelReplaceMessage &msg, Price &newPriceTicks) {
     if (msg.orderId == 0 || msg.newPrice <= 0 || msg.newQuantity == 0) {
         LOG(LogLevel::ERROR, "Invalid CancelReplaceMessage");
         return false;
     }
-    if (!tickSizeValid(symbol_, msg.newPrice)) {
+    const SymbolConfig* current = currentConfig();
+    if (!current) return false;
+    const SymbolConfig &cfg = *current;
+    if (!priceToTicks(msg.newPrice, newPriceTicks)) {
         LOG(LogLevel::WARN, "cancelReplace: new price not aligned to tickSize");
         return false;
     }
-    if (!quantityValid(symbol_, msg.newQuantity)) {
+    if (!quantityValid(cfg, msg.newQuantity)) {
         LOG(LogLevel::WARN, "cancelReplace: quantity below min");
         return false;
     }
-    if (!priceValidForSymbol(symbol_, msg.newPrice)) {
+    if (!priceValidForSymbol(cfg, msg.newPrice)) {
         LOG(LogLevel::WARN, "cancelReplace: price out of allowed range");
         return false;
     }
@@ -77,197 +253,310 @@ bool MatchingEngine::validateCancelReplace(const CancelReplaceMessage &msg) {
 }
 
 double MatchingEngine::getLastTradePrice() const {
-    return orderBook.getLastTradePrice();
+    return top_.load().vwap;
+}
+
+void MatchingEngine::getTopOfBook(double &bestBid, double &bestAsk) const {
+    TopOfBook top = top_.load();
+    bestBid = top.bestBid;
+    bestAsk = top.bestAsk;
+}
+
+void MatchingEngine::publishTop() {
+    TopOfBook top{};
+    orderBook.visitLevels(Side::BUY, 1, [&](const PriceLevel &level) {
+        top.bestBid = fromTicks(level.price, tickSize_);
+        top.bidQuantity = level.totalQuantity;
+    });
+    orderBook.visitLevels(Side::SELL, 1, [&](const PriceLevel &level) {
+        top.bestAsk = fromTicks(level.price, tickSize_);
+        top.askQuantity = level.totalQuantity;
+    });
+    top.lastTradePrice = fromTicks(orderBook.lastTrade(), tickSize_);
+    top.vwap = orderBook.getLastTradePrice() * tickSize_;
+    top.recentVolume = orderBook.recentVolume();
+    top.updates = ++topUpdates_;
+    top_.store(top);
 }
 
 bool MatchingEngine::processAdd(const AddMessage &msg) {
-    if (!validateAdd(msg)) return false;
+    bool accepted = applyAdd(msg);
+    // Rejected, or filled and gone already
+    retireIfGone(msg.orderId);
+    return accepted;
+}
 
-    SymbolConfig cfg;
-    if (!configManager.getConfig(msg.symbol, cfg)) {
+bool MatchingEngine::applyAdd(const AddMessage &msg) {
+    // One config read serves every check below
+    const SymbolConfig* current = currentConfig();
+    if (!current) {
         LOG(LogLevel::ERROR, "No config for symbol");
         return false;
     }
+    const SymbolConfig &cfg = *current;
     if (cfg.tradingHalted) {
         LOG(LogLevel::WARN, "Trading halted for symbol");
         return false;
     }
 
+    Price priceTicks = 0, triggerTicks = 0;
+    if (!validateAdd(msg, cfg, priceTicks, triggerTicks)) return false;
+
     auto timestamp = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
     Order* o = orderPool.allocate();
-    new(o) Order(msg.orderId, msg.side, msg.symbol, msg.price, msg.quantity, timestamp,
-                 msg.participantId, msg.tif, msg.orderType, msg.triggerPrice, msg.visibleQuantity);
+    if (!o) {
+        LOG(LogLevel::ERROR, "processAdd: order pool exhausted");
+        return false;
+    }
+    new(o) Order(msg.orderId, msg.side, symbolId_, priceTicks, msg.quantity, timestamp,
+                 msg.participantId, msg.tif, msg.orderType, triggerTicks, msg.visibleQuantity);
+    o->stp = msg.stp;
 
     // Write-ahead log
-    replayLog.logAddMessage(msg.header.sequence, msg);
+    if (!replaySink_) replayLog.logAddMessage(msg.header.sequence, msg, symbol_);
 
-    std::vector<ExecutionMessage> trades;
+    if (orderBook.contains(o->orderId)) {
+        LOG(LogLevel::WARN, "processAdd: orderId already exists");
+        orderPool.deallocate(o);
+        return false;
+    }
+    if (o->orderType == OrderType::STOP_LOSS) {
+        if (orderBook.addOrder(o)) return true;
+        orderPool.deallocate(o);
+        return false;
+    }
+    if (o->tif == TimeInForce::FOK && !orderBook.canFill(*o)) {
+        // Killed before it touched the book: no fills, no feed events
+        orderPool.deallocate(o);
+        return true;
+    }
 
-    if (o->orderType == OrderType::MARKET) {
-        // Market orders try to match immediately
-        handleMarketOrder(o, trades, timestamp);
-    } else if (o->tif != TimeInForce::GTC) {
-        // IOC/FOK logic
-        handleIocFok(o, trades, timestamp);
+    // The aggressor takes what crosses straight off the opposite side and
+    // only a GTC limit remainder is ever inserted into the book
+    std::vector<ExecutionMessage> trades;
+    uint64_t seq = nextSequence;
+    bool mayRest = orderBook.matchAggressor(o, seq, timestamp, trades);
+    if (mayRest && o->quantity > 0 && o->tif == TimeInForce::GTC && o->orderType != OrderType::MARKET) {
+        if (!orderBook.addOrder(o)) orderPool.deallocate(o);
     } else {
-        // GTC limit/iceberg/stop
-        std::unique_lock<std::shared_mutex> lock(orderBook.bookMutex);
-        if (!orderBook.addOrder(o)) {
-            orderPool.deallocate(o);
-            return false;
-        }
-        // If limit order just placed, try match
-        if (o->orderType == OrderType::LIMIT || o->orderType == OrderType::ICEBERG) {
-            auto res = orderBook.matchBook(nextSequence.load(), timestamp);
-            for (auto &t : res) {
-                nextSequence.store(t.header.sequence + 1);
-                sendExecution(t);
-            }
-        }
+        orderPool.deallocate(o);
     }
+    finishMatching(trades, timestamp);
 
     // Send executions
     for (auto &t : trades) {
-        nextSequence.store(t.header.sequence + 1);
+        nextSequence = t.header.sequence + 1;
         sendExecution(t);
     }
+    // Market and IOC orders are gone by now, traded or not
+    retireIfGone(msg.orderId);
 
     return true;
 }
 
 bool MatchingEngine::processCancel(const CancelMessage &msg) {
     if (!validateCancel(msg)) return false;
-    replayLog.logCancelMessage(msg.header.sequence, msg);
+    if (!replaySink_) replayLog.logCancelMessage(msg.header.sequence, msg);
 
-    std::unique_lock<std::shared_mutex> lock(orderBook.bookMutex);
     bool success = orderBook.cancelOrder(msg.orderId, msg.participantId);
+    retireIfGone(msg.orderId);
     return success;
 }
 
 bool MatchingEngine::processCancelReplace(const CancelReplaceMessage &msg) {
-    if (!validateCancelReplace(msg)) return false;
+    Price newPriceTicks = 0;
+    if (!validateCancelReplace(msg, newPriceTicks)) return false;
 
-    replayLog.logCancelReplaceMessage(msg.header.sequence, msg);
+    if (!replaySink_) replayLog.logCancelReplaceMessage(msg.header.sequence, msg);
 
-    std::unique_lock<std::shared_mutex> lock(orderBook.bookMutex);
-    bool success = orderBook.modifyOrder(msg.orderId, msg.newPrice, msg.newQuantity, msg.participantId);
+    bool success = orderBook.modifyOrder(msg.orderId, newPriceTicks, msg.newQuantity, msg.participantId);
     if (success) {
         uint64_t timestamp = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
-        auto trades = orderBook.matchBook(nextSequence.load(), timestamp);
+        auto trades = orderBook.matchBook(nextSequence, timestamp);
+        finishMatching(trades, timestamp);
         for (auto &t : trades) {
-            nextSequence.store(t.header.sequence + 1);
+            nextSequence = t.header.sequence + 1;
             sendExecution(t);
         }
     }
+    retireIfGone(msg.orderId);
     return success;
 }
 
-void MatchingEngine::processSnapshotRequest(const SnapshotRequest &msg) {
-    std::shared_lock<std::shared_mutex> lock(orderBook.bookMutex);
+SnapshotResponse MatchingEngine::processSnapshotRequest(const SnapshotRequest &msg) {
     SnapshotResponse resp;
     resp.header.type = MessageType::SNAPSHOT_RESPONSE;
     resp.header.sequence = msg.header.sequence;
     resp.header.timestamp = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
-    resp.symbol = msg.symbol;
-    orderBook.getTopOfBook(resp.bestBid, resp.bestAsk);
-    resp.lastTradePrice = orderBook.getLastTradePrice();
-    LOG(LogLevel::INFO, "Snapshot for " << msg.symbol << ": bestBid=" << resp.bestBid << ", bestAsk=" << resp.bestAsk);
+    resp.symbol = symbol_;
+    size_t depth = std::clamp<uint32_t>(msg.depth, 1, MAX_SNAPSHOT_DEPTH);
+    for (Side side : {Side::BUY, Side::SELL}) {
+        std::vector<DepthLevel> &out = side == Side::BUY ? resp.bids : resp.asks;
+        out.reserve(depth);
+        orderBook.visitLevels(side, depth, [&](const PriceLevel &level) {
+            out.push_back(DepthLevel{fromTicks(level.price, tickSize_), level.totalQuantity, level.orderCount});
+        });
+    }
+    resp.bestBid = resp.bids.empty() ? 0.0 : resp.bids.front().price;
+    resp.bestAsk = resp.asks.empty() ? 0.0 : resp.asks.front().price;
+    resp.lastTradePrice = getLastTradePrice();
+    LOG(LogLevel::INFO, "Snapshot for " << symbol_ << ": bestBid=" << resp.bestBid << ", bestAsk=" << resp.bestAsk
+        << ", " << resp.bids.size() << "x" << resp.asks.size() << " levels");
+    return resp;
+}
+
+void MatchingEngine::retireIfGone(uint64_t orderId) {
+    if (routes_ && !orderBook.contains(orderId)) routes_->retire(orderId, symbolId_);
 }
 
 void MatchingEngine::sendExecution(const ExecutionMessage &exec) {
-    // Multicast execution
-    replayLog.logExecutionMessage(exec.header.sequence, exec);
-    LOG(LogLevel::INFO, "Execution: seq=" << exec.header.sequence << " symbol=" << exec.symbol << " qty=" << exec.quantity << " price=" << exec.price);
+    retireIfGone(exec.buyOrderId);
+    retireIfGone(exec.sellOrderId);
+    if (replaySink_) {
+        replaySink_->push_back(exec);
+        return;
+    }
+    replayLog.logExecutionMessage(exec.header.sequence, exec, symbol_);
+    if (risk_) {
+        risk_->onFill(exec.buyParticipantId, symbolId_, Side::BUY, exec.quantity);
+        risk_->onFill(exec.sellParticipantId, symbolId_, Side::SELL, exec.quantity);
+    }
+    if (participants_) {
+        double price = fromTicks(exec.price, tickSize_);
+        fills_.push_back({exec.header.sequence, exec.buyOrderId, exec.buyParticipantId, symbolId_, Side::BUY,
+                          price, exec.quantity, exec.buyLeavesQuantity});
+        fills_.push_back({exec.header.sequence, exec.sellOrderId, exec.sellParticipantId, symbolId_, Side::SELL,
+                          price, exec.quantity, exec.sellLeavesQuantity});
+    }
+    LOG(LogLevel::INFO, "Execution: seq=" << exec.header.sequence << " symbol=" << symbol_ << " qty=" << exec.quantity << " price=" << fromTicks(exec.price, tickSize_));
+}
+
+void MatchingEngine::setMarketData(MarketDataPublisher* publisher) {
+    marketData_ = publisher;
+    orderBook.setEventSink(publisher ? &bookEvents_ : nullptr);
+    if (!publisher) return;
+    orderBook.emitRestingOrders();
+    publishBookEvents();
+}
+
+void MatchingEngine::publishBookEvents() {
+    uint64_t timestamp = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+    for (const BookEvent &e : bookEvents_) {
+        MarketDataEvent md;
+        switch (e.type) {
+            case BookEvent::Type::ADD: md.type = MdType::ORDER_ADD; break;
+            case BookEvent::Type::MODIFY: md.type = MdType::ORDER_MODIFY; break;
+            case BookEvent::Type::DELETE: md.type = MdType::ORDER_DELETE; break;
+            case BookEvent::Type::TRADE: md.type = MdType::TRADE; break;
+        }
+        md.side = e.side;
+        md.orderId = e.orderId;
+        md.otherOrderId = e.otherOrderId;
+        md.price = BinaryCodec::toWirePrice(fromTicks(e.price, tickSize_));
+        md.quantity = e.quantity;
+        md.symbolSequence = ++marketDataSequence_;
+        md.timestamp = timestamp;
+        marketData_->publish(symbolId_, md);
+    }
+    bookEvents_.clear();
+}
+
+std::unique_ptr<EngineSnapshot> MatchingEngine::captureSnapshot() {
+    auto snap = std::make_unique<EngineSnapshot>();
+    snap->symbol = symbol_;
+    snap->nextSequence = nextSequence;
+    if (const SymbolConfig* cfg = configManager.acquire(symbolId_)) snap->config = *cfg;
+    orderBook.captureState(snap->book);
+    replayLog.logCheckpoint(symbol_, nextSequence, &snap->lsn);
+    return snap;
+}
+
+bool MatchingEngine::restoreSnapshot(const EngineSnapshot &snap) {
+    SymbolConfig current;
+    if (!configManager.getConfig(symbolId_, current)) return false;
+    // Prices in the snapshot are ticks of the configuration it was taken with
+    if (snap.config.tickSize != current.tickSize || snap.config.bookType != current.bookType ||
+        snap.config.minPrice != current.minPrice || snap.config.maxPrice != current.maxPrice) {
+        LOG(LogLevel::WARN, "restoreSnapshot: " << symbol_ << " configuration changed since the snapshot");
+        return false;
+    }
+    if (!orderBook.restoreState(snap.book, symbolId_)) return false;
+    configManager.setConfig(symbolId_, snap.config);
+    nextSequence = snap.nextSequence;
+    return true;
 }
 
 void MatchingEngine::step() {
     // All ops triggered by client request so no delayed orders
 }
 
-bool MatchingEngine::priceValidForSymbol(const std::string &symbol, double price) {
-    SymbolConfig cfg;
-    if (!configManager.getConfig(symbol, cfg)) return false;
+const SymbolConfig* MatchingEngine::currentConfig() {
+    const SymbolConfig* cfg = configManager.acquire(symbolId_);
+    if (!cfg) return nullptr;
+    // Resting prices are ticks of the current layout, so a new tick size or
+    // level storage only takes effect once the book is empty
+    bool ladder = cfg->bookType == BookType::LADDER;
+    if (cfg->tickSize != tickSize_ || cfg->bookType != layout_.bookType ||
+        (ladder && (cfg->minPrice != layout_.minPrice || cfg->maxPrice != layout_.maxPrice))) {
+        if (orderBook.empty()) {
+            applyLayout(*cfg);
+            layoutDeferred_ = false;
+            LOG(LogLevel::INFO, "MatchingEngine: " << symbol_ << " now trades at tick size " << tickSize_);
+        } else if (!layoutDeferred_) {
+            layoutDeferred_ = true;
+            LOG(LogLevel::WARN, "MatchingEngine: " << symbol_ << " keeps its tick size and levels until the book is empty");
+        }
+    }
+    orderBook.setSelfTradePrevention(cfg->selfTrade);
+    return cfg;
+}
+
+void MatchingEngine::applyLayout(const SymbolConfig &cfg) {
+    if (tickSize_ > 0 && cfg.tickSize != tickSize_) {
+        orderBook.rescaleTradeHistory(tickSize_ / cfg.tickSize);
+    }
+    tickSize_ = cfg.tickSize;
+    layout_ = cfg;
+    if (risk_) risk_->setTickSize(symbolId_, tickSize_);
+    orderBook.setBookType(cfg.bookType, roundToTicks(cfg.minPrice, tickSize_), roundToTicks(cfg.maxPrice, tickSize_));
+}
+
+bool MatchingEngine::priceValidForSymbol(const SymbolConfig &cfg, double price) const {
     return (price >= cfg.minPrice && price <= cfg.maxPrice);
 }
 
-bool MatchingEngine::tickSizeValid(const std::string &symbol, double price) {
-    SymbolConfig cfg;
-    if (!configManager.getConfig(symbol, cfg)) return false;
-    double ticks = price / cfg.tickSize;
-    double rounded = std::floor(ticks);
-    double diff = std::abs(ticks - rounded);
-    return diff < 1e-9; // close enough for floating point
+bool MatchingEngine::priceToTicks(double price, Price &ticks) const {
+    if (tickSize_ <= 0) return false;
+    return toTicks(price, tickSize_, ticks);
 }
 
-bool MatchingEngine::quantityValid(const std::string &symbol, uint64_t qty) {
-    SymbolConfig cfg;
-    if (!configManager.getConfig(symbol, cfg)) return false;
+bool MatchingEngine::quantityValid(const SymbolConfig &cfg, uint64_t qty) const {
     return qty >= cfg.minQuantity;
 }
 
-bool MatchingEngine::checkVolatilityHalt(const AddMessage &msg) {
-    SymbolConfig cfg;
-    if (!configManager.getConfig(msg.symbol, cfg)) return false;
+bool MatchingEngine::checkVolatilityHalt(const AddMessage &msg, const SymbolConfig &cfg) {
     if (cfg.tradingHalted) return true;
     // Simple check: if price is way off reference
     if (msg.orderType == OrderType::LIMIT || msg.orderType == OrderType::ICEBERG) {
         double pctChange = std::abs((msg.price - cfg.referencePrice)/cfg.referencePrice);
         if (pctChange > cfg.volatilityThreshold) {
             // Trigger halt
-            configManager.haltTrading(msg.symbol);
+            configManager.haltTrading(symbolId_);
             return true;
         }
     }
     return false;
 }
 
-bool MatchingEngine::checkTimeInForce(Order* o, std::vector<ExecutionMessage> &trades, uint64_t timestamp) {
-    // If FOK and not fully matched, cancel:
-    if (o->tif == TimeInForce::FOK) {
-        if (o->quantity > 0) {
-            // not fully matched
-            orderBook.cancelOrder(o->orderId, o->participantId);
-        }
-        return false; // order done
-    } else if (o->tif == TimeInForce::IOC) {
-        // IOC: cancel remainder
-        if (o->quantity > 0) {
-            orderBook.cancelOrder(o->orderId, o->participantId);
-        }
-        return false;
-    }
-    return true; // GTC continues
-}
-
-void MatchingEngine::handleMarketOrder(Order* o, std::vector<ExecutionMessage> &trades, uint64_t timestamp) {
-    std::unique_lock<std::shared_mutex> lock(orderBook.bookMutex);
-    orderBook.addOrder(o); // Add to lookup to allow cancel if needed
-    // Immediately match
-    auto res = orderBook.matchBook(nextSequence.load(), timestamp);
-
-    // Market orders are either fully matched or partial
-    // If partial remains, and TIF=FOK or IOC, handle
-    // If GTC (which doesn't make sense for market in this design), we would just discard remainder.
-
-    for (auto &t : res) {
-        trades.push_back(t);
-    }
-
-    // For a market order without FOK/IOC explicitly set, treat as FOK?
-    // Let's assume market orders always IOC.
-    // Cancel remainder if any
-    if (o->quantity > 0) {
-        orderBook.cancelOrder(o->orderId, o->participantId);
-    }
-}
-
-void MatchingEngine::handleIocFok(Order* o, std::vector<ExecutionMessage> &trades, uint64_t timestamp) {
-    std::unique_lock<std::shared_mutex> lock(orderBook.bookMutex);
-    orderBook.addOrder(o);
-    auto res = orderBook.matchBook(nextSequence.load(), timestamp);
-    for (auto &t : res) {
-        trades.push_back(t);
+void MatchingEngine::finishMatching(std::vector<ExecutionMessage> &trades, uint64_t timestamp) {
+    if (!trades.empty()) {
+        uint64_t seq = trades.back().header.sequence + 1;
+        firedStops_.clear();
+        orderBook.triggerStopOrders(timestamp, seq, trades, firedStops_);
+        for (uint64_t orderId : firedStops_) retireIfGone(orderId);
     }
-    checkTimeInForce(o, trades, timestamp);
+    std::vector<uint64_t> &cancelled = orderBook.selfTradeCancels();
+    for (uint64_t orderId : cancelled) retireIfGone(orderId);
+    cancelled.clear();
 }
 
@@ -4,42 +4,146 @@
 #include "MemoryPool.h"
 #include "Logging.h"
 #include "SymbolConfig.h"
+#include "EngineCommand.h"
+#include "RingBuffer.h"
+#include "Snapshot.h"
+#include "OrderIndex.h"
+#include "MarketData.h"
+#include "SeqLock.h"
+#include "ResponseChannel.h"
+#include <memory>
 #include <atomic>
+#include <thread>
 
+// Book summary an engine republishes after every request, in prices. One
+// cache line, so a reader's copy is a handful of loads.
+struct TopOfBook {
+    double bestBid;       // 0 if no bids
+    double bestAsk;       // 0 if no asks
+    uint64_t bidQuantity; // resting at bestBid
+    uint64_t askQuantity;
+    double lastTradePrice;
+    double vwap;          // over the recent trades
+    uint64_t recentVolume;
+    uint64_t updates;     // bumped on every publish
+};
+static_assert(sizeof(TopOfBook) == 64);
+
+// Each engine is the single writer of its OrderBook. Once start()ed, all
+// requests arrive through submit() and are executed in order on the engine's
+// own thread, so the book is never locked. The process* methods are the
+// synchronous core and may be called directly only while the engine thread
+// is not running.
 class MatchingEngine {
 public:
-    MatchingEngine(const std::string& symbol, Replay& replay, MemoryPool<Order>& pool, SymbolConfigManager &configManager);
+    static constexpr size_t INBOUND_CAPACITY = 65536;
+
+    MatchingEngine(const std::string& symbol, SymbolId symbolId, Replay& replay, MemoryPool<Order>& pool, SymbolConfigManager &configManager);
+    ~MatchingEngine();
+
+    // cpu < 0 leaves the thread unpinned
+    void start(int cpu = -1);
+    void stop();
 
+    // Any thread. Returns false if the inbound ring is full.
+    bool submit(EngineCommand &&cmd);
+
+    // Any thread: read from the last published TopOfBook, never from the book
+    TopOfBook topOfBook() const { return top_.load(); }
     double getLastTradePrice() const;
+    void getTopOfBook(double &bestBid, double &bestAsk) const;
     bool processAdd(const AddMessage &msg);
     bool processCancel(const CancelMessage &msg);
     bool processCancelReplace(const CancelReplaceMessage &msg);
-    void processSnapshotRequest(const SnapshotRequest &msg);
+    SnapshotResponse processSnapshotRequest(const SnapshotRequest &msg);
     void sendExecution(const ExecutionMessage &exec);
 
+    const std::string& symbol() const { return symbol_; }
+    uint32_t symbolId() const { return symbolId_; }
+
+    // Cancel routing shared with the controller; the engine retires each
+    // order id from it once the order has left the book
+    void setOrderRoutes(OrderRouteIndex* routes) { routes_ = routes; }
+    // Where to report fills; each side goes to its participant's channel
+    void setParticipants(ParticipantRegistry* participants) { participants_ = participants; }
+    // Pre-trade limits on new orders and replaces, checked before they reach
+    // process*; the book reports its open orders to it. Call before start().
+    void setRisk(RiskEngine* risk);
+
+    // Publish book changes and trades from now on, starting with the book as
+    // it stands. Call before start().
+    void setMarketData(MarketDataPublisher* publisher);
+
+    // Copy the book for a snapshot and mark the point in the journal
+    std::unique_ptr<EngineSnapshot> captureSnapshot();
+    // Load a snapshot into an empty engine before it starts
+    bool restoreSnapshot(const EngineSnapshot &snap);
+
+    // Recovery: while a sink is set nothing is journaled and executions are
+    // collected into it instead of being published
+    void setReplaySink(std::vector<ExecutionMessage>* sink) { replaySink_ = sink; }
+
     void step();
 
     OrderBook orderBook;
 
 private:
     std::string symbol_;
+    SymbolId symbolId_;
     Replay& replayLog;
     MemoryPool<Order>& orderPool;
     SymbolConfigManager &configManager;
+    double tickSize_ = 0.0; // prices below are in ticks of this
+    SymbolConfig layout_{}; // config the book's tick size and levels were built from
+    bool layoutDeferred_ = false;
+
+    uint64_t nextSequence = 1;
+    std::vector<ExecutionMessage>* replaySink_ = nullptr;
+    OrderRouteIndex* routes_ = nullptr;
+    ParticipantRegistry* participants_ = nullptr;
+    RiskEngine* risk_ = nullptr;
+    std::vector<FillReport> fills_; // reported after the current request's reply
+    std::vector<uint64_t> firedStops_;
+    MarketDataPublisher* marketData_ = nullptr;
+    std::vector<BookEvent> bookEvents_;
+    uint64_t marketDataSequence_ = 0;
+
+    SeqLock<TopOfBook> top_;
+    uint64_t topUpdates_ = 0;
+
+    MpscRing<EngineCommand> inbound_;
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+    // Parking for an idle engine thread: producers bump wakeSeq_ and notify
+    // only when the consumer has announced it is about to sleep
+    std::atomic<bool> parked_{false};
+    std::atomic<uint32_t> wakeSeq_{0};
+
+    void run();
+    void execute(EngineCommand &cmd);
 
-    std::atomic<uint64_t> nextSequence{1};
+    bool applyAdd(const AddMessage &msg);
+    // The config to validate one request against; see SymbolConfigManager
+    const SymbolConfig* currentConfig();
+    void applyLayout(const SymbolConfig &cfg);
+    void retireIfGone(uint64_t orderId);
+    void publishBookEvents();
+    void publishTop();
+    void deliverFills();
 
-    bool validateAdd(const AddMessage &msg);
+    RejectReason checkRisk(const AddMessage &msg, RiskEngine::Hold &hold);
+    RejectReason checkRisk(const CancelReplaceMessage &msg, RiskEngine::Hold &hold);
+    bool validateAdd(const AddMessage &msg, const SymbolConfig &cfg, Price &priceTicks, Price &triggerTicks);
     bool validateCancel(const CancelMessage &msg);
-    bool validateCancelReplace(const CancelReplaceMessage &msg);
+    bool validateCancelReplace(const CancelReplaceMessage &msg, Price &newPriceTicks);
 
-    bool checkVolatilityHalt(const AddMessage &msg);
-    bool priceValidForSymbol(const std::string &symbol, double price);
-    bool tickSizeValid(const std::string &symbol, double price);
-    bool quantityValid(const std::string &symbol, uint64_t qty);
-    bool checkTimeInForce(Order* o, std::vector<ExecutionMessage> &trades, uint64_t timestamp);
+    bool checkVolatilityHalt(const AddMessage &msg, const SymbolConfig &cfg);
+    bool priceValidForSymbol(const SymbolConfig &cfg, double price) const;
+    bool priceToTicks(double price, Price &ticks) const;
+    bool quantityValid(const SymbolConfig &cfg, uint64_t qty) const;
 
-    void handleMarketOrder(Order* o, std::vector<ExecutionMessage> &trades, uint64_t timestamp);
-    void handleIocFok(Order* o, std::vector<ExecutionMessage> &trades, uint64_t timestamp);
+    // After matching: fire the stops this request's trades crossed (their
+    // fills join trades) and retire what self-trade prevention cancelled
+    void finishMatching(std::vector<ExecutionMessage> &trades, uint64_t timestamp);
 };
 
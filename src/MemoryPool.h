@@ -1,41 +1,337 @@
 #pragma once
+#include <atomic>
 #include <cstddef>
-#include <vector>
-#include <mutex>
+#include <cstdint>
+#include <sys/mman.h>
+#include "Logging.h"
 
-template<typename T, size_t BLOCK_SIZE=1024>
+struct MemoryPoolOptions {
+    size_t reserveObjects = 0; // carved and pre-faulted by configure()
+    bool hugePages = false;    // back chunks with 2 MB pages where the kernel allows
+};
+
+struct MemoryPoolStats {
+    uint64_t allocations = 0;   // published per batch, so up to one batch per thread behind
+    uint64_t deallocations = 0;
+    uint64_t refills = 0;       // batches a thread cache took from the depot
+    uint64_t flushes = 0;       // batches a thread cache gave back
+    uint64_t chunks = 0;        // chunks mapped so far
+    uint64_t hugeChunks = 0;    // of which backed by hugetlbfs pages
+    uint64_t capacity = 0;      // objects carved from all chunks
+};
+
+// Fixed-size object pool. Each thread allocates from and frees into its own
+// cache, an intrusive list threaded through the free objects themselves, so
+// the common path is a few loads and stores with no lock or atomic. Caches
+// trade whole batches with a shared lock-free depot (a tagged Treiber stack)
+// and only a depot miss maps a new chunk, which configure() can do up front.
+//
+// allocate() returns raw storage: construct with placement new. Pools must
+// outlive every thread that uses them; a thread's cached objects return to
+// the depot when it exits.
+template<typename T, size_t BATCH_SIZE = 64>
 class MemoryPool {
 public:
+    static constexpr size_t CHUNK_BYTES = size_t(2) << 20;
+    static constexpr size_t MAX_POOLS = 64; // live pools of one type with thread caches
+
     MemoryPool() {
-        allocateBlock();
+        generation_ = nextGeneration_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < MAX_POOLS; ++i) {
+            MemoryPool* expected = nullptr;
+            if (registry_[i].compare_exchange_strong(expected, this, std::memory_order_acq_rel)) {
+                index_ = i;
+                break;
+            }
+        }
+        if (index_ == MAX_POOLS) {
+            LOG(LogLevel::WARN, "MemoryPool: more than " << MAX_POOLS << " live pools, falling back to the shared depot");
+        }
     }
 
-    T* allocate() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (freeList_.empty()) {
-            allocateBlock();
+    ~MemoryPool() {
+        if (index_ < MAX_POOLS) registry_[index_].store(nullptr, std::memory_order_release);
+        Chunk* chunk = chunks_.load(std::memory_order_acquire);
+        while (chunk) {
+            Chunk* next = chunk->next;
+            munmap(chunk, CHUNK_BYTES);
+            chunk = next;
         }
-        T* obj = freeList_.back();
-        freeList_.pop_back();
-        return obj;
+    }
+
+    MemoryPool(const MemoryPool&) = delete;
+    MemoryPool& operator=(const MemoryPool&) = delete;
+
+    // Call before the pool is used. Reserving carves every slot, which also
+    // faults in every page, so trading never waits on the kernel for memory.
+    bool configure(const MemoryPoolOptions &options) {
+        hugePages_ = options.hugePages;
+        reserved_ = options.reserveObjects;
+        while (capacity_.load(std::memory_order_relaxed) < reserved_) {
+            if (!grow()) return false;
+        }
+        if (reserved_ > 0) {
+            MemoryPoolStats s = stats();
+            LOG(LogLevel::INFO, "MemoryPool: reserved " << s.capacity << " objects in " << s.chunks << " chunks ("
+                << s.hugeChunks << " on huge pages)");
+        }
+        return true;
+    }
+
+    // Null only if a new chunk could not be mapped
+    T* allocate() {
+        LocalCache* c = cache();
+        if (!c) return allocateShared();
+        if (!c->head && !refill(*c)) return nullptr;
+        Slot* s = c->head;
+        c->head = s->next;
+        --c->count;
+        ++c->allocations;
+        return reinterpret_cast<T*>(s);
     }
 
     void deallocate(T* obj) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        freeList_.push_back(obj);
+        Slot* s = reinterpret_cast<Slot*>(obj);
+        LocalCache* c = cache();
+        if (!c) {
+            s->next = nullptr;
+            s->count = 1;
+            pushBatch(s);
+            return;
+        }
+        s->next = c->head;
+        c->head = s;
+        ++c->count;
+        ++c->deallocations;
+        // Keep a batch in hand so alternating alloc/free never hits the depot
+        if (c->count >= 2 * BATCH_SIZE) flush(*c, BATCH_SIZE);
+    }
+
+    MemoryPoolStats stats() const {
+        MemoryPoolStats s;
+        s.allocations = allocations_.load(std::memory_order_relaxed);
+        s.deallocations = deallocations_.load(std::memory_order_relaxed);
+        s.refills = refills_.load(std::memory_order_relaxed);
+        s.flushes = flushes_.load(std::memory_order_relaxed);
+        s.chunks = chunkCount_.load(std::memory_order_relaxed);
+        s.hugeChunks = hugeChunkCount_.load(std::memory_order_relaxed);
+        s.capacity = capacity_.load(std::memory_order_relaxed);
+        return s;
     }
 
 private:
-    void allocateBlock() {
-        blockStorage_.emplace_back(new char[sizeof(T) * BLOCK_SIZE]);
-        char* block = blockStorage_.back();
-        for (size_t i = 0; i < BLOCK_SIZE; ++i) {
-            freeList_.push_back(reinterpret_cast<T*>(block + i * sizeof(T)));
+    // A free slot. next links slots within a thread cache or a batch; the
+    // first slot of a batch in the depot also carries the batch links.
+    struct Slot {
+        Slot* next;
+        Slot* nextBatch;
+        size_t count;
+    };
+
+    struct Chunk {
+        Chunk* next;
+    };
+
+    static constexpr size_t SLOT_ALIGN = alignof(T) > alignof(Slot) ? alignof(T) : alignof(Slot);
+    static constexpr size_t SLOT_SIZE =
+        ((sizeof(T) > sizeof(Slot) ? sizeof(T) : sizeof(Slot)) + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+    static constexpr size_t FIRST_SLOT = (sizeof(Chunk) + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+    static_assert(FIRST_SLOT + SLOT_SIZE * BATCH_SIZE <= CHUNK_BYTES, "object too large for a pool chunk");
+
+    // Depot head: slot pointer in the low 48 bits, ABA tag in the high 16
+    static constexpr uint64_t POINTER_MASK = (uint64_t(1) << 48) - 1;
+
+    struct LocalCache {
+        uint64_t generation = 0; // of the pool the slots below belong to
+        Slot* head = nullptr;
+        size_t count = 0;
+        uint64_t allocations = 0;   // not yet added to the pool's counters
+        uint64_t deallocations = 0;
+    };
+
+    struct ThreadCaches {
+        LocalCache caches[MAX_POOLS];
+
+        ~ThreadCaches() {
+            for (size_t i = 0; i < MAX_POOLS; ++i) {
+                LocalCache &c = caches[i];
+                MemoryPool* pool = registry_[i].load(std::memory_order_acquire);
+                if (!pool || pool->generation_ != c.generation) continue;
+                while (c.count > 0) pool->flush(c, c.count < BATCH_SIZE ? c.count : BATCH_SIZE);
+                pool->publish(c);
+            }
         }
+    };
+
+    static inline thread_local ThreadCaches threadCaches_;
+    static inline std::atomic<MemoryPool*> registry_[MAX_POOLS] = {};
+    static inline std::atomic<uint64_t> nextGeneration_{1};
+
+    size_t index_ = MAX_POOLS;
+    uint64_t generation_ = 0;
+    bool hugePages_ = false;
+    size_t reserved_ = 0;
+
+    alignas(64) std::atomic<uint64_t> depot_{0};
+    alignas(64) std::atomic<Chunk*> chunks_{nullptr};
+    std::atomic<uint64_t> allocations_{0};
+    std::atomic<uint64_t> deallocations_{0};
+    std::atomic<uint64_t> refills_{0};
+    std::atomic<uint64_t> flushes_{0};
+    std::atomic<uint64_t> chunkCount_{0};
+    std::atomic<uint64_t> hugeChunkCount_{0};
+    std::atomic<uint64_t> capacity_{0};
+
+    LocalCache* cache() {
+        if (index_ == MAX_POOLS) return nullptr;
+        LocalCache &c = threadCaches_.caches[index_];
+        if (c.generation != generation_) {
+            // Left over from a destroyed pool that had this index; its memory is gone
+            c = LocalCache{};
+            c.generation = generation_;
+        }
+        return &c;
     }
 
-    std::vector<char*> blockStorage_;
-    std::vector<T*> freeList_;
-    std::mutex mutex_;
-};
+    void publish(LocalCache &c) {
+        allocations_.fetch_add(c.allocations, std::memory_order_relaxed);
+        deallocations_.fetch_add(c.deallocations, std::memory_order_relaxed);
+        c.allocations = 0;
+        c.deallocations = 0;
+    }
+
+    bool refill(LocalCache &c) {
+        Slot* batch = popBatch();
+        while (!batch) {
+            if (!grow()) return false;
+            batch = popBatch();
+        }
+        c.head = batch;
+        c.count = batch->count;
+        refills_.fetch_add(1, std::memory_order_relaxed);
+        publish(c);
+        return true;
+    }
+
+    // Hand the first n cached slots back to the depot as one batch
+    void flush(LocalCache &c, size_t n) {
+        Slot* head = c.head;
+        Slot* tail = head;
+        for (size_t i = 1; i < n; ++i) tail = tail->next;
+        c.head = tail->next;
+        c.count -= n;
+        tail->next = nullptr;
+        head->count = n;
+        pushBatch(head);
+        flushes_.fetch_add(1, std::memory_order_relaxed);
+        publish(c);
+    }
+
+    // Without a thread cache: take one slot from a batch and return the rest
+    T* allocateShared() {
+        Slot* batch = popBatch();
+        while (!batch) {
+            if (!grow()) return nullptr;
+            batch = popBatch();
+        }
+        if (batch->next) {
+            batch->next->count = batch->count - 1;
+            pushBatch(batch->next);
+        }
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        return reinterpret_cast<T*>(batch);
+    }
+
+    static uint64_t pack(Slot* s, uint64_t previous) {
+        return (uint64_t)(uintptr_t)s | ((((previous >> 48) + 1) & 0xFFFF) << 48);
+    }
+
+    void pushBatch(Slot* batch) {
+        uint64_t old = depot_.load(std::memory_order_relaxed);
+        do {
+            batch->nextBatch = (Slot*)(uintptr_t)(old & POINTER_MASK);
+        } while (!depot_.compare_exchange_weak(old, pack(batch, old), std::memory_order_release,
+                                               std::memory_order_relaxed));
+    }
+
+    Slot* popBatch() {
+        uint64_t old = depot_.load(std::memory_order_acquire);
+        while (Slot* head = (Slot*)(uintptr_t)(old & POINTER_MASK)) {
+            // If another thread popped head meanwhile this read is stale, but
+            // chunks stay mapped and the tag makes the exchange fail
+            Slot* next = head->nextBatch;
+            if (depot_.compare_exchange_weak(old, pack(next, old), std::memory_order_acquire,
+                                             std::memory_order_acquire)) {
+                return head;
+            }
+        }
+        return nullptr;
+    }
+
+    void* mapChunk(bool &huge) {
+        huge = false;
+        void* mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (hugePages_) {
+            mem = mmap(nullptr, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            huge = mem != MAP_FAILED;
+        }
+#endif
+        if (mem != MAP_FAILED) return mem;
+        if (!hugePages_) {
+            mem = mmap(nullptr, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            return mem == MAP_FAILED ? nullptr : mem;
+        }
+        // No hugetlbfs pages reserved: map twice the size, trim to a 2 MB
+        // boundary and ask for transparent huge pages instead
+        mem = mmap(nullptr, 2 * CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return nullptr;
+        uintptr_t start = (uintptr_t)mem;
+        uintptr_t aligned = (start + CHUNK_BYTES - 1) & ~(uintptr_t)(CHUNK_BYTES - 1);
+        if (aligned > start) munmap(mem, aligned - start);
+        if (aligned + CHUNK_BYTES < start + 2 * CHUNK_BYTES) {
+            munmap((void*)(aligned + CHUNK_BYTES), start + 2 * CHUNK_BYTES - aligned - CHUNK_BYTES);
+        }
+#ifdef MADV_HUGEPAGE
+        madvise((void*)aligned, CHUNK_BYTES, MADV_HUGEPAGE);
+#endif
+        return (void*)aligned;
+    }
 
+    // Map a chunk and carve it into batches for the depot. Writing the links
+    // touches every page, so a carved chunk is already faulted in.
+    bool grow() {
+        bool huge = false;
+        void* mem = mapChunk(huge);
+        if (!mem) {
+            LOG(LogLevel::ERROR, "MemoryPool: could not map a " << (CHUNK_BYTES >> 20) << " MB chunk");
+            return false;
+        }
+        if (reserved_ > 0 && capacity_.load(std::memory_order_relaxed) >= reserved_) {
+            LOG(LogLevel::WARN, "MemoryPool: growing past the reserved " << reserved_ << " objects");
+        }
+
+        Chunk* chunk = static_cast<Chunk*>(mem);
+        chunk->next = chunks_.load(std::memory_order_relaxed);
+        while (!chunks_.compare_exchange_weak(chunk->next, chunk, std::memory_order_release,
+                                              std::memory_order_relaxed)) {}
+
+        char* base = static_cast<char*>(mem) + FIRST_SLOT;
+        size_t slots = (CHUNK_BYTES - FIRST_SLOT) / SLOT_SIZE;
+        for (size_t first = 0; first < slots; first += BATCH_SIZE) {
+            size_t n = slots - first < BATCH_SIZE ? slots - first : BATCH_SIZE;
+            Slot* head = reinterpret_cast<Slot*>(base + first * SLOT_SIZE);
+            for (size_t i = 0; i < n; ++i) {
+                Slot* s = reinterpret_cast<Slot*>(base + (first + i) * SLOT_SIZE);
+                s->next = i + 1 < n ? reinterpret_cast<Slot*>(base + (first + i + 1) * SLOT_SIZE) : nullptr;
+            }
+            head->count = n;
+            pushBatch(head);
+        }
+
+        chunkCount_.fetch_add(1, std::memory_order_relaxed);
+        if (huge) hugeChunkCount_.fetch_add(1, std::memory_order_relaxed);
+        capacity_.fetch_add(slots, std::memory_order_relaxed);
+        return true;
+    }
+};
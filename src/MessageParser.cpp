@@ -1,215 +1,206 @@
 #include "MessageParser.h"
 #include "Logging.h"
 #include <algorithm>
-#include <string>
-#include <sstream>
+#include <charconv>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-void MessageParser::appendData(const char* data, size_t len) {
-    buffer_.insert(buffer_.end(), data, data + len);
-}
+namespace {
 
-std::optional<MessageHeader> MessageParser::nextMessageHeader() {
-    auto it = std::find(buffer_.begin(), buffer_.end(), '\n');
-    if (it == buffer_.end()) {
-        return std::nullopt;
-    }
-    // Peek line
-    std::string line(buffer_.begin(), it);
-    // Format: TYPE|seq|timestamp|...
-    // Extract first three fields
-    std::istringstream iss(line);
-    std::string typeStr; 
-    std::getline(iss, typeStr, '|');
-    if (typeStr.empty()) {
-        // consume line
-        buffer_.erase(buffer_.begin(), it+1);
-        return std::nullopt;
-    }
+bool parseUint(std::string_view s, uint64_t &out) {
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ec == std::errc() && ptr == s.data() + s.size();
+}
 
-    std::string seqStr;
-    std::getline(iss, seqStr, '|');
-    if (seqStr.empty()) {
-        buffer_.erase(buffer_.begin(), it+1);
-        return std::nullopt;
-    }
+bool parseDouble(std::string_view s, double &out) {
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ec == std::errc() && ptr == s.data() + s.size();
+}
 
-    std::string tsStr;
-    std::getline(iss, tsStr, '|');
-    if (tsStr.empty()) {
-        // Some messages might not have more fields
-        // Just handle minimal
-        tsStr = "0";
-    }
+// Bit i set if p[i] is '|' or '\n', for the 16 bytes at p
+#if defined(__SSE2__)
+inline uint32_t delimiterMask(const char* p) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i pipes = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('|'));
+    __m128i newlines = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(pipes, newlines));
+}
+#endif
 
-    MessageType mt;
-    if (typeStr == "ADD") mt = MessageType::ADD;
-    else if (typeStr == "CANCEL") mt = MessageType::CANCEL;
-    else if (typeStr == "CANCEL_REPLACE") mt = MessageType::CANCEL_REPLACE;
-    else if (typeStr == "SNAPSHOT_REQUEST") mt = MessageType::SNAPSHOT_REQUEST;
-    else {
-        // unknown
-        LOG(LogLevel::WARN, "Unknown message type: " << typeStr);
-        buffer_.erase(buffer_.begin(), it+1);
-        return std::nullopt;
-    }
+}
 
-    uint64_t seq = std::stoull(seqStr);
-    uint64_t ts = std::stoull(tsStr);
+MessageParser::MessageParser() {
+    buffer_.resize(64 * 1024);
+}
 
-    MessageHeader hdr{mt, seq, ts};
-    return hdr;
+void MessageParser::appendData(const char* data, size_t len) {
+    // Reclaim consumed bytes once per batch; what is left is at most one
+    // partial line
+    if (head_ > 0) {
+        size_t remaining = tail_ - head_;
+        if (remaining > 0) std::memmove(buffer_.data(), buffer_.data() + head_, remaining);
+        head_ = 0;
+        tail_ = remaining;
+    }
+    if (tail_ + len > buffer_.size()) {
+        buffer_.resize(std::max(buffer_.size() * 2, tail_ + len));
+    }
+    std::memcpy(buffer_.data() + tail_, data, len);
+    tail_ += len;
 }
 
-static std::vector<std::string> splitLine(const std::string &line) {
-    std::vector<std::string> parts;
-    size_t start = 0;
-    while (true) {
-        auto pos = line.find('|', start);
-        if (pos == std::string::npos) {
-            parts.push_back(line.substr(start));
-            break;
-        } else {
-            parts.push_back(line.substr(start, pos - start));
-            start = pos + 1;
+size_t MessageParser::tokenizeLine() {
+    const char* base = buffer_.data() + head_;
+    const size_t avail = tail_ - head_;
+    fieldCount_ = 0;
+    size_t fieldStart = 0;
+    size_t i = 0;
+
+    auto onDelimiter = [&](size_t pos) -> bool {
+        if (fieldCount_ < MAX_FIELDS) {
+            fields_[fieldCount_++] = std::string_view(base + fieldStart, pos - fieldStart);
         }
+        fieldStart = pos + 1;
+        return base[pos] == '\n';
+    };
+
+#if defined(__SSE2__)
+    for (; i + 16 <= avail; i += 16) {
+        uint32_t mask = delimiterMask(base + i);
+        while (mask) {
+            size_t pos = i + (size_t)__builtin_ctz(mask);
+            mask &= mask - 1;
+            if (onDelimiter(pos)) return pos;
+        }
+    }
+#endif
+    for (; i < avail; ++i) {
+        if (base[i] != '|' && base[i] != '\n') continue;
+        if (onDelimiter(i)) return i;
     }
-    return parts;
+    return std::string_view::npos;
 }
 
-std::optional<AddMessage> MessageParser::nextAddMessage() {
-    auto it = std::find(buffer_.begin(), buffer_.end(), '\n');
-    if (it == buffer_.end()) return std::nullopt;
-    std::string line(buffer_.begin(), it);
+MessageParser::Result MessageParser::next(ParsedMessage &out) {
+    if (head_ == tail_) return Result::NEED_MORE;
+
+    size_t lineLen = tokenizeLine();
+    if (lineLen == std::string_view::npos) {
+        if (tail_ - head_ > MAX_LINE) {
+            LOG(LogLevel::WARN, "Dropping unterminated line longer than " << MAX_LINE << " bytes");
+            head_ = tail_;
+            return Result::SKIPPED;
+        }
+        return Result::NEED_MORE;
+    }
+
+    // The line is consumed whatever its contents
+    head_ += lineLen + 1;
+
+    std::string_view type = fieldCount_ > 0 ? fields_[0] : std::string_view();
+    bool ok = false;
+    if (type == "ADD") {
+        out.type = MessageType::ADD;
+        ok = parseAdd(out.add);
+    } else if (type == "CANCEL") {
+        out.type = MessageType::CANCEL;
+        ok = parseCancel(out.cancel);
+    } else if (type == "CANCEL_REPLACE") {
+        out.type = MessageType::CANCEL_REPLACE;
+        ok = parseCancelReplace(out.cancelReplace);
+    } else if (type == "SNAPSHOT_REQUEST") {
+        out.type = MessageType::SNAPSHOT_REQUEST;
+        ok = parseSnapshotRequest(out.snapshot);
+    } else {
+        if (!type.empty()) LOG(LogLevel::WARN, "Unknown message type: " << type);
+        return Result::SKIPPED;
+    }
+
+    if (!ok) {
+        LOG(LogLevel::WARN, "Malformed " << type << " message");
+        return Result::SKIPPED;
+    }
+    return Result::MESSAGE;
+}
+
+bool MessageParser::parseHeader(MessageHeader &hdr, MessageType type) {
+    hdr.type = type;
+    if (!parseUint(fields_[1], hdr.sequence)) return false;
+    hdr.timestamp = 0;
+    // Timestamp may be left empty
+    return fields_[2].empty() || parseUint(fields_[2], hdr.timestamp);
+}
 
-    auto parts = splitLine(line);
-    // ADD|seq|ts|orderId|symbol|price|qty|side|tif|ordertype|participantId|triggerPrice|visibleQty
+bool MessageParser::parseAdd(AddMessage &msg) {
     // Side=BUY/SELL, tif=GTC/IOC/FOK, ordertype=LIMIT/MARKET/STOP_LOSS/ICEBERG
-    if (parts.size() < 8) {
-        // consume line
-        buffer_.erase(buffer_.begin(), it+1);
-        return std::nullopt;
-    }
-    if (parts[0] != "ADD") {
-        buffer_.erase(buffer_.begin(), it+1);
-        return std::nullopt;
-    }
-    AddMessage msg;
-    msg.header.type = MessageType::ADD;
-    msg.header.sequence = std::stoull(parts[1]);
-    msg.header.timestamp = std::stoull(parts[2]);
-    msg.orderId = std::stoull(parts[3]);
-    msg.symbol = parts[4];
-    msg.price = std::stod(parts[5]);
-    msg.quantity = std::stoull(parts[6]);
-    msg.side = (parts[7] == "BUY") ? Side::BUY : Side::SELL;
-
-    // Default
+    if (fieldCount_ < 8) return false;
+    if (!parseHeader(msg.header, MessageType::ADD)) return false;
+    if (!parseUint(fields_[3], msg.orderId)) return false;
+    msg.symbolId = symbols_ ? symbols_->find(fields_[4]) : INVALID_SYMBOL;
+    if (!parseDouble(fields_[5], msg.price)) return false;
+    if (!parseUint(fields_[6], msg.quantity)) return false;
+    msg.side = (fields_[7] == "BUY") ? Side::BUY : Side::SELL;
+
+    // Defaults for the optional trailing fields
     msg.tif = TimeInForce::GTC;
     msg.orderType = OrderType::LIMIT;
     msg.participantId = 0;
     msg.triggerPrice = 0.0;
     msg.visibleQuantity = msg.quantity;
+    msg.stp = SelfTradePrevention::SYMBOL_DEFAULT;
 
-    if (parts.size() >= 9) {
-        std::string tifStr = parts[8];
-        if (tifStr == "GTC") msg.tif = TimeInForce::GTC;
-        else if (tifStr == "IOC") msg.tif = TimeInForce::IOC;
-        else if (tifStr == "FOK") msg.tif = TimeInForce::FOK;
+    if (fieldCount_ >= 9) {
+        std::string_view tif = fields_[8];
+        if (tif == "IOC") msg.tif = TimeInForce::IOC;
+        else if (tif == "FOK") msg.tif = TimeInForce::FOK;
     }
-
-    if (parts.size() >= 10) {
-        std::string otype = parts[9];
-        if (otype == "LIMIT") msg.orderType = OrderType::LIMIT;
-        else if (otype == "MARKET") msg.orderType = OrderType::MARKET;
+    if (fieldCount_ >= 10) {
+        std::string_view otype = fields_[9];
+        if (otype == "MARKET") msg.orderType = OrderType::MARKET;
         else if (otype == "STOP_LOSS") msg.orderType = OrderType::STOP_LOSS;
         else if (otype == "ICEBERG") msg.orderType = OrderType::ICEBERG;
     }
-
-    if (parts.size() >= 11) {
-        msg.participantId = std::stoull(parts[10]);
-    }
-
-    if (parts.size() >= 12) {
-        msg.triggerPrice = std::stod(parts[11]);
-    }
-
-    if (parts.size() >= 13) {
-        msg.visibleQuantity = std::stoull(parts[12]);
-    }
-
-    buffer_.erase(buffer_.begin(), it+1);
-    return msg;
+    if (fieldCount_ >= 11 && !parseUint(fields_[10], msg.participantId)) return false;
+    if (fieldCount_ >= 12 && !parseDouble(fields_[11], msg.triggerPrice)) return false;
+    if (fieldCount_ >= 13 && !parseUint(fields_[12], msg.visibleQuantity)) return false;
+    if (fieldCount_ >= 14) {
+        std::string_view stp = fields_[13];
+        if (stp == "CN") msg.stp = SelfTradePrevention::CANCEL_NEWEST;
+        else if (stp == "CO") msg.stp = SelfTradePrevention::CANCEL_OLDEST;
+        else if (stp == "CB") msg.stp = SelfTradePrevention::CANCEL_BOTH;
+        else if (stp == "DC") msg.stp = SelfTradePrevention::DECREMENT_AND_CANCEL;
+    }
+    return true;
 }
 
-std::optional<CancelMessage> MessageParser::nextCancelMessage() {
-    auto it = std::find(buffer_.begin(), buffer_.end(), '\n');
-    if (it == buffer_.end()) return std::nullopt;
-    std::string line(buffer_.begin(), it);
-    auto parts = splitLine(line);
-    // CANCEL|seq|ts|orderId|participantId
-    if (parts.size() < 4 || parts[0] != "CANCEL") {
-        buffer_.erase(buffer_.begin(), it+1);
-        return std::nullopt;
-    }
-
-    CancelMessage msg;
-    msg.header.type = MessageType::CANCEL;
-    msg.header.sequence = std::stoull(parts[1]);
-    msg.header.timestamp = std::stoull(parts[2]);
-    msg.orderId = std::stoull(parts[3]);
+bool MessageParser::parseCancel(CancelMessage &msg) {
+    if (fieldCount_ < 4) return false;
+    if (!parseHeader(msg.header, MessageType::CANCEL)) return false;
+    if (!parseUint(fields_[3], msg.orderId)) return false;
     msg.participantId = 0;
-    if (parts.size() >= 5) {
-        msg.participantId = std::stoull(parts[4]);
-    }
-
-    buffer_.erase(buffer_.begin(), it+1);
-    return msg;
+    if (fieldCount_ >= 5 && !parseUint(fields_[4], msg.participantId)) return false;
+    return true;
 }
 
-std::optional<CancelReplaceMessage> MessageParser::nextCancelReplaceMessage() {
-    auto it = std::find(buffer_.begin(), buffer_.end(), '\n');
-    if (it == buffer_.end()) return std::nullopt;
-    std::string line(buffer_.begin(), it);
-    auto parts = splitLine(line);
-    // CANCEL_REPLACE|seq|ts|orderId|newPrice|newQty|participantId
-    if (parts.size() < 6 || parts[0] != "CANCEL_REPLACE") {
-        buffer_.erase(buffer_.begin(), it+1);
-        return std::nullopt;
-    }
-    CancelReplaceMessage msg;
-    msg.header.type = MessageType::CANCEL_REPLACE;
-    msg.header.sequence = std::stoull(parts[1]);
-    msg.header.timestamp = std::stoull(parts[2]);
-    msg.orderId = std::stoull(parts[3]);
-    msg.newPrice = std::stod(parts[4]);
-    msg.newQuantity = std::stoull(parts[5]);
+bool MessageParser::parseCancelReplace(CancelReplaceMessage &msg) {
+    if (fieldCount_ < 6) return false;
+    if (!parseHeader(msg.header, MessageType::CANCEL_REPLACE)) return false;
+    if (!parseUint(fields_[3], msg.orderId)) return false;
+    if (!parseDouble(fields_[4], msg.newPrice)) return false;
+    if (!parseUint(fields_[5], msg.newQuantity)) return false;
     msg.participantId = 0;
-    if (parts.size() >= 7) {
-        msg.participantId = std::stoull(parts[6]);
-    }
-
-    buffer_.erase(buffer_.begin(), it+1);
-    return msg;
+    if (fieldCount_ >= 7 && !parseUint(fields_[6], msg.participantId)) return false;
+    return true;
 }
 
-std::optional<SnapshotRequest> MessageParser::nextSnapshotRequest() {
-    auto it = std::find(buffer_.begin(), buffer_.end(), '\n');
-    if (it == buffer_.end()) return std::nullopt;
-    std::string line(buffer_.begin(), it);
-    auto parts = splitLine(line);
-    // SNAPSHOT_REQUEST|seq|ts|symbol
-    if (parts.size() < 4 || parts[0] != "SNAPSHOT_REQUEST") {
-        buffer_.erase(buffer_.begin(), it+1);
-        return std::nullopt;
-    }
-
-    SnapshotRequest msg;
-    msg.header.type = MessageType::SNAPSHOT_REQUEST;
-    msg.header.sequence = std::stoull(parts[1]);
-    msg.header.timestamp = std::stoull(parts[2]);
-    msg.symbol = parts[3];
-
-    buffer_.erase(buffer_.begin(), it+1);
-    return msg;
+bool MessageParser::parseSnapshotRequest(SnapshotRequest &msg) {
+    if (fieldCount_ < 4) return false;
+    if (!parseHeader(msg.header, MessageType::SNAPSHOT_REQUEST)) return false;
+    msg.symbolId = symbols_ ? symbols_->find(fields_[3]) : INVALID_SYMBOL;
+    uint64_t depth = 1;
+    if (fieldCount_ >= 5 && !parseUint(fields_[4], depth)) return false;
+    msg.depth = (uint32_t)std::min<uint64_t>(depth, MAX_SNAPSHOT_DEPTH);
+    return true;
 }
-
@@ -1,18 +1,67 @@
 #pragma once
 #include "Messages.h"
+#include "SymbolTable.h"
+#include <cstddef>
+#include <string_view>
 #include <vector>
-#include <optional>
 
+// Holds the most recently parsed message; only the member matching type is
+// valid. Reusing one instance per session keeps parsing allocation-free.
+struct ParsedMessage {
+    MessageType type = MessageType::HEARTBEAT;
+    AddMessage add;
+    CancelMessage cancel;
+    CancelReplaceMessage cancelReplace;
+    SnapshotRequest snapshot;
+};
+
+// Pipe-delimited text protocol, one message per '\n' terminated line:
+//   ADD|seq|ts|orderId|symbol|price|qty|side|tif|ordertype|participantId|triggerPrice|visibleQty
+//   CANCEL|seq|ts|orderId|participantId
+//   CANCEL_REPLACE|seq|ts|orderId|newPrice|newQty|participantId
+//   SNAPSHOT_REQUEST|seq|ts|symbol
+//
+// Input accumulates in a slab consumed from the front by advancing an
+// offset. Each line is tokenized in a single pass that looks for '|' and
+// '\n' together (16 bytes at a time with SSE2), fields are string_views into
+// the slab and numbers are parsed with std::from_chars. Consumed bytes are
+// reclaimed once per appendData() rather than once per message.
 class MessageParser {
 public:
+    static constexpr size_t MAX_LINE = 1024;
+    static constexpr size_t MAX_FIELDS = 16;
+
+    enum class Result {
+        NEED_MORE, // no complete line buffered
+        MESSAGE,   // out holds a message
+        SKIPPED    // a malformed or unknown line was dropped
+    };
+
+    MessageParser();
+
+    // Symbols are interned as they are parsed; without a table, or for an
+    // unknown symbol, the id is INVALID_SYMBOL and the request is rejected
+    // downstream
+    void setSymbols(const SymbolTable* symbols) { symbols_ = symbols; }
+
     void appendData(const char* data, size_t len);
-    std::optional<MessageHeader> nextMessageHeader();
-    std::optional<AddMessage> nextAddMessage();
-    std::optional<CancelMessage> nextCancelMessage();
-    std::optional<CancelReplaceMessage> nextCancelReplaceMessage();
-    std::optional<SnapshotRequest> nextSnapshotRequest();
+    Result next(ParsedMessage &out);
 
 private:
+    const SymbolTable* symbols_ = nullptr;
     std::vector<char> buffer_;
-};
+    size_t head_ = 0; // first unconsumed byte
+    size_t tail_ = 0; // end of valid data
+
+    std::string_view fields_[MAX_FIELDS];
+    size_t fieldCount_ = 0;
 
+    // Split the line at head_ into fields_; returns its length or npos
+    size_t tokenizeLine();
+
+    bool parseAdd(AddMessage &msg);
+    bool parseCancel(CancelMessage &msg);
+    bool parseCancelReplace(CancelReplaceMessage &msg);
+    bool parseSnapshotRequest(SnapshotRequest &msg);
+    bool parseHeader(MessageHeader &hdr, MessageType type);
+};
@@ -1,6 +1,9 @@
 #pragma once
 #include <string>
 #include <cstdint>
+#include <vector>
+#include "Price.h"
+#include "SymbolTable.h"
 
 enum class MessageType {
     ADD,
@@ -27,6 +30,28 @@ enum class OrderType : uint8_t {
     ICEBERG
 };
 
+// What happens when an order would trade with another of its participant's.
+// Newest is the order that arrived later (the aggressor), oldest the one
+// resting. Either way matching carries on with the rest of the book.
+enum class SelfTradePrevention : uint8_t {
+    SYMBOL_DEFAULT,      // an order's mode: use its symbol's
+    CANCEL_NEWEST,
+    CANCEL_OLDEST,
+    CANCEL_BOTH,
+    DECREMENT_AND_CANCEL // take the smaller quantity off both, no trade; cancels whichever reaches 0
+};
+
+// Why a request was refused, when there is more to say than NACK
+enum class RejectReason : uint8_t {
+    NONE,           // not given
+    OPEN_ORDERS,    // pre-trade risk: the participant's open order limit
+    GROSS_NOTIONAL, // open notional over all symbols
+    POSITION,       // worst-case position in the symbol
+    MESSAGE_RATE,   // new orders and replaces per second
+    RISK_CAPACITY   // no risk slot left for a new participant
+};
+constexpr size_t RISK_REJECT_REASONS = 6;
+
 struct MessageHeader {
     MessageType type;
     uint64_t sequence;
@@ -36,7 +61,7 @@ struct MessageHeader {
 struct AddMessage {
     MessageHeader header;
     uint64_t orderId;
-    std::string symbol;
+    SymbolId symbolId = INVALID_SYMBOL; // interned by the parser
     double price;
     uint64_t quantity;
     Side side;
@@ -45,6 +70,7 @@ struct AddMessage {
     uint64_t participantId;
     double triggerPrice;      // For STOP_LOSS
     uint64_t visibleQuantity; // For ICEBERG
+    SelfTradePrevention stp = SelfTradePrevention::SYMBOL_DEFAULT;
 };
 
 struct CancelMessage {
@@ -65,16 +91,39 @@ struct ExecutionMessage {
     MessageHeader header;
     uint64_t buyOrderId;
     uint64_t sellOrderId;
-    char symbol[8];
-    double price;
+    SymbolId symbolId;
+    Price price;       // ticks, converted at egress
     uint64_t quantity;
     uint64_t buyParticipantId;
     uint64_t sellParticipantId;
+    uint64_t buyLeavesQuantity = 0;  // still open on each order after this fill
+    uint64_t sellLeavesQuantity = 0;
 };
 
+// One side of an execution, reported to the session that owns the order
+struct FillReport {
+    uint64_t execId;         // execution sequence, unique within the symbol
+    uint64_t orderId;
+    uint64_t participantId;
+    SymbolId symbolId;
+    Side side;
+    double price;
+    uint64_t quantity;       // filled by this execution
+    uint64_t leavesQuantity; // still open after it
+};
+
+constexpr uint32_t MAX_SNAPSHOT_DEPTH = 50;
+
 struct SnapshotRequest {
     MessageHeader header;
-    std::string symbol;
+    SymbolId symbolId = INVALID_SYMBOL;
+    uint32_t depth = 1; // price levels per side, 1..MAX_SNAPSHOT_DEPTH
+};
+
+struct DepthLevel {
+    double price;
+    uint64_t quantity;   // resting at this price
+    uint32_t orderCount;
 };
 
 struct SnapshotResponse {
@@ -83,5 +132,6 @@ struct SnapshotResponse {
     double bestBid;
     double bestAsk;
     double lastTradePrice;
-    // Could add more levels later but not required for now
+    std::vector<DepthLevel> bids; // best first, at most the requested depth
+    std::vector<DepthLevel> asks;
 };
@@ -7,7 +7,7 @@
 #include <arpa/inet.h>
 #include <cstring>
 
-int NetworkInterface::setupListener(const std::string &host, int port) {
+int NetworkInterface::setupListener(const std::string &host, int port, bool reusePort) {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) {
         LOG(LogLevel::ERROR, "socket creation failed");
@@ -16,6 +16,11 @@ int NetworkInterface::setupListener(const std::string &host, int port) {
 
     int optval = 1;
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+        LOG(LogLevel::ERROR, "SO_REUSEPORT failed");
+        close(fd);
+        return -1;
+    }
     
     sockaddr_in addr;
     std::memset(&addr, 0, sizeof(addr));
@@ -33,7 +38,7 @@ int NetworkInterface::setupListener(const std::string &host, int port) {
         return -1;
     }
 
-    if (listen(fd, 128) < 0) {
+    if (listen(fd, SOMAXCONN) < 0) {
         LOG(LogLevel::ERROR, "listen failed");
         close(fd);
         return -1;
@@ -4,7 +4,9 @@
 
 class NetworkInterface {
 public:
-    int setupListener(const std::string &host, int port);
+    // With reusePort every listener bound to the port gets its own accept
+    // queue and the kernel spreads new connections across them (Linux)
+    int setupListener(const std::string &host, int port, bool reusePort = false);
     bool setNonBlocking(int fd);
     int acceptClient(int listenFd, std::string &clientAddrOut);
 };
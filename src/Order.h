@@ -1,33 +1,49 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include "Messages.h"
+#include "Price.h"
+
+struct PriceLevel;
 
 struct Order {
     uint64_t orderId;
     Side side;
-    char symbol[8];
-    double price;
-    uint64_t quantity;
+    SymbolId symbolId;
+    Price price;              // ticks
+    uint64_t quantity;        // open; for an iceberg only its displayed slice
     uint64_t timestamp;
     uint64_t participantId;
     TimeInForce tif;
     OrderType orderType;
-    double triggerPrice;      
-    uint64_t visibleQuantity;
-    uint64_t totalQuantity; // For iceberg: total initial qty
+    Price triggerPrice;       // ticks
+    uint64_t visibleQuantity; // iceberg display size
+    uint64_t hiddenQuantity;  // iceberg reserve behind the displayed slice
+    SelfTradePrevention stp = SelfTradePrevention::SYMBOL_DEFAULT;
+
+    // Intrusive FIFO links, owned by the PriceLevel the order rests on
+    Order* prev = nullptr;
+    Order* next = nullptr;
+    PriceLevel* level = nullptr;
 
-    Order(uint64_t id, Side s, const std::string &sym, double p, uint64_t q, uint64_t ts,
-          uint64_t partId, TimeInForce t, OrderType otype, double trigP, uint64_t visQty)
-        : orderId(id), side(s), price(p), quantity(q), timestamp(ts),
+    Order(uint64_t id, Side s, SymbolId sym, Price p, uint64_t q, uint64_t ts,
+          uint64_t partId, TimeInForce t, OrderType otype, Price trigP, uint64_t visQty)
+        : orderId(id), side(s), symbolId(sym), price(p), quantity(q), timestamp(ts),
           participantId(partId), tif(t), orderType(otype), triggerPrice(trigP),
-          visibleQuantity(visQty), totalQuantity(q) {
-        for (size_t i = 0; i<7 && i<sym.size(); i++) {
-            symbol[i] = sym[i];
-        }
-        symbol[std::min<size_t>(sym.size(),7)] = '\0';
+          visibleQuantity(visQty), hiddenQuantity(0) {
+        setOpenQuantity(q);
     }
 
     Order() = default;
+
+    uint64_t openQuantity() const { return quantity + hiddenQuantity; }
+
+    // An iceberg shows at most visibleQuantity and keeps the rest hidden; a
+    // display size of 0 shows everything
+    void setOpenQuantity(uint64_t qty) {
+        quantity = (orderType == OrderType::ICEBERG && visibleQuantity > 0) ? std::min(qty, visibleQuantity) : qty;
+        hiddenQuantity = qty - quantity;
+    }
 };
 
@@ -1,44 +1,71 @@
 #include "OrderBook.h"
 #include "Logging.h"
+#include "LadderPriceLevels.h"
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 
-OrderBook::OrderBook() {}
+OrderBook::OrderBook()
+    : bids(std::make_unique<MapBidLevels>()), asks(std::make_unique<MapAskLevels>()) {}
+
+void OrderBook::setBookType(BookType type, Price minPrice, Price maxPrice) {
+    if (!bids->empty() || !asks->empty()) {
+        LOG(LogLevel::ERROR, "setBookType: book is not empty");
+        return;
+    }
+    if (type == BookType::LADDER) {
+        bids = std::make_unique<LadderPriceLevels>(Side::BUY, minPrice, maxPrice);
+        asks = std::make_unique<LadderPriceLevels>(Side::SELL, minPrice, maxPrice);
+    } else {
+        bids = std::make_unique<MapBidLevels>();
+        asks = std::make_unique<MapAskLevels>();
+    }
+}
 
 bool OrderBook::addOrder(Order* o) {
     if (!o) { LOG(LogLevel::ERROR, "addOrder: Null order pointer"); return false; }
-    if (orderLookup.find(o->orderId) != orderLookup.end()) {
+    if (orderLookup.contains(o->orderId)) {
         LOG(LogLevel::WARN, "addOrder: orderId already exists");
         return false;
     }
+    if (o->orderId == OrderIndex<Order*>::EMPTY) {
+        LOG(LogLevel::WARN, "addOrder: orderId is reserved");
+        return false;
+    }
 
     if (o->orderType == OrderType::STOP_LOSS) {
         insertStopOrder(o);
-        orderLookup[o->orderId] = o;
+        orderLookup.set(o->orderId, o);
+        trackOpen(o, 1, (int64_t)o->openQuantity());
         return true;
     }
 
     if (o->orderType == OrderType::MARKET) {
-        // Market orders won't rest in the book.
-        // They will be matched immediately by the caller.
-        // Just add to lookup so we can cancel if needed quickly (FOK scenario)
-        orderLookup[o->orderId] = o;
-        return true;
+        LOG(LogLevel::WARN, "addOrder: market orders do not rest");
+        return false;
     }
 
-    auto &book = (o->side == Side::BUY) ? bids : asks;
-    book[o->price].push(o);
-    orderLookup[o->orderId] = o;
+    auto &book = (o->side == Side::BUY) ? *bids : *asks;
+    PriceLevel* level = book.getOrCreate(o->price);
+    if (!level) {
+        LOG(LogLevel::WARN, "addOrder: price outside book range");
+        return false;
+    }
+    level->pushBack(o);
+    orderLookup.set(o->orderId, o);
+    countResting(o, 1);
+    trackOpen(o, 1, (int64_t)o->openQuantity());
+    emit(BookEvent::Type::ADD, o);
     return true;
 }
 
 bool OrderBook::cancelOrder(uint64_t orderId, uint64_t participantId) {
-    auto it = orderLookup.find(orderId);
-    if (it == orderLookup.end()) {
+    Order** found = orderLookup.find(orderId);
+    if (!found) {
         LOG(LogLevel::INFO, "cancelOrder: orderId not found");
         return false;
     }
-    Order* o = it->second;
+    Order* o = *found;
     if (o->participantId != participantId) {
         LOG(LogLevel::WARN, "cancelOrder: participant mismatch");
         return false; // not allowed to cancel others' orders
@@ -69,11 +96,7 @@ bool OrderBook::cancelOrder(uint64_t orderId, uint64_t participantId) {
         if (!found) {
             LOG(LogLevel::WARN, "cancelOrder: stop order not found in stopOrders map");
         }
-        orderLookup.erase(orderId);
-        orderPool_->deallocate(o);
-        return true;
-    } else if (o->orderType == OrderType::MARKET) {
-        // If market order is still here, means FOK/IOC scenario
+        trackOpen(o, -1, -(int64_t)o->openQuantity());
         orderLookup.erase(orderId);
         orderPool_->deallocate(o);
         return true;
@@ -86,13 +109,13 @@ bool OrderBook::cancelOrder(uint64_t orderId, uint64_t participantId) {
     return removed;
 }
 
-bool OrderBook::modifyOrder(uint64_t orderId, double newPrice, uint64_t newQty, uint64_t participantId) {
-    auto it = orderLookup.find(orderId);
-    if (it == orderLookup.end()) {
+bool OrderBook::modifyOrder(uint64_t orderId, Price newPrice, uint64_t newQty, uint64_t participantId) {
+    Order** found = orderLookup.find(orderId);
+    if (!found) {
         LOG(LogLevel::INFO, "modifyOrder: orderId not found");
         return false;
     }
-    Order* oldOrder = it->second;
+    Order* oldOrder = *found;
     if (oldOrder->participantId != participantId) {
         LOG(LogLevel::WARN, "modifyOrder: participant mismatch");
         return false;
@@ -105,83 +128,107 @@ bool OrderBook::modifyOrder(uint64_t orderId, double newPrice, uint64_t newQty,
         return false;
     }
 
+    auto &book = (oldOrder->side == Side::BUY) ? *bids : *asks;
+    if (!book.accepts(newPrice)) {
+        LOG(LogLevel::WARN, "modifyOrder: price outside book range");
+        return false;
+    }
+    if (!oldOrder->level) {
+        return false;
+    }
+
+    // Quantity-down at the same price keeps time priority and is done in
+    // place, taking an iceberg's hidden reserve first
+    if (newPrice == oldOrder->price && newQty <= oldOrder->openQuantity()) {
+        uint64_t cut = oldOrder->openQuantity() - newQty;
+        uint64_t fromHidden = std::min(cut, oldOrder->hiddenQuantity);
+        oldOrder->level->reduceHidden(oldOrder, fromHidden);
+        oldOrder->level->reduce(oldOrder, cut - fromHidden);
+        trackOpen(oldOrder, 0, -(int64_t)cut);
+        emit(BookEvent::Type::MODIFY, oldOrder);
+        return true;
+    }
+
     if (!removeOrderFromBook(oldOrder)) {
         return false;
     }
 
     oldOrder->price = newPrice;
-    oldOrder->quantity = newQty;
-    oldOrder->visibleQuantity = (oldOrder->orderType == OrderType::ICEBERG && oldOrder->visibleQuantity > newQty) ? newQty : oldOrder->visibleQuantity;
-    oldOrder->totalQuantity = newQty;
+    oldOrder->setOpenQuantity(newQty);
 
-    auto &book = (oldOrder->side == Side::BUY) ? bids : asks;
-    book[newPrice].push(oldOrder);
-    orderLookup[oldOrder->orderId] = oldOrder;
+    book.getOrCreate(newPrice)->pushBack(oldOrder);
+    orderLookup.set(oldOrder->orderId, oldOrder);
+    countResting(oldOrder, 1);
+    trackOpen(oldOrder, 1, (int64_t)oldOrder->openQuantity());
+    emit(BookEvent::Type::ADD, oldOrder);
     return true;
 }
 
 bool OrderBook::removeOrderFromBook(Order* o) {
-    auto &book = (o->side == Side::BUY) ? bids : asks;
-    auto it = book.find(o->price);
-    if (it == book.end()) return false;
-
-    std::queue<Order*> &q = it->second;
-    std::queue<Order*> newQ;
-    bool removed = false;
-    while(!q.empty()) {
-        Order* front = q.front(); q.pop();
-        if (front == o) {
-            removed = true;
-        } else {
-            newQ.push(front);
-        }
-    }
-    if (newQ.empty()) {
-        book.erase(it);
-    } else {
-        it->second = std::move(newQ);
+    PriceLevel* level = o->level;
+    if (!level) return false;
+
+    emit(BookEvent::Type::DELETE, o);
+    level->remove(o);
+    if (level->empty()) {
+        auto &book = (o->side == Side::BUY) ? *bids : *asks;
+        book.erase(level);
     }
-    if (removed) {
-        orderLookup.erase(o->orderId);
-    }
-    return removed;
+    orderLookup.erase(o->orderId);
+    countResting(o, -1);
+    trackOpen(o, -1, -(int64_t)o->openQuantity());
+    return true;
+}
+
+void OrderBook::countResting(const Order* o, int delta) {
+    RestingCount* found = restingByParticipant_.find(o->participantId);
+    RestingCount count = found ? *found : RestingCount{};
+    (o->side == Side::BUY ? count.bids : count.asks) += delta;
+    if (count.bids == 0 && count.asks == 0) restingByParticipant_.erase(o->participantId);
+    else if (found) *found = count;
+    else restingByParticipant_.set(o->participantId, count);
+}
+
+bool OrderBook::hasResting(uint64_t participantId, Side side) const {
+    const RestingCount* count = restingByParticipant_.find(participantId);
+    return count && (side == Side::BUY ? count->bids : count->asks) > 0;
 }
 
-void OrderBook::getTopOfBook(double &bestBid, double &bestAsk) {
-    std::shared_lock<std::shared_mutex> lock(bookMutex);
-    bestBid = (bids.empty()) ? 0.0 : bids.rbegin()->first;
-    bestAsk = (asks.empty()) ? 0.0 : asks.begin()->first;
+void OrderBook::getTopOfBook(Price &bestBid, Price &bestAsk) {
+    PriceLevel* bid = bids->best();
+    PriceLevel* ask = asks->best();
+    bestBid = bid ? bid->price : 0;
+    bestAsk = ask ? ask->price : 0;
 }
 
 std::vector<ExecutionMessage> OrderBook::match(uint64_t seqBase, uint64_t timestamp) {
-    std::unique_lock<std::shared_mutex> lock(bookMutex);
-    // Trigger stop orders if needed
-    triggerStopOrders(timestamp, seqBase);
-    return matchBook(seqBase, timestamp);
+    auto trades = matchBook(seqBase, timestamp);
+    if (!trades.empty()) {
+        seqBase = trades.back().header.sequence + 1;
+        std::vector<uint64_t> activated;
+        triggerStopOrders(timestamp, seqBase, trades, activated);
+    }
+    return trades;
 }
 
 std::vector<ExecutionMessage> OrderBook::matchBook(uint64_t seqBase, uint64_t timestamp) {
     std::vector<ExecutionMessage> trades;
-    while(!bids.empty() && !asks.empty()) {
-        double bestBid = bids.rbegin()->first;
-        double bestAsk = asks.begin()->first;
-        if (bestBid < bestAsk) break;
+    while (true) {
+        PriceLevel* bidLevel = bids->best();
+        PriceLevel* askLevel = asks->best();
+        if (!bidLevel || !askLevel) break;
+        if (bidLevel->price < askLevel->price) break;
 
-        auto &bidQueue = bids.rbegin()->second;
-        auto &askQueue = asks.begin()->second;
-        Order* bidOrder = bidQueue.front();
-        Order* askOrder = askQueue.front();
+        Order* bidOrder = bidLevel->head;
+        Order* askOrder = askLevel->head;
 
-        // Prevent self-trade
         if (bidOrder->participantId == askOrder->participantId) {
-            // If same participant, we cannot match these two.
-            // Move on by removing or skipping one side. Typically you'd just break.
-            // We'll just break as no trade is possible at this price level.
-            break;
+            preventSelfTrade(bidOrder, askOrder);
+            continue;
         }
 
         uint64_t tradeQty = std::min(bidOrder->quantity, askOrder->quantity);
-        double tradePrice = askOrder->price; // trades at passive order price
+        Price tradePrice = askOrder->price; // trades at passive order price
 
         ExecutionMessage exec;
         exec.header.type = MessageType::EXECUTION;
@@ -189,136 +236,237 @@ std::vector<ExecutionMessage> OrderBook::matchBook(uint64_t seqBase, uint64_t ti
         exec.header.timestamp = timestamp;
         exec.buyOrderId = (bidOrder->side == Side::BUY) ? bidOrder->orderId : askOrder->orderId;
         exec.sellOrderId = (askOrder->side == Side::SELL) ? askOrder->orderId : bidOrder->orderId;
-        for (int i=0; i<8; i++) exec.symbol[i] = bidOrder->symbol[i];
+        exec.symbolId = bidOrder->symbolId;
         exec.price = tradePrice;
         exec.quantity = tradeQty;
         exec.buyParticipantId = bidOrder->participantId;
         exec.sellParticipantId = askOrder->participantId;
-        trades.push_back(exec);
-
-        bidOrder->quantity -= tradeQty;
-        askOrder->quantity -= tradeQty;
+        // The later of the two arrived last and took liquidity
+        emitTrade(exec, bidOrder->timestamp > askOrder->timestamp ? Side::BUY : Side::SELL);
 
         recordTradePrice(tradePrice, tradeQty);
-        if (bidOrder->orderType == OrderType::ICEBERG) refreshIceberg(bidOrder);
-        if (askOrder->orderType == OrderType::ICEBERG) refreshIceberg(askOrder);
+        exec.buyLeavesQuantity = fillResting(*bids, bidLevel, bidOrder, tradeQty);
+        exec.sellLeavesQuantity = fillResting(*asks, askLevel, askOrder, tradeQty);
+        trades.push_back(exec);
+    }
+    return trades;
+}
 
-        if (bidOrder->quantity == 0) {
-            bidQueue.pop();
-            orderLookup.erase(bidOrder->orderId);
-            if (orderPool_) orderPool_->deallocate(bidOrder);
+bool OrderBook::canFill(const Order &o) {
+    PriceLevels &book = (o.side == Side::BUY) ? *asks : *bids;
+    uint64_t need = o.openQuantity();
+    // Without orders of its own on the other side the aggressor meets no
+    // self-trade, and each level's totals say all it can take there
+    bool ownOrders = hasResting(o.participantId, o.side == Side::BUY ? Side::SELL : Side::BUY);
+    SelfTradePrevention mode = selfTradeMode(&o);
+    for (const PriceLevel* level = book.best(); level; level = book.next(level)) {
+        if (!crosses(o, level->price)) return false;
+        if (!ownOrders) {
+            uint64_t available = level->totalQuantity + level->hiddenQuantity;
+            if (available >= need) return true;
+            need -= available;
+            continue;
         }
-
-        if (askOrder->quantity == 0) {
-            askQueue.pop();
-            orderLookup.erase(askOrder->orderId);
-            if (orderPool_) orderPool_->deallocate(askOrder);
+        // Walk the queue as matchAggressor would. Meeting its own order
+        // stops the walk or shrinks the aggressor without a fill, unless the
+        // resting order is the one cancelled.
+        uint64_t hidden = 0;
+        for (const Order* r = level->head; r; r = r->next) {
+            if (r->participantId == o.participantId) {
+                if (mode != SelfTradePrevention::CANCEL_OLDEST) return false;
+                continue;
+            }
+            if (r->quantity >= need) return true;
+            need -= r->quantity;
+            hidden += r->hiddenQuantity;
         }
+        // Reserves refill behind the queue and trade once it is through
+        if (hidden >= need) return true;
+        need -= hidden;
+    }
+    return false;
+}
 
-        if (bidQueue.empty()) {
-            auto bidIter = bids.end(); 
-            --bidIter;
-            bids.erase(bidIter->first);
+bool OrderBook::matchAggressor(Order* o, uint64_t &seqBase, uint64_t timestamp, std::vector<ExecutionMessage> &trades) {
+    PriceLevels &book = (o->side == Side::BUY) ? *asks : *bids;
+    // Nothing of an incoming iceberg is hidden until it rests
+    o->quantity = o->openQuantity();
+    o->hiddenQuantity = 0;
+    bool cancelled = false;
+    while (o->quantity > 0) {
+        PriceLevel* level = book.best();
+        if (!level || !crosses(*o, level->price)) break;
+
+        Order* resting = level->head;
+        if (resting->participantId == o->participantId) {
+            // The aggressor is the newest; it is not on the book, so
+            // cancelling it just stops the walk
+            SelfTradePrevention mode = selfTradeMode(o);
+            if (mode == SelfTradePrevention::DECREMENT_AND_CANCEL) {
+                uint64_t qty = std::min(o->quantity, resting->quantity);
+                uint64_t restingId = resting->orderId;
+                o->quantity -= qty;
+                if (fillResting(book, level, resting, qty) == 0) selfTradeCancels_.push_back(restingId);
+                continue;
+            }
+            if (mode != SelfTradePrevention::CANCEL_NEWEST) cancelSelfTrade(resting);
+            if (mode != SelfTradePrevention::CANCEL_OLDEST) {
+                cancelled = true;
+                break;
+            }
+            continue;
         }
 
-        if (askQueue.empty()) {
-            asks.erase(asks.begin()->first);
+        uint64_t tradeQty = std::min(o->quantity, resting->quantity);
+        ExecutionMessage exec;
+        exec.header.type = MessageType::EXECUTION;
+        exec.header.sequence = seqBase++;
+        exec.header.timestamp = timestamp;
+        const Order* buy = o->side == Side::BUY ? o : resting;
+        const Order* sell = o->side == Side::BUY ? resting : o;
+        exec.buyOrderId = buy->orderId;
+        exec.sellOrderId = sell->orderId;
+        exec.symbolId = o->symbolId;
+        exec.price = level->price;
+        exec.quantity = tradeQty;
+        exec.buyParticipantId = buy->participantId;
+        exec.sellParticipantId = sell->participantId;
+        emitTrade(exec, o->side);
+
+        recordTradePrice(level->price, tradeQty);
+        o->quantity -= tradeQty;
+        uint64_t restingLeaves = fillResting(book, level, resting, tradeQty);
+        exec.buyLeavesQuantity = o->side == Side::BUY ? o->quantity : restingLeaves;
+        exec.sellLeavesQuantity = o->side == Side::BUY ? restingLeaves : o->quantity;
+        trades.push_back(exec);
+    }
+    o->setOpenQuantity(o->quantity);
+    return !cancelled;
+}
+
+void OrderBook::preventSelfTrade(Order* bidOrder, Order* askOrder) {
+    // Same rule as the trade's aggressor: the later arrival is the newest
+    bool bidNewest = bidOrder->timestamp > askOrder->timestamp;
+    Order* newest = bidNewest ? bidOrder : askOrder;
+    Order* oldest = bidNewest ? askOrder : bidOrder;
+    switch (selfTradeMode(newest)) {
+        case SelfTradePrevention::CANCEL_OLDEST:
+            cancelSelfTrade(oldest);
+            break;
+        case SelfTradePrevention::CANCEL_BOTH:
+            cancelSelfTrade(oldest);
+            cancelSelfTrade(newest);
+            break;
+        case SelfTradePrevention::DECREMENT_AND_CANCEL: {
+            uint64_t qty = std::min(bidOrder->quantity, askOrder->quantity);
+            uint64_t bidId = bidOrder->orderId, askId = askOrder->orderId;
+            if (fillResting(*bids, bidOrder->level, bidOrder, qty) == 0) selfTradeCancels_.push_back(bidId);
+            if (fillResting(*asks, askOrder->level, askOrder, qty) == 0) selfTradeCancels_.push_back(askId);
+            break;
         }
+        default:
+            cancelSelfTrade(newest);
+            break;
     }
-    return trades;
+}
+
+void OrderBook::cancelSelfTrade(Order* o) {
+    selfTradeCancels_.push_back(o->orderId);
+    removeOrderFromBook(o);
+    if (orderPool_) orderPool_->deallocate(o);
+}
+
+uint64_t OrderBook::fillResting(PriceLevels &book, PriceLevel* level, Order* o, uint64_t qty) {
+    level->reduce(o, qty);
+    trackOpen(o, o->openQuantity() == 0 ? -1 : 0, -(int64_t)qty);
+    if (o->quantity == 0 && o->hiddenQuantity > 0) {
+        refreshIceberg(level, o);
+        return o->openQuantity();
+    }
+    uint64_t leaves = o->openQuantity();
+    emit(leaves == 0 ? BookEvent::Type::DELETE : BookEvent::Type::MODIFY, o);
+    if (leaves == 0) {
+        level->remove(o);
+        orderLookup.erase(o->orderId);
+        countResting(o, -1);
+        if (orderPool_) orderPool_->deallocate(o);
+    }
+    if (level->empty()) book.erase(level);
+    return leaves;
 }
 
 double OrderBook::getLastTradePrice() const {
-    std::shared_lock<std::shared_mutex> lock(bookMutex);
     // Use a Volume-Weighted Average Price
-    double totalValue = 0.0;
-    uint64_t totalVolume = 0;
+    return (vwapVolume_ > 0) ? (vwapValue_ / vwapVolume_) : 0.0;
+}
+
+void OrderBook::recomputeVwap() {
+    vwapValue_ = 0.0;
+    vwapVolume_ = 0;
     for (const auto &[price, quantity] : recentTrades) {
-        totalValue += price * quantity;
-        totalVolume += quantity;
+        vwapValue_ += (double)price * quantity;
+        vwapVolume_ += quantity;
+    }
+}
+
+void OrderBook::rescaleTradeHistory(double factor) {
+    for (auto &trade : recentTrades) {
+        trade.first = (Price)std::llround((double)trade.first * factor);
     }
-    return (totalVolume > 0) ? (totalValue / totalVolume) : 0.0;
+    lastTradePrice = (Price)std::llround((double)lastTradePrice * factor);
+    recomputeVwap();
 }
 
-void OrderBook::recordTradePrice(double price, uint64_t quantity) {
-    std::unique_lock<std::shared_mutex> lock(bookMutex);
+void OrderBook::recordTradePrice(Price price, uint64_t quantity) {
     recentTrades.emplace_back(price, quantity);
+    vwapValue_ += (double)price * quantity;
+    vwapVolume_ += quantity;
     if (recentTrades.size() > maxRecentTrades) {
+        auto [oldPrice, oldQuantity] = recentTrades.front();
+        vwapValue_ -= (double)oldPrice * oldQuantity;
+        vwapVolume_ -= oldQuantity;
         recentTrades.pop_front();
     }
+    lastTradePrice = price;
+    haveLastTrade = true;
 }
 
-void OrderBook::triggerStopOrders(uint64_t timestamp, uint64_t &seqBase) {
-    // If we have lastTradePrice, trigger STOP_LOSS orders
-    if (!haveLastTrade) return;
-
-    std::vector<Order*> toActivate;
-    // Buy stop: trigger when lastTradePrice <= triggerPrice
-    // We'll find all buy stops with triggerPrice >= lastTradePrice
-    {
-        auto it = stopOrdersBuy.lower_bound(lastTradePrice);
-        // Need to activate all orders with triggerPrice >= lastTradePrice
-        // Actually for buy stop-loss orders, usually they trigger if price breaks below a threshold.
-        // Here we interpret stop-loss buy: triggers if lastPrice >= triggerPrice or lastPrice <= triggerPrice?
-        // Typically a stop BUY triggers if market goes above trigger (for a breakout).
-        // A stop SELL triggers if market goes below trigger.
-        // Let's define:
-        // Stop BUY triggers if lastTradePrice >= triggerPrice
-        // Stop SELL triggers if lastTradePrice <= triggerPrice
-        // We'll adjust logic:
-    }
-
-    // Re-interpret:
-    // STOP_LOSS BUY: Activate if lastTradePrice >= triggerPrice
-    // STOP_LOSS SELL: Activate if lastTradePrice <= triggerPrice
-
-    // Activate buy stops where triggerPrice <= lastTradePrice
-    {
-        // For buy stops: triggers if lastTradePrice >= triggerPrice
-        // So we want all orders in stopOrdersBuy with triggerPrice <= lastTradePrice
-        for (auto it = stopOrdersBuy.begin(); it != stopOrdersBuy.end();) {
-            if (it->first <= lastTradePrice) {
-                toActivate.push_back(it->second);
-                it = stopOrdersBuy.erase(it);
-            } else {
-                ++it;
-            }
-        }
+void OrderBook::triggerStopOrders(uint64_t timestamp, uint64_t &seqBase, std::vector<ExecutionMessage> &trades,
+                                  std::vector<uint64_t> &activated) {
+    // Each fired stop may print trades that cross further triggers, so the
+    // crossed range is re-read after every activation until nothing fires
+    while (Order* o = popTriggeredStop()) {
+        activated.push_back(o->orderId);
+        activateStopOrder(o, timestamp, seqBase, trades);
     }
+}
 
-    // Activate sell stops where triggerPrice >= lastTradePrice
-    {
-        // Sell stops trigger if lastTradePrice <= triggerPrice
-        // Means if their triggerPrice >= lastTradePrice, we activate them
-        for (auto it = stopOrdersSell.begin(); it != stopOrdersSell.end();) {
-            if (it->first >= lastTradePrice) {
-                toActivate.push_back(it->second);
-                it = stopOrdersSell.erase(it);
-            } else {
-                ++it;
-            }
-        }
+Order* OrderBook::popTriggeredStop() {
+    if (!haveLastTrade) return nullptr;
+    if (!stopOrdersBuy.empty() && stopOrdersBuy.begin()->first <= lastTradePrice) {
+        Order* o = stopOrdersBuy.begin()->second;
+        stopOrdersBuy.erase(stopOrdersBuy.begin());
+        return o;
     }
-
-    std::vector<ExecutionMessage> dummyTrades;
-    for (auto* o : toActivate) {
-        activateStopOrder(o, timestamp, seqBase, dummyTrades);
+    if (!stopOrdersSell.empty() && std::prev(stopOrdersSell.end())->first >= lastTradePrice) {
+        // Highest trigger first; among equal triggers the earliest stop, which
+        // is the first of its key's run
+        auto it = stopOrdersSell.lower_bound(std::prev(stopOrdersSell.end())->first);
+        Order* o = it->second;
+        stopOrdersSell.erase(it);
+        return o;
     }
-
-    // Now that stop orders are activated as market orders, they will match on the next match call
-    // Actually, we can immediately attempt to match them by calling matchBook again
-    // but that is done by the caller after triggerStopOrders.
+    return nullptr;
 }
 
 void OrderBook::activateStopOrder(Order* o, uint64_t timestamp, uint64_t &seqBase, std::vector<ExecutionMessage> &trades) {
-    // Turn stop-loss order into a market order (or limit if we prefer)
-    // For simplicity, stop orders become market orders when triggered
+    // A fired stop is a market order: it takes what the opposite side has
+    // and the rest is dropped, like any other market order
+    trackOpen(o, -1, -(int64_t)o->openQuantity());
     o->orderType = OrderType::MARKET;
-    // Insert into lookup if not present
-    orderLookup[o->orderId] = o;
-    // They will be matched later (caller will run matchBook)
-    // Market orders do not rest in book, matching engine handles them immediately.
-    // This function just changes their type. The engine call after this should handle them.
+    matchAggressor(o, seqBase, timestamp, trades);
+    orderLookup.erase(o->orderId);
+    if (orderPool_) orderPool_->deallocate(o);
 }
 
 void OrderBook::insertStopOrder(Order* o) {
@@ -329,24 +477,137 @@ void OrderBook::insertStopOrder(Order* o) {
     }
 }
 
-void OrderBook::refreshIceberg(Order* o) {
-    if (o->orderType != OrderType::ICEBERG) return;
+void OrderBook::refreshIceberg(PriceLevel* level, Order* o) {
+    // To the feed the spent slice leaves and a fresh one joins the back
+    emit(BookEvent::Type::DELETE, o);
+    level->remove(o);
+    uint64_t slice = std::min(o->visibleQuantity, o->hiddenQuantity);
+    o->quantity = slice;
+    o->hiddenQuantity -= slice;
+    level->pushBack(o);
+    emit(BookEvent::Type::ADD, o);
+}
 
-    // If visibleQuantity is depleted but totalQuantity still > quantity, we can refresh visible.
-    uint64_t alreadyVisible = o->totalQuantity - o->quantity;
-    if (o->quantity < o->visibleQuantity && o->quantity > 0) {
-        // visibleQuantity can't exceed current quantity
-        // Actually, iceberg logic: visibleQuantity sets how much is shown. If partially filled,
-        // once visible is depleted, we show again up to visibleQuantity, but not exceeding total left.
-        // If currently quantity < visibleQuantity, no need to do anything, it's already less visible.
-        return;
-    } else if (o->quantity > o->visibleQuantity) {
-        // It's possible that after trade, full visible was taken. We still have more hidden qty.
-        // Actually, we only refresh iceberg after a fill reduces visible to 0.
-        // If quantity still >= visibleQuantity, we do nothing special.
-        return;
+void OrderBook::emit(BookEvent::Type type, const Order* o) {
+    if (!events_) return;
+    events_->push_back(BookEvent{type, o->side, o->orderId, 0, o->price, type == BookEvent::Type::DELETE ? 0 : o->quantity});
+}
+
+void OrderBook::emitTrade(const ExecutionMessage &exec, Side aggressor) {
+    if (!events_) return;
+    events_->push_back(BookEvent{BookEvent::Type::TRADE, aggressor, exec.buyOrderId, exec.sellOrderId, exec.price, exec.quantity});
+}
+
+void OrderBook::setRisk(RiskEngine* risk) {
+    risk_ = risk;
+    for (PriceLevels* levels : {bids.get(), asks.get()}) {
+        for (PriceLevel* level = levels->best(); level; level = levels->next(level)) {
+            for (Order* o = level->head; o; o = o->next) trackOpen(o, 1, (int64_t)o->openQuantity());
+        }
+    }
+    for (auto &entry : stopOrdersBuy) trackOpen(entry.second, 1, (int64_t)entry.second->openQuantity());
+    for (auto &entry : stopOrdersSell) trackOpen(entry.second, 1, (int64_t)entry.second->openQuantity());
+}
+
+void OrderBook::emitRestingOrders() {
+    for (PriceLevels* side : {bids.get(), asks.get()}) {
+        for (PriceLevel* level = side->best(); level; level = side->next(level)) {
+            for (Order* o = level->head; o; o = o->next) emit(BookEvent::Type::ADD, o);
+        }
     }
-    // If the order was partially filled and now quantity < visibleQuantity,
-    // that means no refresh needed. If quantity =0, order is gone anyway.
 }
 
+namespace {
+
+SnapshotOrder toSnapshotOrder(const Order* o) {
+    SnapshotOrder s{};
+    s.orderId = o->orderId;
+    s.price = o->price;
+    s.quantity = o->quantity;
+    s.timestamp = o->timestamp;
+    s.participantId = o->participantId;
+    s.triggerPrice = o->triggerPrice;
+    s.visibleQuantity = o->visibleQuantity;
+    s.hiddenQuantity = o->hiddenQuantity;
+    s.side = (uint8_t)o->side;
+    s.tif = (uint8_t)o->tif;
+    s.orderType = (uint8_t)o->orderType;
+    s.stp = (uint8_t)o->stp;
+    return s;
+}
+
+}
+
+void OrderBook::captureState(BookState &out) const {
+    out.orders.clear();
+    out.stops.clear();
+    out.recentTrades.clear();
+    out.orders.reserve(orderLookup.size());
+
+    for (PriceLevels* side : {bids.get(), asks.get()}) {
+        for (PriceLevel* level = side->best(); level; level = side->next(level)) {
+            for (Order* o = level->head; o; o = o->next) {
+                out.orders.push_back(toSnapshotOrder(o));
+            }
+        }
+    }
+    for (auto* stops : {&stopOrdersBuy, &stopOrdersSell}) {
+        for (const auto &[trigger, o] : *stops) {
+            out.stops.push_back(toSnapshotOrder(o));
+        }
+    }
+    for (const auto &[price, qty] : recentTrades) {
+        out.recentTrades.push_back(SnapshotTrade{price, qty});
+    }
+    out.lastTradePrice = lastTradePrice;
+    out.haveLastTrade = haveLastTrade;
+}
+
+bool OrderBook::restoreState(const BookState &state, SymbolId symbolId) {
+    if (!orderPool_ || !orderLookup.empty() || !bids->empty() || !asks->empty()) {
+        LOG(LogLevel::ERROR, "restoreState: book must be empty and have a pool");
+        return false;
+    }
+
+    auto makeOrder = [&](const SnapshotOrder &s) -> Order* {
+        Order* o = orderPool_->allocate();
+        if (!o) return nullptr;
+        new(o) Order(s.orderId, (Side)s.side, symbolId, s.price, s.quantity, s.timestamp, s.participantId,
+                     (TimeInForce)s.tif, (OrderType)s.orderType, s.triggerPrice, s.visibleQuantity);
+        o->quantity = s.quantity;
+        o->hiddenQuantity = s.hiddenQuantity;
+        o->stp = (SelfTradePrevention)s.stp;
+        return o;
+    };
+
+    // Re-inserting in captured order recreates each level's FIFO
+    for (const SnapshotOrder &s : state.orders) {
+        Order* o = makeOrder(s);
+        if (!o) return false;
+        auto &book = (o->side == Side::BUY) ? *bids : *asks;
+        PriceLevel* level = book.getOrCreate(o->price);
+        if (!level) {
+            LOG(LogLevel::ERROR, "restoreState: order " << o->orderId << " outside book range");
+            orderPool_->deallocate(o);
+            return false;
+        }
+        level->pushBack(o);
+        orderLookup.set(o->orderId, o);
+        countResting(o, 1);
+    }
+    for (const SnapshotOrder &s : state.stops) {
+        Order* o = makeOrder(s);
+        if (!o) return false;
+        insertStopOrder(o);
+        orderLookup.set(o->orderId, o);
+    }
+
+    recentTrades.clear();
+    for (const SnapshotTrade &t : state.recentTrades) {
+        recentTrades.emplace_back(t.price, t.quantity);
+    }
+    lastTradePrice = state.lastTradePrice;
+    haveLastTrade = state.haveLastTrade;
+    recomputeVwap();
+    return true;
+}
@@ -1,17 +1,35 @@
 #pragma once
+#include <deque>
 #include <map>
-#include <queue>
-#include <unordered_map>
-#include <shared_mutex>
+#include <memory>
 #include <vector>
+#include "BookState.h"
 #include "Messages.h"
 #include "MemoryPool.h"
 #include "Order.h"
+#include "OrderIndex.h"
 #include "Logging.h"
+#include "PriceLevels.h"
+#include "RiskEngine.h"
+#include "SymbolConfig.h"
+
+// One visible change to the book, for market data. Prices are ticks.
+struct BookEvent {
+    enum class Type : uint8_t { ADD, MODIFY, DELETE, TRADE };
+    Type type;
+    Side side;             // resting order's side; aggressor's side for TRADE
+    uint64_t orderId;      // buy order for TRADE
+    uint64_t otherOrderId; // sell order for TRADE
+    Price price;
+    uint64_t quantity;     // displayed quantity after the change; traded quantity for TRADE
+};
 
 // OrderBook now also maintains stop and iceberg orders.
 // Stop-loss orders are stored in a separate structure and activated when price triggers.
-// Iceberg orders are stored like normal orders but manage visibleQuantity internally.
+// Iceberg orders rest with only their displayed slice in quantity, so matching
+// and level totals see just that; a spent slice is refilled from the hidden
+// reserve and the order goes to the back of its level.
+// Not thread-safe: a book is only touched by its MatchingEngine's thread.
 
 class OrderBook {
 public:
@@ -19,52 +37,152 @@ public:
 
     bool addOrder(Order* o);
     bool cancelOrder(uint64_t orderId, uint64_t participantId);
-    bool modifyOrder(uint64_t orderId, double newPrice, uint64_t newQty, uint64_t participantId);
+    bool modifyOrder(uint64_t orderId, Price newPrice, uint64_t newQty, uint64_t participantId);
 
     std::vector<ExecutionMessage> match(uint64_t seqBase, uint64_t timestamp);
-
-    void getTopOfBook(double &bestBid, double &bestAsk);
+    // Match an incoming order against the opposite side without resting it:
+    // a market order takes any price, a limit stops at its own. Whatever is
+    // left of o afterwards is the caller's to rest or discard. False if
+    // self-trade prevention cancelled o, whose remainder must not rest.
+    bool matchAggressor(Order* o, uint64_t &seqBase, uint64_t timestamp, std::vector<ExecutionMessage> &trades);
+    // Read-only: would matchAggressor fill all of o? Sums level totals, and
+    // walks queues only at levels where o's participant may meet itself.
+    bool canFill(const Order &o);
+
+    void getTopOfBook(Price &bestBid, Price &bestAsk);
+    // The best depth levels of one side, best first. Reads each level's
+    // running totals, so the cost is per level, not per order.
+    template<typename F>
+    void visitLevels(Side side, size_t depth, F &&visit) {
+        PriceLevels &levels = side == Side::BUY ? *bids : *asks;
+        for (PriceLevel* level = levels.best(); level && depth > 0; level = levels.next(level), --depth) {
+            visit(*level);
+        }
+    }
+    bool contains(uint64_t orderId) const { return orderLookup.contains(orderId); }
+    const Order* findOrder(uint64_t orderId) const {
+        Order* const* found = orderLookup.find(orderId);
+        return found ? *found : nullptr;
+    }
+    // Mode for orders that do not choose one; the engine keeps it in step
+    // with the symbol's config
+    void setSelfTradePrevention(SelfTradePrevention mode) {
+        selfTradeDefault_ = mode == SelfTradePrevention::SYMBOL_DEFAULT ? SelfTradePrevention::CANCEL_NEWEST : mode;
+    }
+    // Ids of orders self-trade prevention has taken off the book since the
+    // last clear; the caller retires them
+    std::vector<uint64_t>& selfTradeCancels() { return selfTradeCancels_; }
+    bool empty() const { return orderLookup.empty(); }
     void setMemoryPool(MemoryPool<Order>* pool) { orderPool_ = pool; }
+    // Pick level storage; must be called while the book is empty
+    void setBookType(BookType type, Price minPrice, Price maxPrice);
 
-    // Add a trade price to track volatility
+    // Add a trade price to track volatility. VWAP over the recent trades is
+    // in (fractional) ticks and kept as running sums, so reading it is O(1).
     double getLastTradePrice() const;
-    void recordTradePrice(double price, uint64_t quantity);
-
-    // Trigger stop-loss orders if conditions are met
-    void triggerStopOrders(uint64_t timestamp, uint64_t &seqBase);
+    void recordTradePrice(Price price, uint64_t quantity);
+    Price lastTrade() const { return lastTradePrice; }
+    uint64_t recentVolume() const { return vwapVolume_; }
+    // After a tick size change: new ticks = old ticks * factor
+    void rescaleTradeHistory(double factor);
+
+    // After trades have printed: fire every stop the last trade price has
+    // crossed, run each as a market order and repeat while its trades fire
+    // more. Fills are appended to trades and the ids of fired stops, all of
+    // which have left the book, to activated.
+    void triggerStopOrders(uint64_t timestamp, uint64_t &seqBase, std::vector<ExecutionMessage> &trades,
+                           std::vector<uint64_t> &activated);
+
+    // Snapshot support. restoreState needs an empty book and a memory pool.
+    void captureState(BookState &out) const;
+    bool restoreState(const BookState &state, SymbolId symbolId);
+
+    // Market data: while a sink is set every change to the resting orders and
+    // every trade is appended to it. Stop orders and hidden iceberg quantity
+    // are not visible.
+    void setEventSink(std::vector<BookEvent>* sink) { events_ = sink; }
+    // ADD for every resting order in priority order, to seed a new consumer
+    void emitRestingOrders();
+
+    // Pre-trade risk: report every change to the open orders, resting and
+    // stop, from now on, starting with the ones already here
+    void setRisk(RiskEngine* risk);
 
 private:
-    // For simplicity: bids: descending price, asks: ascending price
-    std::map<double, std::queue<Order*>> bids;
-    std::map<double, std::queue<Order*>> asks;
+    // Non-empty levels per side, best first
+    std::unique_ptr<PriceLevels> bids;
+    std::unique_ptr<PriceLevels> asks;
 
-    std::unordered_map<uint64_t, Order*> orderLookup;
+    OrderIndex<Order*> orderLookup;
 
-    // Stop-loss orders: store separately keyed by trigger price and side
-    // On trigger, convert them into market orders
-    // We use a multimap keyed by triggerPrice, to quickly find triggers
-    std::multimap<double, Order*> stopOrdersBuy;  // trigger when price <= triggerPrice
-    std::multimap<double, Order*> stopOrdersSell; // trigger when price >= triggerPrice
+    // Stop-loss orders by trigger price, in arrival order within a price. A
+    // buy stop fires once a trade prints at or above its trigger and a sell
+    // stop at or below, so the fired ones are always a prefix of
+    // stopOrdersBuy and a suffix of stopOrdersSell: finding them costs
+    // nothing per resting stop.
+    std::multimap<Price, Order*> stopOrdersBuy;
+    std::multimap<Price, Order*> stopOrdersSell;
 
-    // Access control
-    mutable std::shared_mutex bookMutex;
     MemoryPool<Order>* orderPool_ = nullptr;
+    std::vector<BookEvent>* events_ = nullptr;
+    SelfTradePrevention selfTradeDefault_ = SelfTradePrevention::CANCEL_NEWEST;
+    std::vector<uint64_t> selfTradeCancels_;
+
+    // Resting orders per participant and side. Lets canFill skip queue
+    // walks for the usual aggressor with nothing of its own to meet.
+    struct RestingCount {
+        uint32_t bids = 0;
+        uint32_t asks = 0;
+    };
+    OrderIndex<RestingCount> restingByParticipant_;
+    void countResting(const Order* o, int delta);
+    bool hasResting(uint64_t participantId, Side side) const;
+
+    void emit(BookEvent::Type type, const Order* o);
+
+    RiskEngine* risk_ = nullptr;
+    // A stop is valued at its trigger until it fires
+    void trackOpen(const Order* o, int32_t orders, int64_t quantity) {
+        if (!risk_) return;
+        Price price = o->orderType == OrderType::STOP_LOSS ? o->triggerPrice : o->price;
+        risk_->onOpen(o->participantId, o->symbolId, o->side, price, orders, quantity);
+    }
+    void emitTrade(const ExecutionMessage &exec, Side aggressor);
 
     // Internal utilities
     bool removeOrderFromBook(Order* o);
     void insertStopOrder(Order* o);
+    // Next stop the last trade has crossed, removed from its map; buys first
+    Order* popTriggeredStop();
     void activateStopOrder(Order* o, uint64_t timestamp, uint64_t &seqBase, std::vector<ExecutionMessage> &trades);
+    // Take qty from a resting order; removes it and its level once empty.
+    // Returns what is left of the order.
+    uint64_t fillResting(PriceLevels &book, PriceLevel* level, Order* o, uint64_t qty);
+    static bool crosses(const Order &o, Price level) {
+        if (o.orderType == OrderType::MARKET) return true;
+        return o.side == Side::BUY ? level <= o.price : level >= o.price;
+    }
+    SelfTradePrevention selfTradeMode(const Order* newest) const {
+        return newest->stp == SelfTradePrevention::SYMBOL_DEFAULT ? selfTradeDefault_ : newest->stp;
+    }
+    // Take a resting order off the book for self-trade prevention
+    void cancelSelfTrade(Order* o);
+    // Resolve a crossed pair with one owner between two resting orders
+    void preventSelfTrade(Order* bidOrder, Order* askOrder);
 
     std::vector<ExecutionMessage> matchBook(uint64_t seqBase, uint64_t timestamp);
 
     // For volatility tracking
-    double lastTradePrice = 0.0;
+    Price lastTradePrice = 0;
     bool haveLastTrade = false;
-    std::deque<std::pair<double, uint64_t>> recentTrades; // Price, Quantity
+    std::deque<std::pair<Price, uint64_t>> recentTrades; // Price, Quantity
     size_t maxRecentTrades = 100; // Maintain last 100 trades
+    double vwapValue_ = 0.0;      // sum of price * quantity over recentTrades
+    uint64_t vwapVolume_ = 0;
+    void recomputeVwap();
 
-    // Helper for iceberg orders: refresh visible qty after partial fills
-    void refreshIceberg(Order* o);
+    // Refill an iceberg's spent slice from its reserve, losing time priority
+    void refreshIceberg(PriceLevel* level, Order* o);
 
     friend class MatchingEngine;
 };
@@ -0,0 +1,163 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Map from order id to a small value in one flat array: linear probing with
+// Fibonacci hashing, so sequential ids spread evenly, and backward-shift
+// deletion, so erasing leaves no tombstones and probe chains stay short on
+// cancel-heavy flow. No per-entry allocation. Not thread-safe.
+template<typename V>
+class OrderIndex {
+public:
+    static constexpr uint64_t EMPTY = UINT64_MAX; // the one id that cannot be stored
+
+    explicit OrderIndex(size_t capacity = 1024) {
+        allocate(capacity);
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    V* find(uint64_t id) {
+        for (size_t i = home(id);; i = (i + 1) & mask_) {
+            if (slots_[i].id == id) return &slots_[i].value;
+            if (slots_[i].id == EMPTY) return nullptr;
+        }
+    }
+
+    const V* find(uint64_t id) const {
+        return const_cast<OrderIndex*>(this)->find(id);
+    }
+
+    bool contains(uint64_t id) const { return find(id) != nullptr; }
+
+    // Insert or overwrite. False only for the reserved id.
+    bool set(uint64_t id, V value) {
+        if (id == EMPTY) return false;
+        if ((size_ + 1) * 2 > mask_ + 1) allocate((mask_ + 1) * 2);
+        size_t i = home(id);
+        while (slots_[i].id != EMPTY && slots_[i].id != id) i = (i + 1) & mask_;
+        if (slots_[i].id == EMPTY) ++size_;
+        slots_[i].id = id;
+        slots_[i].value = value;
+        return true;
+    }
+
+    bool erase(uint64_t id) {
+        size_t i = home(id);
+        while (slots_[i].id != id) {
+            if (slots_[i].id == EMPTY) return false;
+            i = (i + 1) & mask_;
+        }
+        // Pull back any later entry of the chain whose home is not in (i, j]
+        for (size_t j = (i + 1) & mask_; slots_[j].id != EMPTY; j = (j + 1) & mask_) {
+            size_t h = home(slots_[j].id);
+            bool stays = i <= j ? (h > i && h <= j) : (h > i || h <= j);
+            if (!stays) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i].id = EMPTY;
+        --size_;
+        return true;
+    }
+
+    void clear() {
+        for (size_t i = 0; i <= mask_; ++i) slots_[i].id = EMPTY;
+        size_ = 0;
+    }
+
+    // Room for n entries without rehashing
+    void reserve(size_t n) {
+        if (n * 2 > mask_ + 1) allocate(n * 2);
+    }
+
+private:
+    struct Slot {
+        uint64_t id;
+        V value;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_ = 0;
+    unsigned shift_ = 64;
+    size_t size_ = 0;
+
+    size_t home(uint64_t id) const {
+        return (size_t)((id * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    void allocate(size_t capacity) {
+        size_t cap = 16;
+        unsigned bits = 4;
+        while (cap < capacity) {
+            cap <<= 1;
+            ++bits;
+        }
+        std::unique_ptr<Slot[]> old = std::move(slots_);
+        size_t oldCap = old ? mask_ + 1 : 0;
+        slots_.reset(new Slot[cap]);
+        for (size_t i = 0; i < cap; ++i) slots_[i].id = EMPTY;
+        mask_ = cap - 1;
+        shift_ = 64 - bits;
+        size_ = 0;
+        for (size_t i = 0; i < oldCap; ++i) {
+            if (old[i].id != EMPTY) set(old[i].id, old[i].value);
+        }
+    }
+};
+
+// Order id -> symbol id, used to route cancels to the engine holding the
+// order. Dispatch threads record orders as they arrive and engine threads
+// retire them once they leave the book, so the index only holds live orders.
+// Sharded by id so the two sides rarely meet on a lock.
+class OrderRouteIndex {
+public:
+    static constexpr size_t SHARDS = 16;
+
+    void record(uint64_t orderId, uint32_t symbolId) {
+        Shard &s = shardFor(orderId);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.index.set(orderId, symbolId);
+    }
+
+    bool find(uint64_t orderId, uint32_t &symbolId) {
+        Shard &s = shardFor(orderId);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        const uint32_t* v = s.index.find(orderId);
+        if (!v) return false;
+        symbolId = *v;
+        return true;
+    }
+
+    // Only if the id still routes to symbolId, so a reused id recorded for
+    // another symbol in the meantime is left alone
+    void retire(uint64_t orderId, uint32_t symbolId) {
+        Shard &s = shardFor(orderId);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        const uint32_t* v = s.index.find(orderId);
+        if (v && *v == symbolId) s.index.erase(orderId);
+    }
+
+    size_t size() {
+        size_t n = 0;
+        for (Shard &s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            n += s.index.size();
+        }
+        return n;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        OrderIndex<uint32_t> index;
+    };
+    Shard shards_[SHARDS];
+
+    // Low bits pick the shard; the index hashes the whole id for the slot
+    Shard& shardFor(uint64_t orderId) { return shards_[orderId & (SHARDS - 1)]; }
+};
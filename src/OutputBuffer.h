@@ -0,0 +1,73 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <errno.h>
+
+// Bytes waiting to go out on one socket. Responses are copied straight into a
+// power-of-two ring, so queueing one costs a memcpy rather than an allocation,
+// and everything queued goes out in a single writev of at most two pieces.
+// The ring doubles when full, up to limit; beyond that append() refuses.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(size_t limit, size_t initialCapacity = 16384) : limit_(limit) {
+        size_t cap = 64;
+        while (cap < initialCapacity) cap <<= 1;
+        data_.reset(new char[cap]);
+        mask_ = cap - 1;
+    }
+
+    size_t size() const { return tail_ - head_; }
+    bool empty() const { return head_ == tail_; }
+
+    // False if the bytes would take the buffer past its limit
+    bool append(const void* bytes, size_t len) {
+        if (size() + len > limit_) return false;
+        if (size() + len > mask_ + 1) grow(size() + len);
+        size_t off = tail_ & mask_;
+        size_t first = std::min(len, mask_ + 1 - off);
+        std::memcpy(data_.get() + off, bytes, first);
+        std::memcpy(data_.get(), static_cast<const char*>(bytes) + first, len - first);
+        tail_ += len;
+        return true;
+    }
+
+    // Writes as much as the socket takes. Returns the bytes written, 0 if the
+    // socket is full, or -1 on an error.
+    ssize_t writeTo(int fd) {
+        if (empty()) return 0;
+        size_t off = head_ & mask_;
+        size_t first = std::min(size(), mask_ + 1 - off);
+        iovec iov[2] = {{data_.get() + off, first}, {data_.get(), size() - first}};
+        ssize_t n = writev(fd, iov, iov[1].iov_len ? 2 : 1);
+        if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        head_ += (size_t)n;
+        if (empty()) head_ = tail_ = 0;
+        return n;
+    }
+
+private:
+    std::unique_ptr<char[]> data_;
+    size_t mask_ = 0;
+    size_t head_ = 0; // running offsets; the slot is offset & mask_
+    size_t tail_ = 0;
+    size_t limit_;
+
+    void grow(size_t need) {
+        size_t cap = mask_ + 1;
+        while (cap < need) cap <<= 1;
+        std::unique_ptr<char[]> bigger(new char[cap]);
+        size_t len = size();
+        size_t off = head_ & mask_;
+        size_t first = std::min(len, mask_ + 1 - off);
+        std::memcpy(bigger.get(), data_.get() + off, first);
+        std::memcpy(bigger.get() + first, data_.get(), len - first);
+        data_ = std::move(bigger);
+        mask_ = cap - 1;
+        head_ = 0;
+        tail_ = len;
+    }
+};
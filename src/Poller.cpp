@@ -0,0 +1,19 @@
+#include "Poller.h"
+#include "Logging.h"
+#include "KqueuePoller.h"
+#include "EpollPoller.h"
+#include "UringPoller.h"
+
+std::unique_ptr<Poller> Poller::create(const std::string &backend) {
+#if PLUTUS_HAVE_KQUEUE
+    if (backend.empty() || backend == "kqueue") return std::make_unique<KqueuePoller>();
+#endif
+#if PLUTUS_HAVE_EPOLL
+    if (backend.empty() || backend == "epoll") return std::make_unique<EpollPoller>();
+#endif
+#if PLUTUS_HAVE_URING
+    if (backend == "uring") return std::make_unique<UringPoller>();
+#endif
+    LOG(LogLevel::ERROR, "Poller backend not available on this platform: " << backend);
+    return nullptr;
+}
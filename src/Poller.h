@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Poller abstracts the OS readiness/completion mechanism under EventLoop.
+// Readiness backends (kqueue, epoll) report ACCEPTABLE/READABLE and let the loop
+// do the accept()/read() itself. Completion backends (io_uring) do the I/O in the
+// kernel and hand back ACCEPTED fds and DATA that is valid until the next wait().
+
+struct PollEvent {
+    enum class Kind : uint8_t {
+        ACCEPTABLE, // listener has pending connections
+        ACCEPTED,   // fd is a freshly accepted client
+        READABLE,   // client fd has data to read
+        DATA,       // data/len already received for client fd
+        WRITABLE,   // client fd can take more output
+        HANGUP      // peer closed or the fd errored
+    };
+
+    int fd;
+    Kind kind;
+    const char* data = nullptr;
+    size_t len = 0;
+};
+
+class Poller {
+public:
+    virtual ~Poller() = default;
+
+    virtual const char* name() const = 0;
+    virtual bool init() = 0;
+
+    virtual bool addListener(int fd) = 0;
+    virtual bool addClient(int fd) = 0;
+    virtual void removeClient(int fd) = 0;
+
+    // Ask for a WRITABLE event once the socket can take more output
+    virtual bool armWrite(int fd) = 0;
+
+    // Blocks until at least one event is ready. Returns the number of events
+    // written to out, or -1 on a fatal error.
+    virtual int wait(PollEvent* out, int maxEvents) = 0;
+
+    // Backend names accepted by create(): "kqueue", "epoll", "uring".
+    // An empty name picks the platform default.
+    static std::unique_ptr<Poller> create(const std::string &backend);
+};
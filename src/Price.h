@@ -0,0 +1,26 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+// Prices inside the book are signed tick indices (price / tickSize). Wire prices
+// are converted once when an order enters an engine and converted back only when
+// something leaves it (logs, snapshots), so matching never compares doubles.
+using Price = int64_t;
+
+// Exact conversion for order prices: fails if price is not on the tick grid
+inline bool toTicks(double price, double tickSize, Price &out) {
+    double ticks = price / tickSize;
+    double rounded = std::round(ticks);
+    if (std::abs(ticks - rounded) > 1e-6) return false;
+    out = (Price)rounded;
+    return true;
+}
+
+// Nearest tick, for trigger prices which do not have to sit on the grid
+inline Price roundToTicks(double price, double tickSize) {
+    return (Price)std::llround(price / tickSize);
+}
+
+inline double fromTicks(Price ticks, double tickSize) {
+    return (double)ticks * tickSize;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <functional>
+#include <map>
+#include "Order.h"
+#include "Price.h"
+
+// FIFO of resting orders at one price, threaded through Order::prev/next so
+// that removing any order (cancel, fill, amend) is O(1). Aggregates are kept
+// up to date on every change so depth queries never walk the orders.
+struct PriceLevel {
+    Price price = 0;
+    Order* head = nullptr; // oldest, first to fill
+    Order* tail = nullptr;
+    uint64_t totalQuantity = 0;  // displayed
+    uint64_t hiddenQuantity = 0; // iceberg reserves, tradable but not shown
+    uint32_t orderCount = 0;
+
+    bool empty() const { return head == nullptr; }
+
+    void pushBack(Order* o) {
+        o->prev = tail;
+        o->next = nullptr;
+        o->level = this;
+        if (tail) tail->next = o; else head = o;
+        tail = o;
+        totalQuantity += o->quantity;
+        hiddenQuantity += o->hiddenQuantity;
+        ++orderCount;
+    }
+
+    void remove(Order* o) {
+        if (o->prev) o->prev->next = o->next; else head = o->next;
+        if (o->next) o->next->prev = o->prev; else tail = o->prev;
+        o->prev = o->next = nullptr;
+        o->level = nullptr;
+        totalQuantity -= o->quantity;
+        hiddenQuantity -= o->hiddenQuantity;
+        --orderCount;
+    }
+
+    // Take qty off a resting order without touching its queue position
+    void reduce(Order* o, uint64_t qty) {
+        o->quantity -= qty;
+        totalQuantity -= qty;
+    }
+
+    void reduceHidden(Order* o, uint64_t qty) {
+        o->hiddenQuantity -= qty;
+        hiddenQuantity -= qty;
+    }
+};
+
+// One side of the book: non-empty price levels ordered best first.
+// Level pointers stay valid until the level is erased.
+class PriceLevels {
+public:
+    virtual ~PriceLevels() = default;
+
+    virtual bool empty() const = 0;
+    virtual bool accepts(Price price) const = 0;
+
+    virtual PriceLevel* best() = 0;                      // nullptr if empty
+    virtual PriceLevel* find(Price price) = 0;           // nullptr if no level
+    virtual PriceLevel* getOrCreate(Price price) = 0;    // nullptr if !accepts(price)
+    virtual PriceLevel* next(const PriceLevel* level) = 0; // next worse level or nullptr
+    virtual void erase(PriceLevel* level) = 0;           // level must be empty
+};
+
+// Red-black tree levels. Unbounded price range, O(log n) per level operation.
+// Compare is std::greater for bids and std::less for asks so begin() is best.
+template<typename Compare>
+class MapPriceLevels : public PriceLevels {
+public:
+    bool empty() const override { return levels_.empty(); }
+    bool accepts(Price) const override { return true; }
+
+    PriceLevel* best() override {
+        return levels_.empty() ? nullptr : &levels_.begin()->second;
+    }
+
+    PriceLevel* find(Price price) override {
+        auto it = levels_.find(price);
+        return it == levels_.end() ? nullptr : &it->second;
+    }
+
+    PriceLevel* getOrCreate(Price price) override {
+        auto [it, inserted] = levels_.try_emplace(price);
+        if (inserted) it->second.price = price;
+        return &it->second;
+    }
+
+    PriceLevel* next(const PriceLevel* level) override {
+        auto it = levels_.upper_bound(level->price);
+        return it == levels_.end() ? nullptr : &it->second;
+    }
+
+    void erase(PriceLevel* level) override {
+        levels_.erase(level->price);
+    }
+
+private:
+    std::map<Price, PriceLevel, Compare> levels_;
+};
+
+using MapBidLevels = MapPriceLevels<std::greater<Price>>;
+using MapAskLevels = MapPriceLevels<std::less<Price>>;
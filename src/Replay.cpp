@@ -1,30 +1,280 @@
 #include "Replay.h"
+#include "EngineController.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
 
-Replay::Replay() {
-    logfile_.open("replay.log", std::ios::app);
+namespace {
+
+void copySymbol(char (&dst)[8], const char* src, size_t len) {
+    std::memset(dst, 0, sizeof(dst));
+    std::memcpy(dst, src, std::min(len, sizeof(dst)));
+}
+
+template<typename Payload>
+bool readPayload(const JournalReader::Record &rec, Payload &out) {
+    if (rec.length < sizeof(Payload)) return false;
+    std::memcpy(&out, rec.payload, sizeof(Payload));
+    return true;
 }
 
-void Replay::logAddMessage(uint64_t seq, const AddMessage &msg) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    logfile_ << "ADD|" << seq << "|" << msg.orderId << "|" << msg.symbol << "|" << msg.price << "|" << msg.quantity << "\n";
+std::string symbolOf(const char (&sym)[8]) {
+    return std::string(sym, strnlen(sym, sizeof(sym)));
+}
+
+// Timestamps are wall clock at match time and legitimately differ on replay
+bool sameExecution(const JournalExecution &logged, const ExecutionMessage &exec) {
+    return logged.sequence == exec.header.sequence &&
+           logged.buyOrderId == exec.buyOrderId &&
+           logged.sellOrderId == exec.sellOrderId &&
+           logged.price == exec.price &&
+           logged.quantity == exec.quantity &&
+           logged.buyParticipantId == exec.buyParticipantId &&
+           logged.sellParticipantId == exec.sellParticipantId;
+}
+
+// Per-symbol replay state. Engines append regenerated executions to
+// regenerated; each journaled execution is checked against the next one.
+struct SymbolReplay {
+    MatchingEngine* engine = nullptr;
+    std::vector<ExecutionMessage> regenerated;
+    size_t verified = 0;
+    uint64_t fromLsn = 0;
+};
+
+template<typename Payload>
+JournalEntry makeEntry(JournalRecordType type, const Payload &payload) {
+    JournalEntry entry;
+    entry.type = type;
+    entry.length = sizeof(Payload);
+    std::memcpy(entry.payload, &payload, sizeof(Payload));
+    return entry;
+}
+
+}
+
+Replay::Replay(const JournalOptions &options)
+    : options_(options), journal_(options) {
+    if (!journal_.start()) {
+        LOG(LogLevel::ERROR, "Replay: journal could not be opened in " << options.directory);
+    }
+}
+
+Replay::~Replay() {
+    close();
+}
+
+void Replay::close() {
+    journal_.stop();
+}
+
+void Replay::logAddMessage(uint64_t seq, const AddMessage &msg, const std::string &symbol) {
+    JournalAdd rec{};
+    rec.sequence = seq;
+    rec.timestamp = msg.header.timestamp;
+    rec.orderId = msg.orderId;
+    copySymbol(rec.symbol, symbol.data(), symbol.size());
+    rec.price = msg.price;
+    rec.quantity = msg.quantity;
+    rec.participantId = msg.participantId;
+    rec.triggerPrice = msg.triggerPrice;
+    rec.visibleQuantity = msg.visibleQuantity;
+    rec.side = (uint8_t)msg.side;
+    rec.tif = (uint8_t)msg.tif;
+    rec.orderType = (uint8_t)msg.orderType;
+    rec.stp = (uint8_t)msg.stp;
+    journal_.append(makeEntry(JournalRecordType::ADD, rec));
 }
 
 void Replay::logCancelMessage(uint64_t seq, const CancelMessage &msg) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    logfile_ << "CANCEL|" << seq << "|" << msg.orderId << "\n";
+    JournalCancel rec{};
+    rec.sequence = seq;
+    rec.timestamp = msg.header.timestamp;
+    rec.orderId = msg.orderId;
+    rec.participantId = msg.participantId;
+    journal_.append(makeEntry(JournalRecordType::CANCEL, rec));
 }
 
 void Replay::logCancelReplaceMessage(uint64_t seq, const CancelReplaceMessage &msg) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    logfile_ << "CANCEL_REPLACE|" << seq << "|" << msg.orderId << "|" << msg.newPrice << "|" << msg.newQuantity << "\n";
+    JournalCancelReplace rec{};
+    rec.sequence = seq;
+    rec.timestamp = msg.header.timestamp;
+    rec.orderId = msg.orderId;
+    rec.newPrice = msg.newPrice;
+    rec.newQuantity = msg.newQuantity;
+    rec.participantId = msg.participantId;
+    journal_.append(makeEntry(JournalRecordType::CANCEL_REPLACE, rec));
 }
 
-void Replay::logExecutionMessage(uint64_t seq, const ExecutionMessage &msg) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    logfile_ << "EXEC|" << seq << "|" << msg.symbol << "|" << msg.price << "|" << msg.quantity << "\n";
+void Replay::logCheckpoint(const std::string &symbol, uint64_t nextSequence, std::atomic<uint64_t>* lsnOut) {
+    JournalCheckpoint rec{};
+    copySymbol(rec.symbol, symbol.data(), symbol.size());
+    rec.nextSequence = nextSequence;
+    JournalEntry entry = makeEntry(JournalRecordType::CHECKPOINT, rec);
+    entry.assignedLsn = lsnOut;
+    journal_.append(std::move(entry));
 }
 
-void Replay::replayAll() {
-    // Read replay.log and re-apply messages to rebuild state but not required yet.
+void Replay::logExecutionMessage(uint64_t seq, const ExecutionMessage &msg, const std::string &symbol) {
+    // Execution price is logged in ticks, exactly as the book matched it
+    JournalExecution rec{};
+    rec.sequence = seq;
+    rec.timestamp = msg.header.timestamp;
+    rec.buyOrderId = msg.buyOrderId;
+    rec.sellOrderId = msg.sellOrderId;
+    copySymbol(rec.symbol, symbol.data(), symbol.size());
+    rec.price = msg.price;
+    rec.quantity = msg.quantity;
+    rec.buyParticipantId = msg.buyParticipantId;
+    rec.sellParticipantId = msg.sellParticipantId;
+    journal_.append(makeEntry(JournalRecordType::EXECUTION, rec));
 }
 
+bool Replay::replayAll(EngineController &controller, const std::unordered_map<std::string, uint64_t> &fromLsn) {
+    auto start = std::chrono::steady_clock::now();
+
+    // Symbols without a snapshot need the whole journal
+    uint64_t oldestNeeded = UINT64_MAX;
+    for (MatchingEngine* engine : controller.allEngines()) {
+        auto it = fromLsn.find(engine->symbol());
+        oldestNeeded = std::min<uint64_t>(oldestNeeded, it == fromLsn.end() ? 0 : it->second);
+    }
+    if (oldestNeeded == UINT64_MAX) oldestNeeded = 0;
+    JournalReader reader(options_.directory, oldestNeeded);
+
+    // Node-based map: the regenerated vectors handed to engines stay put
+    std::unordered_map<std::string, SymbolReplay> symbols;
+    auto stateFor = [&](const std::string &symbol) -> SymbolReplay* {
+        auto it = symbols.find(symbol);
+        if (it == symbols.end()) {
+            it = symbols.emplace(symbol, SymbolReplay()).first;
+            it->second.engine = controller.findEngine(symbol);
+            auto from = fromLsn.find(symbol);
+            it->second.fromLsn = from == fromLsn.end() ? 0 : from->second;
+            if (it->second.engine) it->second.engine->setReplaySink(&it->second.regenerated);
+        }
+        return it->second.engine ? &it->second : nullptr;
+    };
+    auto stateForOrder = [&](uint64_t orderId) -> SymbolReplay* {
+        MatchingEngine* engine = controller.findOrderEngine(orderId);
+        return engine ? stateFor(engine->symbol()) : nullptr;
+    };
+
+    uint64_t records = 0, inputs = 0, executions = 0, mismatches = 0, unapplied = 0, covered = 0;
+    // Records the symbol's snapshot already reflects
+    auto coveredBySnapshot = [&](const SymbolReplay* st, uint64_t lsn) {
+        if (lsn > st->fromLsn) return false;
+        ++covered;
+        return true;
+    };
+
+    JournalReader::Record rec;
+    while (reader.next(rec)) {
+        ++records;
+        switch (rec.type) {
+            case JournalRecordType::ADD: {
+                JournalAdd r;
+                if (!readPayload(rec, r)) { ++unapplied; break; }
+                AddMessage msg;
+                msg.header = MessageHeader{MessageType::ADD, r.sequence, r.timestamp};
+                msg.orderId = r.orderId;
+                msg.price = r.price;
+                msg.quantity = r.quantity;
+                msg.side = (Side)r.side;
+                msg.tif = (TimeInForce)r.tif;
+                msg.orderType = (OrderType)r.orderType;
+                msg.participantId = r.participantId;
+                msg.triggerPrice = r.triggerPrice;
+                msg.visibleQuantity = r.visibleQuantity;
+                msg.stp = (SelfTradePrevention)r.stp;
+                SymbolReplay* st = stateFor(symbolOf(r.symbol));
+                if (!st) { ++unapplied; break; }
+                msg.symbolId = st->engine->symbolId();
+                if (coveredBySnapshot(st, rec.lsn)) break;
+                controller.recordOrder(msg.orderId, *st->engine);
+                st->engine->processAdd(msg);
+                ++inputs;
+                break;
+            }
+            case JournalRecordType::CANCEL: {
+                JournalCancel r;
+                if (!readPayload(rec, r)) { ++unapplied; break; }
+                // An order that never reached a book fails the same way it did live
+                SymbolReplay* st = stateForOrder(r.orderId);
+                if (st && coveredBySnapshot(st, rec.lsn)) break;
+                ++inputs;
+                if (!st) break;
+                CancelMessage msg;
+                msg.header = MessageHeader{MessageType::CANCEL, r.sequence, r.timestamp};
+                msg.orderId = r.orderId;
+                msg.participantId = r.participantId;
+                st->engine->processCancel(msg);
+                break;
+            }
+            case JournalRecordType::CANCEL_REPLACE: {
+                JournalCancelReplace r;
+                if (!readPayload(rec, r)) { ++unapplied; break; }
+                // An order that never reached a book fails the same way it did live
+                SymbolReplay* st = stateForOrder(r.orderId);
+                if (st && coveredBySnapshot(st, rec.lsn)) break;
+                ++inputs;
+                if (!st) break;
+                CancelReplaceMessage msg;
+                msg.header = MessageHeader{MessageType::CANCEL_REPLACE, r.sequence, r.timestamp};
+                msg.orderId = r.orderId;
+                msg.newPrice = r.newPrice;
+                msg.newQuantity = r.newQuantity;
+                msg.participantId = r.participantId;
+                st->engine->processCancelReplace(msg);
+                break;
+            }
+            case JournalRecordType::EXECUTION: {
+                JournalExecution r;
+                SymbolReplay* st = readPayload(rec, r) ? stateFor(symbolOf(r.symbol)) : nullptr;
+                if (!st) { ++unapplied; break; }
+                if (coveredBySnapshot(st, rec.lsn)) break;
+                ++executions;
+                if (st->verified >= st->regenerated.size() || !sameExecution(r, st->regenerated[st->verified])) {
+                    if (mismatches++ == 0) {
+                        LOG(LogLevel::ERROR, "Replay: execution at lsn " << rec.lsn << " for " << symbolOf(r.symbol)
+                            << " (buy " << r.buyOrderId << ", sell " << r.sellOrderId << ") was not regenerated");
+                    }
+                } else if (++st->verified == st->regenerated.size()) {
+                    st->regenerated.clear();
+                    st->verified = 0;
+                }
+                break;
+            }
+            case JournalRecordType::CHECKPOINT:
+                break;
+            default:
+                ++unapplied;
+                break;
+        }
+    }
+
+    // Executions of the last inputs may not have reached the journal before
+    // a crash; regenerating them is expected and is not a divergence
+    uint64_t unlogged = 0;
+    for (auto &[symbol, st] : symbols) {
+        unlogged += st.regenerated.size() - st.verified;
+        if (st.engine) st.engine->setReplaySink(nullptr);
+    }
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOG(LogLevel::INFO, "Replay: " << records << " records (" << inputs << " requests, " << executions
+        << " executions, " << covered << " already in snapshots) from " << reader.segmentsRead()
+        << " of " << reader.segments().size() << " segments in " << secs << "s, "
+        << (secs > 0 ? (uint64_t)(records / secs) : records) << " records/s");
+    if (unlogged > 0) {
+        LOG(LogLevel::WARN, "Replay: " << unlogged << " trailing executions were not journaled before shutdown");
+    }
+    if (unapplied > 0) {
+        LOG(LogLevel::ERROR, "Replay: " << unapplied << " records could not be applied");
+    }
+    if (mismatches > 0) {
+        LOG(LogLevel::ERROR, "Replay: " << mismatches << " journaled executions did not match the replay");
+    }
+    return mismatches == 0 && unapplied == 0;
+}
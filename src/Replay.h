@@ -1,20 +1,49 @@
 #pragma once
-#include <mutex>
 #include "Messages.h"
 #include "Logging.h"
-#include <fstream>
+#include "Journal.h"
+#include <atomic>
+#include <string>
+#include <unordered_map>
 
+class EngineController;
+
+// Write-ahead log of every request an engine accepts for processing and every
+// execution it produces. Logging copies a fixed-size record into the
+// journal's ring and returns; the journal's writer thread does the I/O.
 class Replay {
 public:
-    Replay();
-    void logAddMessage(uint64_t seq, const AddMessage &msg);
+    explicit Replay(const JournalOptions &options = JournalOptions());
+    ~Replay();
+
+    void logAddMessage(uint64_t seq, const AddMessage &msg, const std::string &symbol);
     void logCancelMessage(uint64_t seq, const CancelMessage &msg);
     void logCancelReplaceMessage(uint64_t seq, const CancelReplaceMessage &msg);
-    void logExecutionMessage(uint64_t seq, const ExecutionMessage &msg);
+    void logExecutionMessage(uint64_t seq, const ExecutionMessage &msg, const std::string &symbol);
+    // Marks the point a snapshot of symbol's book was captured; the marker's
+    // LSN is stored in lsnOut once the journal writer assigns it
+    void logCheckpoint(const std::string &symbol, uint64_t nextSequence, std::atomic<uint64_t>* lsnOut);
+
+    // Everything logged so far is on stable storage once durableLsn() reaches
+    // the LSN current when it was logged (see Durability)
+    uint64_t writtenLsn() const { return journal_.writtenLsn(); }
+    uint64_t durableLsn() const { return journal_.durableLsn(); }
+    bool persisted(uint64_t lsn) const { return journal_.persisted(lsn); }
+
+    // Flush and stop the writer; nothing may be logged afterwards
+    void close();
 
-    void replayAll();
+    // Rebuild all books by re-driving every journaled request through its
+    // engine, in journal order, with journaling switched off. Executions the
+    // engines regenerate are checked against the journaled ones per symbol.
+    // Returns false if they diverge or a record cannot be applied.
+    //
+    // Symbols restored from a snapshot only replay records after the LSN in
+    // fromLsn; journal segments older than every snapshot are not read.
+    bool replayAll(EngineController &controller,
+                   const std::unordered_map<std::string, uint64_t> &fromLsn = {});
 
 private:
-    std::mutex mtx_;
-    std::ofstream logfile_;
+    JournalOptions options_;
+    JournalWriter journal_;
 };
@@ -0,0 +1,61 @@
+#include "ResponseChannel.h"
+#include "Logging.h"
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <thread>
+
+namespace {
+constexpr size_t READY_CAPACITY = 65536;
+}
+
+LoopNotifier::LoopNotifier() : ready_(READY_CAPACITY) {
+    // A socketpair rather than a pipe/eventfd so every poller backend,
+    // including io_uring's recv, can wait on it like a client socket
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        LOG(LogLevel::ERROR, "LoopNotifier: socketpair failed");
+        return;
+    }
+    for (int fd : fds) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, (flags < 0 ? 0 : flags) | O_NONBLOCK);
+    }
+    readFd_ = fds[0];
+    writeFd_ = fds[1];
+}
+
+LoopNotifier::~LoopNotifier() {
+    if (readFd_ >= 0) close(readFd_);
+    if (writeFd_ >= 0) close(writeFd_);
+}
+
+void LoopNotifier::schedule(std::shared_ptr<ResponseChannel> channel) {
+    while (!ready_.tryPush(std::move(channel))) {
+        std::this_thread::yield();
+    }
+    if (!pending_.exchange(true, std::memory_order_acq_rel)) {
+        char b = 1;
+        if (write(writeFd_, &b, 1) < 0 && errno != EAGAIN) {
+            LOG(LogLevel::ERROR, "LoopNotifier: wakeup write failed");
+        }
+    }
+}
+
+void LoopNotifier::drain() {
+    pending_.store(false, std::memory_order_seq_cst);
+    char buf[256];
+    while (read(readFd_, buf, sizeof(buf)) > 0) {}
+}
+
+void ResponseChannel::deliver(EngineResponse &&resp) {
+    if (closed()) return;
+    while (!ring_.tryPush(std::move(resp))) {
+        if (closed()) return;
+        std::this_thread::yield();
+    }
+    if (!scheduled_.exchange(true, std::memory_order_seq_cst)) {
+        notifier_.schedule(shared_from_this());
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "Messages.h"
+#include "OrderIndex.h"
+#include "RingBuffer.h"
+
+// Result of one engine command, delivered back to the session that sent it
+struct EngineResponse {
+    MessageType type = MessageType::HEARTBEAT; // type of the request being answered, or EXECUTION
+    bool success = false;
+    RejectReason reason = RejectReason::NONE;
+    uint64_t sequence = 0;
+    SnapshotResponse snapshot; // SNAPSHOT_REQUEST only
+    FillReport fill{};         // EXECUTION only, sent unprompted
+};
+
+class ResponseChannel;
+
+// Wakes an event loop from other threads. Channels with pending responses are
+// queued here and a byte is written to a socketpair the loop polls on; the
+// byte is only written when the loop is not already due to wake up, so a
+// burst of responses costs one syscall.
+class LoopNotifier {
+public:
+    LoopNotifier();
+    ~LoopNotifier();
+
+    bool valid() const { return readFd_ >= 0; }
+    int fd() const { return readFd_; }
+
+    // Engine threads
+    void schedule(std::shared_ptr<ResponseChannel> channel);
+
+    // Loop thread: consume the wakeup bytes, then pop ready channels
+    void drain();
+    bool nextReady(std::shared_ptr<ResponseChannel> &out) { return ready_.tryPop(out); }
+
+private:
+    int readFd_ = -1;
+    int writeFd_ = -1;
+    std::atomic<bool> pending_{false};
+    MpscRing<std::shared_ptr<ResponseChannel>> ready_;
+};
+
+// Per-session outbound queue. Engines push responses from their own threads;
+// the session's event loop pops them. Shared ownership keeps it alive while
+// commands referencing it are still in flight after the session goes away.
+class ResponseChannel : public std::enable_shared_from_this<ResponseChannel> {
+public:
+    static constexpr size_t CAPACITY = 4096;
+
+    explicit ResponseChannel(LoopNotifier &notifier, int fd)
+        : notifier_(notifier), fd_(fd), ring_(CAPACITY) {}
+
+    int fd() const { return fd_; }
+
+    // Engine threads. Spins if the session's loop has fallen CAPACITY behind.
+    void deliver(EngineResponse &&resp);
+
+    // Loop thread. Clears the scheduled flag first so a deliver() racing
+    // with the drain reschedules the channel instead of being missed.
+    template<typename F>
+    void drain(F &&onResponse) {
+        scheduled_.store(false, std::memory_order_seq_cst);
+        EngineResponse resp;
+        while (ring_.tryPop(resp)) onResponse(resp);
+    }
+
+    // Loop thread, when the session is destroyed
+    void close() { closed_.store(true, std::memory_order_release); }
+    bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+    LoopNotifier &notifier_;
+    int fd_;
+    MpscRing<EngineResponse> ring_;
+    std::atomic<bool> scheduled_{false};
+    std::atomic<bool> closed_{false};
+};
+
+// Participant id -> channel of the session that most recently sent orders for
+// it, so engines can report fills to both sides of a trade. Sessions bind on
+// the dispatch path, engines look up per fill; sharded like OrderRouteIndex.
+// Weak references: a session that has gone away receives nothing.
+class ParticipantRegistry {
+public:
+    static constexpr size_t SHARDS = 16;
+
+    void bind(uint64_t participantId, const std::shared_ptr<ResponseChannel> &channel) {
+        Shard &s = shardFor(participantId);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.index.set(participantId, channel);
+    }
+
+    std::shared_ptr<ResponseChannel> find(uint64_t participantId) {
+        Shard &s = shardFor(participantId);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        const std::weak_ptr<ResponseChannel>* channel = s.index.find(participantId);
+        return channel ? channel->lock() : nullptr;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        OrderIndex<std::weak_ptr<ResponseChannel>> index;
+    };
+    Shard shards_[SHARDS];
+
+    Shard& shardFor(uint64_t participantId) { return shards_[participantId & (SHARDS - 1)]; }
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free ring for many producers and one consumer (Vyukov's
+// bounded queue with the consumer side simplified). Each cell carries a
+// sequence number so producers claim a slot with one CAS and publish it with
+// one release store; the consumer never writes shared counters.
+template<typename T>
+class MpscRing {
+public:
+    explicit MpscRing(size_t capacity) {
+        size_t cap = 2;
+        while (cap < capacity) cap <<= 1;
+        mask_ = cap - 1;
+        cells_.reset(new Cell[cap]);
+        for (size_t i = 0; i < cap; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Any thread. Returns false if the ring is full.
+    bool tryPush(T &&value) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = cells_[pos & mask_];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer thread only
+    bool tryPop(T &out) {
+        Cell &cell = cells_[head_ & mask_];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        if (seq != head_ + 1) return false;
+        out = std::move(cell.value);
+        cell.seq.store(head_ + mask_ + 1, std::memory_order_release);
+        ++head_;
+        return true;
+    }
+
+    // Consumer thread only
+    bool empty() const {
+        return cells_[head_ & mask_].seq.load(std::memory_order_acquire) != head_ + 1;
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) size_t head_ = 0;
+};
@@ -0,0 +1,118 @@
+#include "RiskEngine.h"
+#include <chrono>
+
+RiskEngine::RiskEngine(const RiskLimits &limits, size_t symbolCount)
+    : limits_(limits), tickSizes_(symbolCount, 1.0) {
+    // Kept at most half full so probe chains stay short
+    size_t capacity = 64;
+    while (capacity < (size_t)limits.participants * 2) capacity <<= 1;
+    mask_ = capacity - 1;
+    shift_ = 64 - __builtin_ctzll(capacity);
+    slots_.reset(new Slot[capacity]);
+    exposure_.reset(new Exposure[capacity * symbolCount]);
+    maxNotional_ = std::llround(limits.maxGrossNotional * NOTIONAL_SCALE);
+}
+
+int32_t RiskEngine::slotFor(uint64_t participantId) {
+    if (participantId == EMPTY) return -1;
+    size_t home = (size_t)((participantId * 11400714819323198485ull) >> shift_);
+    for (size_t probe = 0; probe <= mask_; ++probe) {
+        size_t i = (home + probe) & mask_;
+        uint64_t id = slots_[i].participantId.load(std::memory_order_acquire);
+        if (id == EMPTY) {
+            // Another thread may claim it first, possibly for this participant
+            if (slots_[i].participantId.compare_exchange_strong(id, participantId, std::memory_order_acq_rel)) {
+                return (int32_t)i;
+            }
+        }
+        if (id == participantId) return (int32_t)i;
+    }
+    return -1;
+}
+
+bool RiskEngine::countMessage(Slot &slot) {
+    uint64_t second = (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count() & 0xffffffff;
+    uint64_t rate = slot.rate.load(std::memory_order_relaxed);
+    for (;;) {
+        uint64_t count = (rate >> 32) == second ? (rate & 0xffffffff) + 1 : 1;
+        if (count > limits_.maxMessagesPerSecond) return false;
+        if (slot.rate.compare_exchange_weak(rate, (second << 32) | count, std::memory_order_relaxed)) return true;
+    }
+}
+
+RejectReason RiskEngine::reject(RejectReason reason) {
+    rejects_[(size_t)reason].fetch_add(1, std::memory_order_relaxed);
+    return reason;
+}
+
+RejectReason RiskEngine::check(uint64_t participantId, SymbolId symbolId, Side side, int32_t orders,
+                               uint64_t quantity, int64_t notional, Hold &hold) {
+    checks_.fetch_add(1, std::memory_order_relaxed);
+    int32_t index = slotFor(participantId);
+    if (index < 0) return reject(RejectReason::RISK_CAPACITY);
+    Slot &slot = slots_[index];
+    if (limits_.maxMessagesPerSecond && !countMessage(slot)) return reject(RejectReason::MESSAGE_RATE);
+
+    if (limits_.maxPosition && quantity > 0) {
+        const Exposure &e = exposure(symbolId, index);
+        int64_t worst = side == Side::BUY ? e.position + e.openBuy + (int64_t)quantity
+                                          : e.openSell + (int64_t)quantity - e.position;
+        if (worst > (int64_t)limits_.maxPosition) return reject(RejectReason::POSITION);
+    }
+
+    // Other engines may be checking the same participant, so the order's
+    // share is added first and taken back if it went over
+    if (limits_.maxOpenOrders && orders > 0) {
+        int64_t open = slot.openOrders.fetch_add(orders, std::memory_order_relaxed) + orders;
+        if (open > (int64_t)limits_.maxOpenOrders) {
+            slot.openOrders.fetch_sub(orders, std::memory_order_relaxed);
+            return reject(RejectReason::OPEN_ORDERS);
+        }
+        hold.orders = orders;
+    }
+    if (maxNotional_ && notional > 0) {
+        int64_t gross = slot.grossNotional.fetch_add(notional, std::memory_order_relaxed) + notional;
+        if (gross > maxNotional_) {
+            slot.grossNotional.fetch_sub(notional, std::memory_order_relaxed);
+            slot.openOrders.fetch_sub(hold.orders, std::memory_order_relaxed);
+            hold.orders = 0;
+            return reject(RejectReason::GROSS_NOTIONAL);
+        }
+        hold.notional = notional;
+    }
+    hold.slot = index;
+    return RejectReason::NONE;
+}
+
+void RiskEngine::release(Hold &hold) {
+    if (hold.slot < 0) return;
+    Slot &slot = slots_[hold.slot];
+    if (hold.orders) slot.openOrders.fetch_sub(hold.orders, std::memory_order_relaxed);
+    if (hold.notional) slot.grossNotional.fetch_sub(hold.notional, std::memory_order_relaxed);
+    hold = Hold{};
+}
+
+void RiskEngine::onOpen(uint64_t participantId, SymbolId symbolId, Side side, Price price, int32_t orders, int64_t quantity) {
+    int32_t index = slotFor(participantId);
+    if (index < 0) return;
+    Slot &slot = slots_[index];
+    if (orders) slot.openOrders.fetch_add(orders, std::memory_order_relaxed);
+    int64_t value = notional(symbolId, price, 1) * quantity;
+    if (value) slot.grossNotional.fetch_add(value, std::memory_order_relaxed);
+    Exposure &e = exposure(symbolId, index);
+    (side == Side::BUY ? e.openBuy : e.openSell) += quantity;
+}
+
+void RiskEngine::onFill(uint64_t participantId, SymbolId symbolId, Side side, uint64_t quantity) {
+    int32_t index = slotFor(participantId);
+    if (index < 0) return;
+    exposure(symbolId, index).position += side == Side::BUY ? (int64_t)quantity : -(int64_t)quantity;
+}
+
+RiskStats RiskEngine::stats() const {
+    RiskStats s;
+    s.checks = checks_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < RISK_REJECT_REASONS; ++i) s.rejects[i] = rejects_[i].load(std::memory_order_relaxed);
+    return s;
+}
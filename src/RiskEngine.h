@@ -0,0 +1,103 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Messages.h"
+#include "Price.h"
+
+// Pre-trade limits, the same for every participant. 0 leaves a limit off.
+struct RiskLimits {
+    uint32_t maxOpenOrders = 0;        // resting and stop orders, over all symbols
+    double maxGrossNotional = 0;       // price * open quantity, over all symbols
+    uint64_t maxPosition = 0;          // per symbol, long or short, if every open order filled
+    uint32_t maxMessagesPerSecond = 0; // new orders and replaces
+    uint32_t participants = 4096;      // distinct participants the table is sized for
+
+    bool enabled() const {
+        return maxOpenOrders || maxGrossNotional > 0 || maxPosition || maxMessagesPerSecond;
+    }
+};
+
+struct RiskStats {
+    uint64_t checks = 0;
+    uint64_t rejects[RISK_REJECT_REASONS] = {}; // by RejectReason
+};
+
+// Participant state checked before an order reaches its book. Each
+// participant gets a slot in a fixed table, claimed with one CAS the first
+// time it is seen and kept for the life of the process, so the check is a
+// hash, a probe and a few atomics: no map, no lock.
+//
+// Open orders, gross notional and message rate are per participant and
+// touched by every engine it trades on, so they are atomics. Position and
+// open quantity are per symbol and only ever touched by that symbol's engine
+// thread; they are laid out symbol-major so engines never share a line.
+//
+// Books report open orders as they change (OrderBook::setRisk) and engines
+// report fills. Positions start flat when the process starts.
+class RiskEngine {
+public:
+    static constexpr int64_t NOTIONAL_SCALE = 10000;
+
+    // What a passed check holds against the participant while its order is
+    // matched; release() once the book has taken whatever rests
+    struct Hold {
+        int32_t slot = -1;
+        int32_t orders = 0;
+        int64_t notional = 0;
+    };
+
+    RiskEngine(const RiskLimits &limits, size_t symbolCount);
+
+    // Engine thread of symbolId, once per new order or replace. NONE if the
+    // participant stays within its limits with orders more open orders and
+    // quantity more open on side worth notional; those are then held.
+    RejectReason check(uint64_t participantId, SymbolId symbolId, Side side, int32_t orders,
+                       uint64_t quantity, int64_t notional, Hold &hold);
+    void release(Hold &hold);
+
+    // Engine thread of symbolId. Notional is kept in NOTIONAL_SCALE units
+    // of price * quantity, exact for any split of a quantity at one price.
+    void setTickSize(SymbolId symbolId, double tickSize) { tickSizes_[symbolId] = tickSize; }
+    int64_t notional(SymbolId symbolId, Price price, uint64_t quantity) const {
+        return std::llround((double)price * tickSizes_[symbolId] * NOTIONAL_SCALE) * (int64_t)quantity;
+    }
+    void onOpen(uint64_t participantId, SymbolId symbolId, Side side, Price price, int32_t orders, int64_t quantity);
+    void onFill(uint64_t participantId, SymbolId symbolId, Side side, uint64_t quantity);
+
+    // Any thread
+    RiskStats stats() const;
+
+private:
+    static constexpr uint64_t EMPTY = UINT64_MAX;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> participantId{EMPTY};
+        std::atomic<int64_t> openOrders{0};
+        std::atomic<int64_t> grossNotional{0}; // NOTIONAL_SCALE units
+        std::atomic<uint64_t> rate{0};         // second << 32 | messages counted in it
+    };
+    struct Exposure {
+        int64_t position = 0; // bought minus sold
+        int64_t openBuy = 0;
+        int64_t openSell = 0;
+    };
+
+    RiskLimits limits_;
+    int64_t maxNotional_ = 0;
+    size_t mask_;
+    int shift_;
+    std::unique_ptr<Slot[]> slots_;
+    std::unique_ptr<Exposure[]> exposure_; // [symbol][slot]
+    std::vector<double> tickSizes_;
+    std::atomic<uint64_t> checks_{0};
+    std::atomic<uint64_t> rejects_[RISK_REJECT_REASONS] = {};
+
+    // The participant's slot, claimed if it has none; -1 once the table is full
+    int32_t slotFor(uint64_t participantId);
+    Exposure& exposure(SymbolId symbolId, int32_t slot) { return exposure_[(size_t)symbolId * (mask_ + 1) + slot]; }
+    bool countMessage(Slot &slot);
+    RejectReason reject(RejectReason reason);
+};
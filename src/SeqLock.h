@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+// One writer publishes a small value; any number of readers copy it without
+// a lock and without ever delaying the writer. The sequence is odd while a
+// store is in progress, and a reader retries if it changed under its copy.
+// The value is held as atomic words so concurrent copies are well defined.
+template<typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(uint64_t) == 0,
+                  "SeqLock values are copied as whole words");
+    static constexpr size_t WORDS = sizeof(T) / sizeof(uint64_t);
+
+public:
+    SeqLock() { store(T{}); }
+
+    // Writer thread only
+    void store(const T &value) {
+        uint64_t words[WORDS];
+        std::memcpy(words, &value, sizeof(T));
+        uint64_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; ++i) words_[i].store(words[i], std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    // Any thread
+    T load() const {
+        uint64_t words[WORDS];
+        for (unsigned spins = 0;; ++spins) {
+            uint64_t before = seq_.load(std::memory_order_acquire);
+            if ((before & 1) == 0) {
+                for (size_t i = 0; i < WORDS; ++i) words[i] = words_[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq_.load(std::memory_order_relaxed) == before) break;
+            }
+            // The writer was preempted mid-store
+            if (spins > 64) std::this_thread::yield();
+        }
+        T value;
+        std::memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+private:
+    alignas(64) std::atomic<uint64_t> seq_{0};
+    std::atomic<uint64_t> words_[WORDS];
+};
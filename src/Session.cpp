@@ -1,13 +1,87 @@
 #include "Session.h"
 #include "Logging.h"
-#include <sys/event.h>
-#include <sstream>
+#include <charconv>
 #include <unistd.h>
 
-Session::Session(int fd, EngineController &controller, int kqfd)
-    : fd_(fd), kqfd_(kqfd), controller_(controller) { }
+namespace {
+
+template<typename T>
+void appendNumber(std::string &out, T value) {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, res.ptr);
+}
+
+// SNAPSHOT|symbol=S|bestBid=P|bestAsk=P|lastTradePrice=P|bids=P:QTY:ORDERS,...|asks=...
+std::string formatSnapshot(const SnapshotResponse &snap) {
+    std::string out;
+    out.reserve(96 + (snap.bids.size() + snap.asks.size()) * 24);
+    out += "SNAPSHOT|symbol=";
+    out += snap.symbol;
+    out += "|bestBid=";
+    appendNumber(out, snap.bestBid);
+    out += "|bestAsk=";
+    appendNumber(out, snap.bestAsk);
+    out += "|lastTradePrice=";
+    appendNumber(out, snap.lastTradePrice);
+    for (const auto* side : {&snap.bids, &snap.asks}) {
+        out += side == &snap.bids ? "|bids=" : "|asks=";
+        for (size_t i = 0; i < side->size(); ++i) {
+            const DepthLevel &level = (*side)[i];
+            if (i) out += ',';
+            appendNumber(out, level.price);
+            out += ':';
+            appendNumber(out, level.quantity);
+            out += ':';
+            appendNumber(out, level.orderCount);
+        }
+    }
+    out += '\n';
+    return out;
+}
+
+const char* rejectReasonName(RejectReason reason) {
+    switch (reason) {
+        case RejectReason::OPEN_ORDERS: return "OPEN_ORDERS";
+        case RejectReason::GROSS_NOTIONAL: return "GROSS_NOTIONAL";
+        case RejectReason::POSITION: return "POSITION";
+        case RejectReason::MESSAGE_RATE: return "MESSAGE_RATE";
+        case RejectReason::RISK_CAPACITY: return "RISK_CAPACITY";
+        default: return "NONE";
+    }
+}
+
+// EXECUTION|execId|orderId|symbol|BUY/SELL|price|qty|leaves
+std::string formatExecution(const FillReport &fill, const std::string &symbol) {
+    std::string out;
+    out.reserve(64 + symbol.size());
+    out += "EXECUTION|";
+    appendNumber(out, fill.execId);
+    out += '|';
+    appendNumber(out, fill.orderId);
+    out += '|';
+    out += symbol;
+    out += fill.side == Side::BUY ? "|BUY|" : "|SELL|";
+    appendNumber(out, fill.price);
+    out += '|';
+    appendNumber(out, fill.quantity);
+    out += '|';
+    appendNumber(out, fill.leavesQuantity);
+    out += '\n';
+    return out;
+}
+
+}
+
+Session::Session(int fd, EngineController &controller, Poller &poller, LoopNotifier &notifier)
+    : fd_(fd), poller_(poller), controller_(controller),
+      channel_(std::make_shared<ResponseChannel>(notifier, fd)) {
+    parser_.setSymbols(&controller.symbols());
+}
 
 Session::~Session() {
+    // Engines may still hold the channel for in-flight requests
+    channel_->close();
     close(fd_);
 }
 
@@ -16,39 +90,7 @@ bool Session::onReadable() {
     while (true) {
         ssize_t n = read(fd_, buf, sizeof(buf));
         if (n > 0) {
-            parser_.appendData(buf, n);
-            while (true) {
-                auto hdr = parser_.nextMessageHeader();
-                if (!hdr.has_value()) break; // need more data
-                MessageType mt = hdr->type;
-
-                bool handled = true;
-                if (mt == MessageType::ADD) {
-                    auto m = parser_.nextAddMessage();
-                    if (!m.has_value()) break; 
-                    handled = handleAdd(*m);
-                } else if (mt == MessageType::CANCEL) {
-                    auto m = parser_.nextCancelMessage();
-                    if (!m.has_value()) break;
-                    handled = handleCancel(*m);
-                } else if (mt == MessageType::CANCEL_REPLACE) {
-                    auto m = parser_.nextCancelReplaceMessage();
-                    if (!m.has_value()) break;
-                    handled = handleCancelReplace(*m);
-                } else if (mt == MessageType::SNAPSHOT_REQUEST) {
-                    auto m = parser_.nextSnapshotRequest();
-                    if (!m.has_value()) break;
-                    handled = handleSnapshotRequest(*m);
-                } else {
-                    LOG(LogLevel::WARN, "Unknown message type");
-                    handled = false;
-                    break;
-                }
-
-                if (!handled) {
-                    LOG(LogLevel::ERROR, "Failed to handle message");
-                }
-            }
+            if (!onData(buf, (size_t)n)) return false;
         } else if (n == 0) {
             // client disconnected
             return false;
@@ -66,74 +108,245 @@ bool Session::onReadable() {
     return true;
 }
 
-bool Session::onWritable() {
-    while (!writeQueue_.empty()) {
-        const std::string &msg = writeQueue_.front();
-        ssize_t n = write(fd_, msg.data(), msg.size());
-        if (n < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return true;
-            } else {
-                LOG(LogLevel::ERROR, "write error");
-                return false;
-            }
-        } else if ((size_t)n < msg.size()) {
-            writeQueue_.front() = msg.substr(n);
-            return true;
+bool Session::onData(const char* data, size_t len) {
+    if (protocol_ == Protocol::UNKNOWN && len > 0) {
+        if ((uint8_t)data[0] == BINARY_MAGIC) {
+            protocol_ = Protocol::BINARY;
+            ++data;
+            --len;
         } else {
-            writeQueue_.erase(writeQueue_.begin());
+            protocol_ = Protocol::TEXT;
+        }
+    }
+    if (protocol_ == Protocol::BINARY) return onBinaryData(data, len);
+    return onTextData(data, len);
+}
+
+bool Session::onTextData(const char* data, size_t len) {
+    parser_.appendData(data, len);
+    while (true) {
+        MessageParser::Result r = parser_.next(parsed_);
+        if (r == MessageParser::Result::NEED_MORE) break;
+        if (r == MessageParser::Result::SKIPPED) continue;
+
+        bool handled = true;
+        switch (parsed_.type) {
+            case MessageType::ADD:
+                handled = handleAdd(parsed_.add);
+                break;
+            case MessageType::CANCEL:
+                handled = handleCancel(parsed_.cancel);
+                break;
+            case MessageType::CANCEL_REPLACE:
+                handled = handleCancelReplace(parsed_.cancelReplace);
+                break;
+            case MessageType::SNAPSHOT_REQUEST:
+                handled = handleSnapshotRequest(parsed_.snapshot);
+                break;
+            default:
+                handled = false;
+                break;
+        }
+
+        if (!handled) {
+            LOG(LogLevel::ERROR, "Failed to handle message");
+        }
+    }
+    return true;
+}
+
+bool Session::onBinaryData(const char* data, size_t len) {
+    // Decode straight from the read buffer; only a trailing partial frame is copied
+    if (partialFrame_.empty()) {
+        ssize_t used = decodeFrames(data, len);
+        if (used < 0) return false;
+        partialFrame_.assign(data + used, data + len);
+        return true;
+    }
+
+    partialFrame_.insert(partialFrame_.end(), data, data + len);
+    ssize_t used = decodeFrames(partialFrame_.data(), partialFrame_.size());
+    if (used < 0) return false;
+    partialFrame_.erase(partialFrame_.begin(), partialFrame_.begin() + used);
+    return true;
+}
+
+ssize_t Session::decodeFrames(const char* buf, size_t len) {
+    size_t off = 0;
+    while (len - off >= sizeof(WireHeader)) {
+        const WireHeader &hdr = *reinterpret_cast<const WireHeader*>(buf + off);
+        if (hdr.length < sizeof(WireHeader) || hdr.length > WIRE_MAX_FRAME) {
+            LOG(LogLevel::ERROR, "Bad binary frame length " << hdr.length << " on fd " << fd_);
+            return -1;
         }
+        if (len - off < hdr.length) break; // need more data
+
+        const char* frame = buf + off;
+        off += hdr.length;
+
+        bool handled = true;
+        switch ((WireType)hdr.type) {
+            case WireType::ADD: {
+                AddMessage m;
+                if (BinaryCodec::decodeAdd(frame, hdr.length, controller_.symbols(), m)) handled = handleAdd(m);
+                else respond(MessageType::ADD, hdr.sequence, false);
+                break;
+            }
+            case WireType::CANCEL: {
+                CancelMessage m;
+                if (BinaryCodec::decodeCancel(frame, hdr.length, m)) handled = handleCancel(m);
+                else respond(MessageType::CANCEL, hdr.sequence, false);
+                break;
+            }
+            case WireType::CANCEL_REPLACE: {
+                CancelReplaceMessage m;
+                if (BinaryCodec::decodeCancelReplace(frame, hdr.length, m)) handled = handleCancelReplace(m);
+                else respond(MessageType::CANCEL_REPLACE, hdr.sequence, false);
+                break;
+            }
+            case WireType::SNAPSHOT_REQUEST: {
+                SnapshotRequest m;
+                if (BinaryCodec::decodeSnapshotRequest(frame, hdr.length, controller_.symbols(), m)) handled = handleSnapshotRequest(m);
+                else respond(MessageType::SNAPSHOT_REQUEST, hdr.sequence, false);
+                break;
+            }
+            default:
+                LOG(LogLevel::WARN, "Unknown binary message type " << (int)hdr.type);
+                handled = false;
+                break;
+        }
+
+        if (!handled) {
+            LOG(LogLevel::ERROR, "Failed to handle message");
+        }
+    }
+    return (ssize_t)off;
+}
+
+bool Session::onWritable() {
+    writeArmed_ = false;
+    return flush();
+}
+
+bool Session::wantsFlush() {
+    if (flushScheduled_ || (output_.empty() && !overflowed_)) return false;
+    flushScheduled_ = true;
+    return true;
+}
+
+bool Session::flush() {
+    flushScheduled_ = false;
+    if (overflowed_) return false;
+    if (output_.writeTo(fd_) < 0) {
+        LOG(LogLevel::ERROR, "write error");
+        return false;
+    }
+    // Register for writable events only when the socket pushed back
+    if (!output_.empty() && !writeArmed_) {
+        writeArmed_ = poller_.armWrite(fd_);
     }
     return true;
 }
 
 void Session::queueResponse(const std::string &msg) {
-    writeQueue_.push_back(msg);
+    queueResponse(msg.data(), msg.size());
+}
 
-    // Register for writable events
-    struct kevent ev;
-    EV_SET(&ev, fd_, EVFILT_WRITE, EV_ADD | EV_ENABLE, 0, 0, this);
-    if (kevent(kqfd_, &ev, 1, nullptr, 0, nullptr) < 0) {
-        LOG(LogLevel::ERROR, "Failed to register writable event for fd=" << fd_);
+void Session::queueResponse(const void* data, size_t len) {
+    if (overflowed_) return;
+    if (!output_.append(data, len)) {
+        LOG(LogLevel::WARN, "Client fd=" << fd_ << " left " << output_.size() << " bytes unread, disconnecting");
+        overflowed_ = true;
+    }
+}
+
+void Session::respond(MessageType request, uint64_t sequence, bool success, RejectReason reason) {
+    if (protocol_ == Protocol::BINARY) {
+        WireAck ack = BinaryCodec::encodeAck(request, sequence, success, reason);
+        queueResponse(&ack, sizeof(ack));
+        return;
+    }
+    // Only risk rejects of new orders and replaces carry one: ADD_NACK|POSITION
+    if (reason != RejectReason::NONE) {
+        std::string out = request == MessageType::ADD ? "ADD_NACK|" : "CANCEL_REPLACE_NACK|";
+        out += rejectReasonName(reason);
+        out += '\n';
+        queueResponse(out);
+        return;
+    }
+    switch (request) {
+        case MessageType::ADD:
+            queueResponse(success ? "ADD_ACK\n" : "ADD_NACK\n");
+            break;
+        case MessageType::CANCEL:
+            queueResponse(success ? "CANCEL_ACK\n" : "CANCEL_NACK\n");
+            break;
+        case MessageType::CANCEL_REPLACE:
+            queueResponse(success ? "CANCEL_REPLACE_ACK\n" : "CANCEL_REPLACE_NACK\n");
+            break;
+        case MessageType::SNAPSHOT_REQUEST:
+            queueResponse(success ? "SNAPSHOT_ACK\n" : "SNAPSHOT_NACK\n");
+            break;
+        default:
+            break;
     }
 }
 
+// Requests are answered asynchronously through onResponses(); only a request
+// that could not be queued is NACKed here.
 bool Session::handleAdd(const AddMessage &msg) {
-    bool success = controller_.dispatchAdd(msg);
-    if (success) queueResponse("ADD_ACK\n");
-    else queueResponse("ADD_NACK\n");
-    return success;
+    // Fills are reported to whichever session last sent orders for the
+    // participant; bound before the order can trade
+    if (msg.participantId != boundParticipant_) {
+        controller_.bindParticipant(msg.participantId, channel_);
+        boundParticipant_ = msg.participantId;
+    }
+    bool queued = controller_.dispatchAdd(msg, channel_);
+    if (!queued) respond(MessageType::ADD, msg.header.sequence, false);
+    return queued;
 }
 
 bool Session::handleCancel(const CancelMessage &msg) {
-    bool success = controller_.dispatchCancel(msg);
-    if (success) queueResponse("CANCEL_ACK\n");
-    else queueResponse("CANCEL_NACK\n");
-    return success;
+    bool queued = controller_.dispatchCancel(msg, channel_);
+    if (!queued) respond(MessageType::CANCEL, msg.header.sequence, false);
+    return queued;
 }
 
 bool Session::handleCancelReplace(const CancelReplaceMessage &msg) {
-    bool success = controller_.dispatchCancelReplace(msg);
-    if (success) queueResponse("CANCEL_REPLACE_ACK\n");
-    else queueResponse("CANCEL_REPLACE_NACK\n");
-    return success;
+    bool queued = controller_.dispatchCancelReplace(msg, channel_);
+    if (!queued) respond(MessageType::CANCEL_REPLACE, msg.header.sequence, false);
+    return queued;
 }
 
 bool Session::handleSnapshotRequest(const SnapshotRequest &msg) {
-    controller_.dispatchSnapshotRequest(msg);
-
-    // Prepare detailed snapshot response
-    double bestBid = 0.0, bestAsk = 0.0, lastTradePrice = 0.0;
-    controller_.getTopOfBook(msg.symbol, bestBid, bestAsk);
-    lastTradePrice = controller_.getLastTradePrice(msg.symbol);
-
-    std::ostringstream response;
-    response << "SNAPSHOT|symbol=" << msg.symbol
-             << "|bestBid=" << bestBid
-             << "|bestAsk=" << bestAsk
-             << "|lastTradePrice=" << lastTradePrice << "\n";
+    bool queued = controller_.dispatchSnapshotRequest(msg, channel_);
+    if (!queued) respond(MessageType::SNAPSHOT_REQUEST, msg.header.sequence, false);
+    return queued;
+}
 
-    queueResponse(response.str());
-    return true;
+void Session::onResponses() {
+    channel_->drain([this](const EngineResponse &resp) {
+        if (resp.type == MessageType::EXECUTION) {
+            const std::string &symbol = controller_.symbols().name(resp.fill.symbolId);
+            if (protocol_ == Protocol::BINARY) {
+                WireExecution exec = BinaryCodec::encodeExecution(resp.fill, symbol);
+                queueResponse(&exec, sizeof(exec));
+            } else {
+                queueResponse(formatExecution(resp.fill, symbol));
+            }
+            return;
+        }
+        if (resp.type != MessageType::SNAPSHOT_REQUEST) {
+            respond(resp.type, resp.sequence, resp.success, resp.reason);
+            return;
+        }
+        if (protocol_ == Protocol::BINARY) {
+            std::vector<char> frame;
+            BinaryCodec::encodeSnapshot(resp.snapshot, frame);
+            queueResponse(frame.data(), frame.size());
+            return;
+        }
+        queueResponse(formatSnapshot(resp.snapshot));
+    });
 }
 
@@ -1,28 +1,65 @@
 #pragma once
+#include <memory>
 #include <string>
 #include <vector>
 #include "MessageParser.h"
+#include "OutputBuffer.h"
+#include "BinaryProtocol.h"
 #include "EngineController.h"
+#include "Poller.h"
+#include "ResponseChannel.h"
 
 class Session {
 public:
-    Session(int fd, EngineController &controller, int kqfd_);
+    // Output a client may leave unread before it is disconnected
+    static constexpr size_t MAX_OUTPUT_BYTES = 8 << 20;
+
+    Session(int fd, EngineController &controller, Poller &poller, LoopNotifier &notifier);
     ~Session();
 
     int getFd() const { return fd_; }
+    const std::shared_ptr<ResponseChannel>& channel() const { return channel_; }
+
+    // Format whatever the engines have answered so far
+    void onResponses();
 
     bool onReadable();
+    bool onData(const char* data, size_t len);
     bool onWritable();
+    // Responses are only queued here; the loop flushes each session once per
+    // iteration. True the first time output is waiting since the last flush.
+    bool wantsFlush();
+    // Write what is queued, arming WRITABLE only if the socket is full.
+    // False if the session must be dropped.
+    bool flush();
     void queueResponse(const std::string &msg);
+    void queueResponse(const void* data, size_t len);
 
 private:
-    int kqfd_;
     int fd_;
+    Poller &poller_;
     std::string clientAddr_;
     EngineController &controller_;
+    std::shared_ptr<ResponseChannel> channel_;
 
-    std::vector<std::string> writeQueue_;
+    // Chosen by the first byte the client sends
+    enum class Protocol { UNKNOWN, TEXT, BINARY };
+    Protocol protocol_ = Protocol::UNKNOWN;
+
+    OutputBuffer output_{MAX_OUTPUT_BYTES};
+    bool flushScheduled_ = false;
+    bool writeArmed_ = false;
+    bool overflowed_ = false;
     MessageParser parser_;
+    ParsedMessage parsed_;
+    std::vector<char> partialFrame_; // binary bytes carried over between reads
+    uint64_t boundParticipant_ = UINT64_MAX; // last participant bound to channel_
+
+    bool onTextData(const char* data, size_t len);
+    bool onBinaryData(const char* data, size_t len);
+    // Decode whole frames from buf, returns bytes consumed or -1 on a framing error
+    ssize_t decodeFrames(const char* buf, size_t len);
+    void respond(MessageType request, uint64_t sequence, bool success, RejectReason reason = RejectReason::NONE);
 
     bool handleAdd(const AddMessage &msg);
     bool handleCancel(const CancelMessage &msg);
@@ -0,0 +1,301 @@
+#include "Snapshot.h"
+#include "Crc32.h"
+#include "EngineController.h"
+#include "Logging.h"
+#include "Replay.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char SNAPSHOT_MAGIC[8] = {'P', 'L', 'U', 'T', 'U', 'S', 'S', '2'};
+constexpr size_t CAPTURED_CAPACITY = 1024;
+
+#pragma pack(push, 1)
+struct SnapshotFileHeader {
+    char magic[8];
+    uint32_t crc;          // CRC-32C of everything after this field
+    uint32_t reserved;
+    char symbol[8];
+    uint64_t lsn;
+    uint64_t nextSequence;
+    double tickSize;
+    uint64_t minQuantity;
+    double minPrice;
+    double maxPrice;
+    double volatilityThreshold;
+    double referencePrice;
+    uint8_t tradingHalted;
+    uint8_t bookType;
+    uint8_t haveLastTrade;
+    uint8_t selfTrade;
+    uint8_t reserved2[4];
+    int64_t lastTradePrice;
+    uint64_t orderCount;
+    uint64_t stopCount;
+    uint64_t tradeCount;
+};
+#pragma pack(pop)
+
+constexpr size_t CRC_OFFSET = offsetof(SnapshotFileHeader, reserved);
+
+int dataSync(int fd) {
+#if defined(__APPLE__)
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+template<typename T>
+void appendArray(std::vector<char> &out, const std::vector<T> &items) {
+    size_t start = out.size();
+    out.resize(start + items.size() * sizeof(T));
+    if (!items.empty()) std::memcpy(out.data() + start, items.data(), items.size() * sizeof(T));
+}
+
+template<typename T>
+void readArray(const char* &p, uint64_t count, std::vector<T> &items) {
+    items.resize(count);
+    if (count) std::memcpy(items.data(), p, count * sizeof(T));
+    p += count * sizeof(T);
+}
+
+}
+
+SnapshotStore::SnapshotStore(const std::string &directory) : directory_(directory) {}
+
+std::string SnapshotStore::pathFor(const std::string &symbol, uint64_t lsn) const {
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%020llu.snap", (unsigned long long)lsn);
+    return directory_ + "/" + symbol + suffix;
+}
+
+std::vector<uint64_t> SnapshotStore::list(const std::string &symbol) {
+    std::vector<uint64_t> out;
+    DIR* dir = opendir(directory_.c_str());
+    if (!dir) return out;
+    const std::string prefix = symbol + ".";
+    while (dirent* ent = readdir(dir)) {
+        std::string name = ent->d_name;
+        // <symbol>.<20 digits>.snap
+        if (name.size() != prefix.size() + 25 || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - 5, 5, ".snap") != 0) {
+            continue;
+        }
+        std::string digits = name.substr(prefix.size(), 20);
+        if (!std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; })) continue;
+        out.push_back(std::strtoull(digits.c_str(), nullptr, 10));
+    }
+    closedir(dir);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+bool SnapshotStore::encode(const EngineSnapshot &snap, uint64_t lsn, std::vector<char> &out) {
+    if (snap.symbol.size() > 8) return false;
+    SnapshotFileHeader hdr{};
+    std::memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    std::memcpy(hdr.symbol, snap.symbol.data(), snap.symbol.size());
+    hdr.lsn = lsn;
+    hdr.nextSequence = snap.nextSequence;
+    hdr.tickSize = snap.config.tickSize;
+    hdr.minQuantity = snap.config.minQuantity;
+    hdr.minPrice = snap.config.minPrice;
+    hdr.maxPrice = snap.config.maxPrice;
+    hdr.volatilityThreshold = snap.config.volatilityThreshold;
+    hdr.referencePrice = snap.config.referencePrice;
+    hdr.tradingHalted = snap.config.tradingHalted;
+    hdr.bookType = (uint8_t)snap.config.bookType;
+    hdr.selfTrade = (uint8_t)snap.config.selfTrade;
+    hdr.haveLastTrade = snap.book.haveLastTrade;
+    hdr.lastTradePrice = snap.book.lastTradePrice;
+    hdr.orderCount = snap.book.orders.size();
+    hdr.stopCount = snap.book.stops.size();
+    hdr.tradeCount = snap.book.recentTrades.size();
+
+    out.clear();
+    out.resize(sizeof(hdr));
+    appendArray(out, snap.book.orders);
+    appendArray(out, snap.book.stops);
+    appendArray(out, snap.book.recentTrades);
+    std::memcpy(out.data(), &hdr, sizeof(hdr));
+    hdr.crc = crc32c(out.data() + CRC_OFFSET, out.size() - CRC_OFFSET);
+    std::memcpy(out.data(), &hdr, sizeof(hdr));
+    return true;
+}
+
+bool SnapshotStore::decode(const char* data, size_t len, EngineSnapshot &out) {
+    SnapshotFileHeader hdr;
+    if (len < sizeof(hdr)) return false;
+    std::memcpy(&hdr, data, sizeof(hdr));
+    if (std::memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0) return false;
+    size_t expected = sizeof(hdr) + (hdr.orderCount + hdr.stopCount) * sizeof(SnapshotOrder) +
+                      hdr.tradeCount * sizeof(SnapshotTrade);
+    if (len != expected) return false;
+    if (hdr.crc != crc32c(data + CRC_OFFSET, len - CRC_OFFSET)) return false;
+
+    out.symbol.assign(hdr.symbol, strnlen(hdr.symbol, sizeof(hdr.symbol)));
+    out.lsn.store(hdr.lsn);
+    out.nextSequence = hdr.nextSequence;
+    out.config.tickSize = hdr.tickSize;
+    out.config.minQuantity = hdr.minQuantity;
+    out.config.minPrice = hdr.minPrice;
+    out.config.maxPrice = hdr.maxPrice;
+    out.config.volatilityThreshold = hdr.volatilityThreshold;
+    out.config.referencePrice = hdr.referencePrice;
+    out.config.tradingHalted = hdr.tradingHalted != 0;
+    out.config.bookType = (BookType)hdr.bookType;
+    out.config.selfTrade = (SelfTradePrevention)hdr.selfTrade;
+    out.book.haveLastTrade = hdr.haveLastTrade != 0;
+    out.book.lastTradePrice = hdr.lastTradePrice;
+
+    const char* p = data + sizeof(hdr);
+    readArray(p, hdr.orderCount, out.book.orders);
+    readArray(p, hdr.stopCount, out.book.stops);
+    readArray(p, hdr.tradeCount, out.book.recentTrades);
+    return true;
+}
+
+bool SnapshotStore::write(const EngineSnapshot &snap, uint64_t lsn) {
+    std::vector<char> buf;
+    if (!encode(snap, lsn, buf)) {
+        LOG(LogLevel::ERROR, "Snapshot: cannot encode " << snap.symbol);
+        return false;
+    }
+    if (mkdir(directory_.c_str(), 0755) < 0 && errno != EEXIST) {
+        LOG(LogLevel::ERROR, "Snapshot: cannot create directory " << directory_);
+        return false;
+    }
+
+    std::string path = pathFor(snap.symbol, lsn);
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG(LogLevel::ERROR, "Snapshot: cannot create " << tmp);
+        return false;
+    }
+    const char* p = buf.data();
+    size_t left = buf.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    bool ok = left == 0 && dataSync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        LOG(LogLevel::ERROR, "Snapshot: cannot write " << path);
+        unlink(tmp.c_str());
+        return false;
+    }
+    // Make the rename itself durable
+    int dirFd = open(directory_.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    return true;
+}
+
+bool SnapshotStore::loadLatest(const std::string &symbol, EngineSnapshot &out) {
+    std::vector<uint64_t> lsns = list(symbol);
+    for (size_t i = lsns.size(); i-- > 0;) {
+        std::string path = pathFor(symbol, lsns[i]);
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) continue;
+        struct stat st;
+        std::vector<char> buf;
+        bool ok = fstat(fd, &st) == 0;
+        if (ok) {
+            buf.resize((size_t)st.st_size);
+            ok = pread(fd, buf.data(), buf.size(), 0) == (ssize_t)buf.size();
+        }
+        close(fd);
+        if (ok && decode(buf.data(), buf.size(), out) && out.symbol == symbol && out.lsn.load() == lsns[i]) {
+            return true;
+        }
+        LOG(LogLevel::WARN, "Snapshot: ignoring unreadable " << path);
+    }
+    return false;
+}
+
+void SnapshotStore::prune(const std::string &symbol, size_t keep) {
+    std::vector<uint64_t> lsns = list(symbol);
+    for (size_t i = 0; i + keep < lsns.size(); ++i) {
+        unlink(pathFor(symbol, lsns[i]).c_str());
+    }
+}
+
+SnapshotManager::SnapshotManager(EngineController &controller, Replay &replay, const SnapshotOptions &options)
+    : controller_(controller), replay_(replay), options_(options), store_(options.directory),
+      captured_(CAPTURED_CAPACITY) {
+    options_.keep = std::max<size_t>(options_.keep, 1);
+}
+
+SnapshotManager::~SnapshotManager() {
+    stop();
+}
+
+void SnapshotManager::start() {
+    if (options_.intervalSeconds == 0 || running_.exchange(true)) return;
+    thread_ = std::thread([this] { run(); });
+}
+
+void SnapshotManager::stop() {
+    if (!running_.exchange(false)) return;
+    if (thread_.joinable()) thread_.join();
+}
+
+void SnapshotManager::submit(std::unique_ptr<EngineSnapshot> snap) {
+    if (!captured_.tryPush(std::move(snap))) {
+        LOG(LogLevel::WARN, "Snapshot: capture queue full, dropping snapshot");
+    }
+}
+
+void SnapshotManager::run() {
+    auto interval = std::chrono::seconds(options_.intervalSeconds);
+    auto nextDue = std::chrono::steady_clock::now() + interval;
+    while (running_.load(std::memory_order_acquire)) {
+        if (std::chrono::steady_clock::now() >= nextDue) {
+            controller_.requestSnapshots(*this);
+            nextDue += interval;
+        }
+        writeReady();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void SnapshotManager::writeReady() {
+    std::unique_ptr<EngineSnapshot> snap;
+    while (captured_.tryPop(snap)) {
+        pending_.push_back(std::move(snap));
+    }
+
+    for (auto it = pending_.begin(); it != pending_.end();) {
+        EngineSnapshot &s = **it;
+        uint64_t lsn = s.lsn.load(std::memory_order_acquire);
+        if (lsn == 0 || !replay_.persisted(lsn)) {
+            ++it;
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (store_.write(s, lsn)) {
+            store_.prune(s.symbol, options_.keep);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            LOG(LogLevel::INFO, "Snapshot: " << s.symbol << " at lsn " << lsn << ", " << s.book.orders.size()
+                << " orders, " << s.book.stops.size() << " stops written in " << ms << "ms");
+        }
+        it = pending_.erase(it);
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BookState.h"
+#include "RingBuffer.h"
+#include "SymbolConfig.h"
+
+class EngineController;
+class Replay;
+
+// One engine's state at a journal checkpoint
+struct EngineSnapshot {
+    std::string symbol;
+    // LSN of the journal CHECKPOINT record; 0 until the journal writer assigns it
+    std::atomic<uint64_t> lsn{0};
+    uint64_t nextSequence = 1;
+    SymbolConfig config{};
+    BookState book;
+};
+
+struct SnapshotOptions {
+    std::string directory = "snapshots";
+    uint64_t intervalSeconds = 60; // 0 disables periodic snapshots
+    size_t keep = 2;               // files kept per symbol
+};
+
+// Snapshot files: <directory>/<symbol>.<lsn>.snap, a fixed header followed by
+// the order, stop and trade arrays, CRC-checked as a whole. Files are written
+// to a temporary name, synced and renamed so a crash never leaves a partial
+// snapshot under a real name.
+class SnapshotStore {
+public:
+    explicit SnapshotStore(const std::string &directory);
+
+    bool write(const EngineSnapshot &snap, uint64_t lsn);
+    // Newest snapshot of symbol that passes its checks
+    bool loadLatest(const std::string &symbol, EngineSnapshot &out);
+    void prune(const std::string &symbol, size_t keep);
+
+    static bool encode(const EngineSnapshot &snap, uint64_t lsn, std::vector<char> &out);
+    static bool decode(const char* data, size_t len, EngineSnapshot &out);
+
+private:
+    std::string directory_;
+
+    // LSNs of symbol's snapshot files, ascending
+    std::vector<uint64_t> list(const std::string &symbol);
+    std::string pathFor(const std::string &symbol, uint64_t lsn) const;
+};
+
+// Takes periodic snapshots. Engines capture their books on their own thread
+// when a checkpoint command reaches them, which is a flat copy of the orders;
+// this thread encodes and writes the copies, so the hot path never waits on
+// disk. A snapshot is only written once its checkpoint record is persisted in
+// the journal, so the journal never restarts below a snapshot's LSN.
+class SnapshotManager {
+public:
+    SnapshotManager(EngineController &controller, Replay &replay, const SnapshotOptions &options);
+    ~SnapshotManager();
+
+    void start();
+    void stop();
+
+    // Engine threads: hand over a capture
+    void submit(std::unique_ptr<EngineSnapshot> snap);
+
+private:
+    EngineController &controller_;
+    Replay &replay_;
+    SnapshotOptions options_;
+    SnapshotStore store_;
+    MpscRing<std::unique_ptr<EngineSnapshot>> captured_;
+    std::vector<std::unique_ptr<EngineSnapshot>> pending_;
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+
+    void run();
+    void writeReady();
+};
@@ -1,7 +1,17 @@
 #pragma once
-#include <string>
-#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <memory>
 #include <mutex>
+#include <vector>
+#include "Messages.h"
+#include "SymbolTable.h"
+
+// Price level storage used by a symbol's OrderBook
+enum class BookType : uint8_t {
+    MAP,    // std::map levels, unbounded price range
+    LADDER  // array ladder over [minPrice, maxPrice], O(1) best price
+};
 
 struct SymbolConfig {
     double tickSize;
@@ -11,39 +21,112 @@ struct SymbolConfig {
     double volatilityThreshold; // e.g. max percent change from reference
     double referencePrice;      // base price for volatility checks
     bool tradingHalted;
+    BookType bookType;
+    SelfTradePrevention selfTrade = SelfTradePrevention::CANCEL_NEWEST; // for orders that do not pick one
 };
 
+// Per-symbol configuration, read-copy-update. A symbol's engine is its only
+// lock-free reader: acquire() is one acquire load per request and never
+// blocks. Updates (admin changes, volatility halts) copy the current
+// version, publish the copy with one store and lock only that symbol's
+// writer mutex, so neither matching nor other symbols wait on them. A
+// replaced version is freed once the engine has loaded a newer one, which it
+// only does between requests.
+//
+// Symbols are added with setConfig() before their engines start; after that
+// setConfig() and the other writers only update existing symbols.
 class SymbolConfigManager {
 public:
-    void setConfig(const std::string &symbol, const SymbolConfig &config) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        configs_[symbol] = config;
+    ~SymbolConfigManager() {
+        for (auto &slot : slots_) {
+            delete slot->current.load(std::memory_order_relaxed);
+            for (const Version* v : slot->retired) delete v;
+        }
+    }
+
+    // Add a symbol at startup, or publish a whole new config for it
+    void setConfig(SymbolId id, const SymbolConfig &config) {
+        if (id >= slots_.size()) {
+            slots_.resize(id + 1);
+        }
+        if (!slots_[id]) slots_[id] = std::make_unique<Slot>();
+        update(id, [&](SymbolConfig &c) { c = config; });
     }
 
-    bool getConfig(const std::string &symbol, SymbolConfig &out) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        auto it = configs_.find(symbol);
-        if (it == configs_.end()) return false;
-        out = it->second;
+    // Copy of the current version; any thread
+    bool getConfig(SymbolId id, SymbolConfig &out) {
+        Slot* slot = slotFor(id);
+        if (!slot) return false;
+        std::lock_guard<std::mutex> lock(slot->writeMutex);
+        const Version* v = slot->current.load(std::memory_order_acquire);
+        if (!v) return false;
+        out = v->config;
         return true;
     }
 
-    void haltTrading(const std::string &symbol) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        if (configs_.find(symbol) != configs_.end()) {
-            configs_[symbol].tradingHalted = true;
+    // The symbol's engine thread only. Stays valid until its next acquire().
+    const SymbolConfig* acquire(SymbolId id) {
+        Slot* slot = slotFor(id);
+        if (!slot) return nullptr;
+        const Version* v = slot->current.load(std::memory_order_acquire);
+        if (!v) return nullptr;
+        if (slot->readerVersion.load(std::memory_order_relaxed) != v->version) {
+            slot->readerVersion.store(v->version, std::memory_order_release);
         }
+        return &v->config;
     }
 
-    void resumeTrading(const std::string &symbol) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        if (configs_.find(symbol) != configs_.end()) {
-            configs_[symbol].tradingHalted = false;
-        }
+    // Copy, mutate and publish. Returns false for an unknown symbol.
+    template<typename Mutate>
+    bool update(SymbolId id, Mutate &&mutate) {
+        Slot* slot = slotFor(id);
+        if (!slot) return false;
+        std::lock_guard<std::mutex> lock(slot->writeMutex);
+        const Version* old = slot->current.load(std::memory_order_relaxed);
+        Version* next = new Version{old ? old->config : SymbolConfig{}, old ? old->version + 1 : 1};
+        mutate(next->config);
+        slot->current.store(next, std::memory_order_release);
+        if (old) slot->retired.push_back(old);
+        reclaim(*slot);
+        return true;
+    }
+
+    bool haltTrading(SymbolId id) {
+        return update(id, [](SymbolConfig &c) { c.tradingHalted = true; });
+    }
+
+    bool resumeTrading(SymbolId id) {
+        return update(id, [](SymbolConfig &c) { c.tradingHalted = false; });
     }
 
 private:
-    std::unordered_map<std::string, SymbolConfig> configs_;
-    std::mutex mtx_;
-};
+    struct Version {
+        SymbolConfig config;
+        uint64_t version;
+    };
+
+    struct Slot {
+        std::atomic<const Version*> current{nullptr};
+        // Newest version the engine has loaded; older retired ones are unreachable
+        std::atomic<uint64_t> readerVersion{0};
+        std::mutex writeMutex;
+        std::vector<const Version*> retired;
+    };
+
+    std::vector<std::unique_ptr<Slot>> slots_;
 
+    Slot* slotFor(SymbolId id) {
+        return id < slots_.size() ? slots_[id].get() : nullptr;
+    }
+
+    // Writer mutex held
+    void reclaim(Slot &slot) {
+        uint64_t seen = slot.readerVersion.load(std::memory_order_acquire);
+        size_t kept = 0;
+        for (const Version* v : slot.retired) {
+            if (v->version < seen) delete v;
+            else slot.retired[kept++] = v;
+        }
+        slot.retired.resize(kept);
+    }
+};
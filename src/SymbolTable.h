@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "OrderIndex.h"
+
+using SymbolId = uint32_t;
+constexpr SymbolId INVALID_SYMBOL = UINT32_MAX;
+constexpr size_t MAX_SYMBOL_LENGTH = 7; // fits char[8] with its NUL on the wire and in the journal
+
+// Interns symbols to dense ids so everything past the parser indexes flat
+// arrays instead of hashing strings. A symbol's bytes packed into a uint64
+// are the lookup key. Filled at startup and read-only once sessions run, so
+// lookups take no lock.
+class SymbolTable {
+public:
+    // Startup only. Returns the existing id for a known symbol.
+    SymbolId intern(std::string_view symbol) {
+        if (symbol.empty() || symbol.size() > MAX_SYMBOL_LENGTH) return INVALID_SYMBOL;
+        if (const SymbolId* id = ids_.find(pack(symbol))) return *id;
+        SymbolId id = (SymbolId)names_.size();
+        names_.emplace_back(symbol);
+        ids_.set(pack(symbol), id);
+        return id;
+    }
+
+    SymbolId find(std::string_view symbol) const {
+        if (symbol.empty() || symbol.size() > MAX_SYMBOL_LENGTH) return INVALID_SYMBOL;
+        const SymbolId* id = ids_.find(pack(symbol));
+        return id ? *id : INVALID_SYMBOL;
+    }
+
+    // NUL-padded wire/journal form
+    SymbolId find(const char (&symbol)[8]) const {
+        return find(std::string_view(symbol, strnlen(symbol, sizeof(symbol))));
+    }
+
+    const std::string& name(SymbolId id) const {
+        static const std::string unknown;
+        return id < names_.size() ? names_[id] : unknown;
+    }
+
+    size_t size() const { return names_.size(); }
+
+private:
+    OrderIndex<SymbolId> ids_{64};
+    std::vector<std::string> names_;
+
+    static uint64_t pack(std::string_view symbol) {
+        uint64_t key = 0;
+        std::memcpy(&key, symbol.data(), symbol.size());
+        return key;
+    }
+};
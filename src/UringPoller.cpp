@@ -0,0 +1,287 @@
+#include "UringPoller.h"
+
+#if PLUTUS_HAVE_URING
+
+#include "Logging.h"
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+int ioUringSetup(unsigned entries, io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+// The ring indices are shared with the kernel
+unsigned loadAcquire(const unsigned* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned* p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+} // namespace
+
+UringPoller::~UringPoller() {
+    delete[] bufBase_;
+    if (sqes_) munmap(sqes_, sqesSize_);
+    if (cqRing_ && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+    if (sqRing_) munmap(sqRing_, sqRingSize_);
+    if (ringFd_ >= 0) close(ringFd_);
+}
+
+bool UringPoller::init() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ringFd_ = ioUringSetup(RING_ENTRIES, &params);
+    if (ringFd_ < 0) {
+        LOG(LogLevel::ERROR, "io_uring_setup failed errno=" << errno);
+        return false;
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ringFd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+        sqRing_ = nullptr;
+        LOG(LogLevel::ERROR, "io_uring SQ ring mmap failed");
+        return false;
+    }
+    if (singleMmap) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ringFd_, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) {
+            cqRing_ = nullptr;
+            LOG(LogLevel::ERROR, "io_uring CQ ring mmap failed");
+            return false;
+        }
+    }
+
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ringFd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        LOG(LogLevel::ERROR, "io_uring SQE mmap failed");
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqEntries_ = params.sq_entries;
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // One provided-buffer group shared by every client recv. Buffers are handed
+    // back with IORING_OP_PROVIDE_BUFFERS in the same submission as the next wait.
+    bufBase_ = new char[BUF_COUNT * BUF_SIZE];
+    provideBuffers(0, BUF_COUNT);
+    return submit(0);
+}
+
+io_uring_sqe* UringPoller::getSqe() {
+    unsigned tail = *sqTail_;
+    if (tail - loadAcquire(sqHead_) >= sqEntries_) {
+        // SQ full: hand what we have to the kernel before queueing more
+        if (!submit(0)) return nullptr;
+    }
+    unsigned idx = tail & sqMask_;
+    io_uring_sqe* sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqArray_[idx] = idx;
+    storeRelease(sqTail_, tail + 1);
+    ++toSubmit_;
+    return sqe;
+}
+
+bool UringPoller::submit(unsigned minComplete) {
+    unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        int ret = ioUringEnter(ringFd_, toSubmit_, minComplete, flags);
+        if (ret >= 0) {
+            toSubmit_ -= std::min<unsigned>(toSubmit_, (unsigned)ret);
+            return true;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EBUSY) {
+            // Completion queue backed up; caller will reap before retrying
+            return true;
+        }
+        LOG(LogLevel::ERROR, "io_uring_enter failed errno=" << errno);
+        return false;
+    }
+}
+
+void UringPoller::prepAccept() {
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = encode(OP_ACCEPT, listenFd_, 0);
+}
+
+void UringPoller::prepRecv(int fd, uint32_t gen) {
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = encode(OP_RECV, fd, gen);
+}
+
+void UringPoller::provideBuffers(uint16_t firstBid, unsigned count) {
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = (int)count;
+    sqe->addr = reinterpret_cast<uint64_t>(bufBase_ + (size_t)firstBid * BUF_SIZE);
+    sqe->len = BUF_SIZE;
+    sqe->off = firstBid;
+    sqe->buf_group = BUF_GROUP;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = encode(OP_PROVIDE, 0, 0);
+}
+
+void UringPoller::publishBuffers() {
+    for (uint16_t bid : recycle_) provideBuffers(bid, 1);
+    recycle_.clear();
+}
+
+bool UringPoller::addListener(int fd) {
+    listenFd_ = fd;
+    prepAccept();
+    return submit(0);
+}
+
+bool UringPoller::addClient(int fd) {
+    uint32_t gen = nextGeneration_++;
+    if (nextGeneration_ == 0) nextGeneration_ = 1;
+    generations_[fd] = gen;
+    prepRecv(fd, gen);
+    // Submitted together with the next wait()
+    return true;
+}
+
+void UringPoller::removeClient(int fd) {
+    generations_.erase(fd);
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = encode(OP_CANCEL, fd, 0);
+    // Cancel-by-fd resolves the file at submit time, so it must go in before close()
+    submit(0);
+}
+
+bool UringPoller::armWrite(int fd) {
+    auto it = generations_.find(fd);
+    if (it == generations_.end()) return false;
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = encode(OP_POLLOUT, fd, it->second);
+    return true;
+}
+
+int UringPoller::wait(PollEvent* out, int maxEvents) {
+    while (true) {
+        // Data returned by the previous wait() has been consumed by now
+        publishBuffers();
+
+        if (loadAcquire(cqTail_) == *cqHead_) {
+            if (!submit(1)) return -1;
+        } else if (toSubmit_ > 0) {
+            if (!submit(0)) return -1;
+        }
+
+        int count = 0;
+        unsigned head = *cqHead_;
+        unsigned tail = loadAcquire(cqTail_);
+        while (head != tail && count < maxEvents) {
+            const io_uring_cqe &cqe = cqes_[head & cqMask_];
+            ++head;
+
+            Op op = Op(cqe.user_data & 0xff);
+            int fd = int((cqe.user_data >> 8) & 0xffffff);
+            uint32_t gen = uint32_t(cqe.user_data >> 32);
+            bool more = cqe.flags & IORING_CQE_F_MORE;
+            bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+            uint16_t bid = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+            if (op == OP_ACCEPT) {
+                if (cqe.res >= 0) {
+                    out[count++] = PollEvent{cqe.res, PollEvent::Kind::ACCEPTED};
+                } else {
+                    LOG(LogLevel::WARN, "io_uring accept failed res=" << cqe.res);
+                }
+                if (!more) prepAccept();
+                continue;
+            }
+            if (op == OP_CANCEL || op == OP_PROVIDE) continue;
+
+            auto it = generations_.find(fd);
+            bool live = it != generations_.end() && it->second == gen;
+            if (!live) {
+                if (hasBuffer) recycle_.push_back(bid);
+                continue;
+            }
+
+            if (op == OP_RECV) {
+                if (cqe.res > 0 && hasBuffer) {
+                    PollEvent ev{fd, PollEvent::Kind::DATA};
+                    ev.data = bufBase_ + (size_t)bid * BUF_SIZE;
+                    ev.len = (size_t)cqe.res;
+                    out[count++] = ev;
+                    recycle_.push_back(bid);
+                    if (!more) prepRecv(fd, gen);
+                } else if (cqe.res == -ENOBUFS) {
+                    // Every buffer is in flight; they come back with the next submit
+                    if (!more) prepRecv(fd, gen);
+                } else {
+                    if (hasBuffer) recycle_.push_back(bid);
+                    out[count++] = PollEvent{fd, PollEvent::Kind::HANGUP};
+                }
+            } else if (op == OP_POLLOUT) {
+                if (cqe.res > 0) out[count++] = PollEvent{fd, PollEvent::Kind::WRITABLE};
+            }
+        }
+        storeRelease(cqHead_, head);
+
+        if (count > 0) return count;
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+#include "Poller.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define PLUTUS_HAVE_URING 1
+#else
+#define PLUTUS_HAVE_URING 0
+#endif
+
+#if PLUTUS_HAVE_URING
+
+#include <linux/io_uring.h>
+#include <unordered_map>
+#include <vector>
+
+// io_uring backend talking to the kernel through the raw syscalls so there is
+// no liburing dependency. The listener uses a multishot accept and every client
+// a multishot recv that picks its buffer from a kernel-provided buffer group,
+// so steady-state input costs one io_uring_enter per loop iteration instead of
+// one read() per socket. Writes still go through write() and only use the ring
+// for POLLOUT notifications when a socket backs up.
+class UringPoller : public Poller {
+public:
+    ~UringPoller() override;
+
+    const char* name() const override { return "uring"; }
+    bool init() override;
+
+    bool addListener(int fd) override;
+    bool addClient(int fd) override;
+    void removeClient(int fd) override;
+    bool armWrite(int fd) override;
+
+    int wait(PollEvent* out, int maxEvents) override;
+
+private:
+    enum Op : uint8_t { OP_ACCEPT = 1, OP_RECV, OP_POLLOUT, OP_CANCEL, OP_PROVIDE };
+
+    static constexpr unsigned RING_ENTRIES = 256;
+    static constexpr unsigned BUF_COUNT = 256;
+    static constexpr unsigned BUF_SIZE = 4096;
+    static constexpr uint16_t BUF_GROUP = 0;
+
+    int ringFd_ = -1;
+    int listenFd_ = -1;
+
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    size_t sqRingSize_ = 0;
+    size_t cqRingSize_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqesSize_ = 0;
+
+    unsigned* sqHead_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned* sqArray_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned sqEntries_ = 0;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned toSubmit_ = 0;
+
+    char* bufBase_ = nullptr;
+    std::vector<uint16_t> recycle_; // buffers to hand back to the kernel
+
+    // Generation per live client fd so completions for a closed fd are not
+    // delivered to a new connection that reused the same number
+    std::unordered_map<int, uint32_t> generations_;
+    uint32_t nextGeneration_ = 1;
+
+    io_uring_sqe* getSqe();
+    bool submit(unsigned minComplete);
+    void prepAccept();
+    void prepRecv(int fd, uint32_t gen);
+    void provideBuffers(uint16_t firstBid, unsigned count);
+    void publishBuffers();
+
+    static uint64_t encode(Op op, int fd, uint32_t gen) {
+        return (uint64_t(gen) << 32) | (uint64_t(uint32_t(fd)) << 8) | op;
+    }
+};
+
+#endif
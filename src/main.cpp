@@ -4,32 +4,129 @@
 #include "NetworkInterface.h"
 #include "EventLoop.h"
 #include "SymbolConfig.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char** argv) {
+    // --poller=kqueue|epoll|uring, defaults to the platform's native poller
+    // --book=map|ladder, price level storage for the symbols below
+    // --pin-cpu=N, pin engine threads to cores N, N+1, ...
+    // --journal-dir=DIR, --segment-mb=N, journal location and segment size
+    // --durability=none|batch|interval, --sync-us=N, when journal writes are synced
+    // --snapshot-dir=DIR, --snapshot-interval=SECONDS (0 disables), book snapshots
+    // --pool-orders=N, --hugepages, order slots pre-faulted at startup and their backing
+    // --md-incremental=IP:PORT, --md-snapshot=IP:PORT, market data feed and its recovery channel
+    // --md-interface=IP, --md-ttl=N, multicast source interface and hop limit
+    // --md-shm=NAME, --md-shm-slots=N, shared-memory feed for local consumers
+    // --md-snapshot-ms=N (0 disables), --md-levels, snapshot cycle period and L2 updates
+    // --net-threads=N, event loops serving client connections, each with its own listener
+    // --self-trade=newest|oldest|both|decrement, default self-trade prevention for the symbols below
+    // --risk-open-orders=N, --risk-notional=X, --risk-position=N, --risk-rate=N, per-participant
+    //   pre-trade limits (0 or absent disables each); --risk-participants=N sizes their table
+    std::string pollerBackend;
+    BookType bookType = BookType::MAP;
+    int pinCpu = -1;
+    int netThreads = 1;
+    SelfTradePrevention selfTrade = SelfTradePrevention::CANCEL_NEWEST;
+    JournalOptions journalOptions;
+    SnapshotOptions snapshotOptions;
+    MemoryPoolOptions poolOptions;
+    MarketDataOptions marketDataOptions;
+    RiskLimits riskLimits;
+    poolOptions.reserveObjects = 1 << 18;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--poller=", 9) == 0) pollerBackend = argv[i] + 9;
+        if (std::strcmp(argv[i], "--book=ladder") == 0) bookType = BookType::LADDER;
+        if (std::strncmp(argv[i], "--pin-cpu=", 10) == 0) pinCpu = std::atoi(argv[i] + 10);
+        if (std::strncmp(argv[i], "--net-threads=", 14) == 0) netThreads = std::max(1, std::atoi(argv[i] + 14));
+        if (std::strncmp(argv[i], "--journal-dir=", 14) == 0) journalOptions.directory = argv[i] + 14;
+        if (std::strncmp(argv[i], "--segment-mb=", 13) == 0) journalOptions.segmentBytes = std::strtoull(argv[i] + 13, nullptr, 10) << 20;
+        if (std::strncmp(argv[i], "--sync-us=", 10) == 0) journalOptions.syncIntervalMicros = std::strtoull(argv[i] + 10, nullptr, 10);
+        if (std::strncmp(argv[i], "--snapshot-dir=", 15) == 0) snapshotOptions.directory = argv[i] + 15;
+        if (std::strncmp(argv[i], "--snapshot-interval=", 20) == 0) snapshotOptions.intervalSeconds = std::strtoull(argv[i] + 20, nullptr, 10);
+        if (std::strncmp(argv[i], "--pool-orders=", 14) == 0) poolOptions.reserveObjects = std::strtoull(argv[i] + 14, nullptr, 10);
+        if (std::strcmp(argv[i], "--hugepages") == 0) poolOptions.hugePages = true;
+        if (std::strncmp(argv[i], "--md-incremental=", 17) == 0) marketDataOptions.incrementalAddress = argv[i] + 17;
+        if (std::strncmp(argv[i], "--md-snapshot=", 14) == 0) marketDataOptions.snapshotAddress = argv[i] + 14;
+        if (std::strncmp(argv[i], "--md-interface=", 15) == 0) marketDataOptions.interface = argv[i] + 15;
+        if (std::strncmp(argv[i], "--md-ttl=", 9) == 0) marketDataOptions.ttl = std::atoi(argv[i] + 9);
+        if (std::strncmp(argv[i], "--md-shm=", 9) == 0) marketDataOptions.shmName = argv[i] + 9;
+        if (std::strncmp(argv[i], "--md-shm-slots=", 15) == 0) marketDataOptions.shmSlots = (uint32_t)std::strtoul(argv[i] + 15, nullptr, 10);
+        if (std::strncmp(argv[i], "--md-snapshot-ms=", 17) == 0) marketDataOptions.snapshotIntervalMs = std::strtoull(argv[i] + 17, nullptr, 10);
+        if (std::strcmp(argv[i], "--md-levels") == 0) marketDataOptions.levelUpdates = true;
+        if (std::strncmp(argv[i], "--risk-open-orders=", 19) == 0) riskLimits.maxOpenOrders = (uint32_t)std::strtoul(argv[i] + 19, nullptr, 10);
+        if (std::strncmp(argv[i], "--risk-notional=", 16) == 0) riskLimits.maxGrossNotional = std::strtod(argv[i] + 16, nullptr);
+        if (std::strncmp(argv[i], "--risk-position=", 16) == 0) riskLimits.maxPosition = std::strtoull(argv[i] + 16, nullptr, 10);
+        if (std::strncmp(argv[i], "--risk-rate=", 12) == 0) riskLimits.maxMessagesPerSecond = (uint32_t)std::strtoul(argv[i] + 12, nullptr, 10);
+        if (std::strncmp(argv[i], "--risk-participants=", 20) == 0) riskLimits.participants = (uint32_t)std::strtoul(argv[i] + 20, nullptr, 10);
+        if (std::strcmp(argv[i], "--self-trade=oldest") == 0) selfTrade = SelfTradePrevention::CANCEL_OLDEST;
+        if (std::strcmp(argv[i], "--self-trade=both") == 0) selfTrade = SelfTradePrevention::CANCEL_BOTH;
+        if (std::strcmp(argv[i], "--self-trade=decrement") == 0) selfTrade = SelfTradePrevention::DECREMENT_AND_CANCEL;
+        if (std::strcmp(argv[i], "--durability=none") == 0) journalOptions.durability = Durability::NONE;
+        if (std::strcmp(argv[i], "--durability=batch") == 0) journalOptions.durability = Durability::BATCH;
+        if (std::strcmp(argv[i], "--durability=interval") == 0) journalOptions.durability = Durability::INTERVAL;
+    }
 
-int main() {
     GLOBAL_LOG_LEVEL = LogLevel::INFO;
-    Replay replayLog;
+    // A client that disconnects mid-write must fail the write, not end the process
+    std::signal(SIGPIPE, SIG_IGN);
+    Replay replayLog(journalOptions);
     SymbolConfigManager configManager;
     EngineController controller(replayLog, configManager);
+    if (!controller.configureOrderPool(poolOptions)) {
+        LOG(LogLevel::ERROR, "Failed to reserve the order pool");
+        return 1;
+    }
 
     // Add some symbols
-    controller.addEngineForSymbol("AAPL", 0.01, 1, 1.00, 10000.00, 0.5, 150.00);
-    controller.addEngineForSymbol("BTCUSD", 0.01, 1, 1000.00, 100000.00, 0.3, 20000.00);
+    controller.addEngineForSymbol("AAPL", 0.01, 1, 1.00, 10000.00, 0.5, 150.00, bookType, selfTrade);
+    controller.addEngineForSymbol("BTCUSD", 0.01, 1, 1000.00, 100000.00, 0.3, 20000.00, bookType, selfTrade);
+    controller.setSnapshotOptions(snapshotOptions);
+    controller.setMarketDataOptions(marketDataOptions);
+    controller.setRiskLimits(riskLimits);
+    if (!controller.recover()) {
+        LOG(LogLevel::ERROR, "Journal replay diverged; books may not match the journal");
+    }
+    controller.startEngines(pinCpu);
 
+    // Each loop owns its sessions from accept to close and dispatches to the
+    // engines directly. On Linux every loop has its own SO_REUSEPORT listener
+    // and the kernel balances connections; elsewhere the loops share one
+    // listener and whichever accepts first takes the connection.
     NetworkInterface net;
-    int listenFd = net.setupListener("", 9999);
-    if (listenFd < 0) {
-        LOG(LogLevel::ERROR, "Failed to setup listener");
-        return 1;
+#if defined(__linux__)
+    const bool perLoopListener = netThreads > 1;
+#else
+    const bool perLoopListener = false;
+#endif
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    int sharedFd = -1;
+    for (int i = 0; i < netThreads; ++i) {
+        int listenFd = sharedFd;
+        if (perLoopListener || listenFd < 0) listenFd = net.setupListener("", 9999, perLoopListener);
+        if (listenFd < 0) {
+            LOG(LogLevel::ERROR, "Failed to setup listener");
+            return 1;
+        }
+        sharedFd = listenFd;
+        loops.push_back(std::make_unique<EventLoop>(controller));
+        if (!loops.back()->init(listenFd, pollerBackend)) {
+            LOG(LogLevel::ERROR, "Failed to init event loop");
+            return 1;
+        }
     }
 
-    EventLoop loop(controller);
-    if (!loop.init(listenFd)) {
-        LOG(LogLevel::ERROR, "Failed to init event loop");
-        return 1;
+    LOG(LogLevel::INFO, "Server running on port 9999 with " << netThreads << " network thread(s)");
+    // The main thread runs the first loop; the loops never return
+    for (size_t i = 1; i < loops.size(); ++i) {
+        std::thread([loop = loops[i].get()] { loop->run(); }).detach();
     }
-
-    LOG(LogLevel::INFO, "Server running on port 9999");
-    loop.run();
+    loops[0]->run();
 
     return 0;
 }